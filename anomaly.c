@@ -0,0 +1,44 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+
+#include <math.h>
+#include "config.h"
+#include "anomaly.h"
+
+int anomaly_update(anomaly_state_t* state, sensor_value_t value, double* zscore){
+    int flags = ANOMALY_NONE;
+    double z = 0;
+
+    if(state->count == 0){
+        state->mean = value;
+        state->variance = 0;
+    }
+    else{
+        // compare with the previous reading
+        double delta = fabs(value - state->last);
+        if(delta > ANOMALY_SPIKE_DELTA) flags |= ANOMALY_SPIKE;
+        if(delta <= ANOMALY_FLATLINE_EPSILON){
+            if(++(state->flat_count) == ANOMALY_FLATLINE_READINGS) flags |= ANOMALY_FLATLINE;
+        }
+        else state->flat_count = 0;
+
+        // compare with the moving average before the reading is added to it
+        if(state->count >= ANOMALY_WARMUP && state->variance > 0){
+            z = (value - state->mean) / sqrt(state->variance);
+            if(fabs(z) > ANOMALY_Z_THRESHOLD) flags |= ANOMALY_ZSCORE;
+        }
+
+        // incremental exponentially weighted mean and variance
+        double diff = value - state->mean;
+        double increment = ANOMALY_ALPHA * diff;
+        state->mean += increment;
+        state->variance = (1 - ANOMALY_ALPHA) * (state->variance + diff * increment);
+    }
+
+    state->last = value;
+    if(state->count < UINT32_MAX) state->count++;
+    if(zscore != NULL) *zscore = z;
+    return flags;
+}
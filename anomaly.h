@@ -0,0 +1,55 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _ANOMALY_H_
+#define _ANOMALY_H_
+
+#include "config.h"
+
+// weight of a new reading in the moving average and variance
+#ifndef ANOMALY_ALPHA
+#define ANOMALY_ALPHA 0.05
+#endif
+
+// a reading further than this many standard deviations from the moving average is an outlier
+#ifndef ANOMALY_Z_THRESHOLD
+#define ANOMALY_Z_THRESHOLD 4.0
+#endif
+
+// readings needed before the moving variance is trusted
+#ifndef ANOMALY_WARMUP
+#define ANOMALY_WARMUP 20
+#endif
+
+// a jump between two readings larger than this is a spike
+#ifndef ANOMALY_SPIKE_DELTA
+#define ANOMALY_SPIKE_DELTA 5.0
+#endif
+
+// a sensor is stuck after this many readings that changed less than ANOMALY_FLATLINE_EPSILON
+#ifndef ANOMALY_FLATLINE_READINGS
+#define ANOMALY_FLATLINE_READINGS 20
+#endif
+
+#ifndef ANOMALY_FLATLINE_EPSILON
+#define ANOMALY_FLATLINE_EPSILON 1e-6
+#endif
+
+// flags returned by anomaly_update
+#define ANOMALY_NONE     0
+#define ANOMALY_ZSCORE   1
+#define ANOMALY_SPIKE    2
+#define ANOMALY_FLATLINE 4
+
+/**
+ * Feeds a reading into the anomaly detector of a sensor, in O(1) time and without allocating memory
+ * A flat line is only reported once, on the reading that makes the sensor count as stuck.
+ * \param state the detector state of the sensor, zero initialised before the first reading
+ * \param value the new reading
+ * \param zscore filled out with the z-score of the reading against the moving average (0 during the warm up), can be NULL
+ * \return a combination of ANOMALY_ZSCORE, ANOMALY_SPIKE and ANOMALY_FLATLINE, or ANOMALY_NONE
+ */
+int anomaly_update(anomaly_state_t* state, sensor_value_t value, double* zscore);
+
+#endif /* _ANOMALY_H_ */
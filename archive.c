@@ -0,0 +1,325 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "archive.h"
+
+#define ARCHIVE_MAGIC "SGA1"
+#define ARCHIVE_MAGIC_LENGTH 4
+#define ARCHIVE_HEADER_LENGTH 28
+
+// the first reading takes 128 bits, the worst case of every other one is 4 + 64 bits for the timestamp
+// and 2 + 5 + 6 + 64 bits for the value
+#define ARCHIVE_BLOCK_BYTES (16 + (ARCHIVE_BLOCK_READINGS * 145 + 7) / 8)
+
+// the reader loads 8 bytes at a time, the buffer is padded so it never reads past its end
+#define ARCHIVE_READ_PADDING 8
+
+// the open block of one sensor
+typedef struct {
+    uint32_t count;
+    sensor_ts_t min_ts;
+    sensor_ts_t max_ts;
+    sensor_ts_t prev_ts;
+    int64_t prev_delta;
+    uint64_t prev_value;        // bits of the previous double
+    int prev_leading;           // window of meaningful bits of the previous XOR, -1 before the first one
+    int prev_trailing;
+    uint64_t acc;               // bits not written to 'bytes' yet
+    int acc_bits;
+    uint32_t length;
+    uint8_t bytes[ARCHIVE_BLOCK_BYTES];
+} archive_encoder_t;
+
+struct archive_writer {
+    FILE* fp;
+    bool failed;
+    archive_encoder_t* encoders[SENSOR_ID_RANGE];   // allocated on the first reading of a sensor
+};
+
+struct archive_reader {
+    uint8_t* data;
+    size_t length;
+    size_t position;
+};
+
+typedef struct {
+    const uint8_t* bytes;
+    uint64_t position;          // in bits
+} bit_reader_t;
+
+// helper methods
+static void archive_write_bits(archive_encoder_t* encoder, uint64_t value, int nbits);
+static void archive_encode_timestamp(archive_encoder_t* encoder, sensor_ts_t ts);
+static void archive_encode_value(archive_encoder_t* encoder, uint64_t value);
+static int archive_flush_block(archive_writer_t* writer, sensor_id_t sensor_id);
+static uint64_t archive_read_bits(bit_reader_t* reader, int nbits);
+static int archive_decode_block(const uint8_t* bytes, uint32_t length, sensor_id_t sensor_id, uint32_t count,
+    sensor_data_t* readings);
+
+archive_writer_t* archive_writer_open(const char* path){
+    archive_writer_t* writer = calloc(1, sizeof(archive_writer_t));
+    if(writer == NULL) return NULL;
+    writer->fp = fopen(path, "w");
+    if(writer->fp == NULL || fwrite(ARCHIVE_MAGIC, ARCHIVE_MAGIC_LENGTH, 1, writer->fp) != 1){
+        if(writer->fp != NULL) fclose(writer->fp);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+int archive_writer_add(archive_writer_t* writer, const sensor_data_t* data){
+    archive_encoder_t* encoder = writer->encoders[data->id];
+    if(encoder == NULL){
+        encoder = malloc(sizeof(archive_encoder_t));
+        if(encoder == NULL) return -1;
+        encoder->count = 0;
+        writer->encoders[data->id] = encoder;
+    }
+
+    uint64_t value;
+    memcpy(&value, &(data->value), sizeof(value));
+    if(encoder->count == 0){
+        // the first reading starts the stream with its timestamp and value as raw bits
+        encoder->min_ts = encoder->max_ts = encoder->prev_ts = data->ts;
+        encoder->prev_delta = 0;
+        encoder->prev_leading = -1;
+        encoder->prev_trailing = 0;
+        encoder->acc = 0;
+        encoder->acc_bits = 0;
+        encoder->length = 0;
+        archive_write_bits(encoder, (uint64_t) data->ts, 64);
+        archive_write_bits(encoder, value, 64);
+    } else {
+        archive_encode_timestamp(encoder, data->ts);
+        archive_encode_value(encoder, value);
+    }
+    encoder->prev_value = value;
+    if(data->ts < encoder->min_ts) encoder->min_ts = data->ts;
+    if(data->ts > encoder->max_ts) encoder->max_ts = data->ts;
+
+    if(++encoder->count == ARCHIVE_BLOCK_READINGS) return archive_flush_block(writer, data->id);
+    return 0;
+}
+
+long archive_writer_close(archive_writer_t** writer){
+    if(writer == NULL || *writer == NULL) return -1;
+    archive_writer_t* w = *writer;
+    for(int i = 0; i < SENSOR_ID_RANGE; i++){
+        if(w->encoders[i] == NULL) continue;
+        if(archive_flush_block(w, i) != 0) w->failed = true;
+        free(w->encoders[i]);
+    }
+
+    // the archive replaces rows in the database, it has to be on disk before they are dropped
+    long size = -1;
+    if(fflush(w->fp) == 0 && fsync(fileno(w->fp)) == 0 && !w->failed) size = ftell(w->fp);
+    if(fclose(w->fp) != 0) size = -1;
+    free(w);
+    *writer = NULL;
+    return size;
+}
+
+archive_reader_t* archive_reader_open(const char* path){
+    FILE* fp = fopen(path, "r");
+    if(fp == NULL) return NULL;
+
+    struct stat st;
+    archive_reader_t* reader = calloc(1, sizeof(archive_reader_t));
+    if(reader == NULL || fstat(fileno(fp), &st) != 0 || st.st_size < ARCHIVE_MAGIC_LENGTH){
+        free(reader);
+        fclose(fp);
+        return NULL;
+    }
+    reader->length = st.st_size;
+    reader->data = calloc(reader->length + ARCHIVE_READ_PADDING, 1);
+    if(reader->data == NULL || fread(reader->data, 1, reader->length, fp) != reader->length
+        || memcmp(reader->data, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LENGTH) != 0){
+        fclose(fp);
+        archive_reader_close(&reader);
+        return NULL;
+    }
+    fclose(fp);
+    reader->position = ARCHIVE_MAGIC_LENGTH;
+    return reader;
+}
+
+int archive_read_block(archive_reader_t* reader, int sensor_id, sensor_data_t* readings){
+    while(reader->position < reader->length){
+        if(reader->length - reader->position < ARCHIVE_HEADER_LENGTH) return -1;
+        const uint8_t* header = reader->data + reader->position;
+        uint16_t id;
+        uint32_t count, length;
+        memcpy(&id, header, sizeof(id));
+        memcpy(&count, header + 4, sizeof(count));
+        memcpy(&length, header + 24, sizeof(length));
+        if(count == 0 || count > ARCHIVE_BLOCK_READINGS
+            || length > reader->length - reader->position - ARCHIVE_HEADER_LENGTH) return -1;
+
+        const uint8_t* bytes = header + ARCHIVE_HEADER_LENGTH;
+        reader->position += ARCHIVE_HEADER_LENGTH + length;
+        if(sensor_id != ARCHIVE_ANY_SENSOR && sensor_id != id) continue;
+        return archive_decode_block(bytes, length, id, count, readings);
+    }
+    return 0;
+}
+
+void archive_reader_rewind(archive_reader_t* reader){
+    reader->position = ARCHIVE_MAGIC_LENGTH;
+}
+
+void archive_reader_close(archive_reader_t** reader){
+    if(reader == NULL || *reader == NULL) return;
+    free((*reader)->data);
+    free(*reader);
+    *reader = NULL;
+}
+
+// appends up to 64 bits to the stream of the encoder
+static void archive_write_bits(archive_encoder_t* encoder, uint64_t value, int nbits){
+    if(nbits > 32){
+        archive_write_bits(encoder, value >> 32, nbits - 32);
+        nbits = 32;
+    }
+    uint64_t mask = (nbits == 0) ? 0 : (UINT64_MAX >> (64 - nbits));
+    encoder->acc = (encoder->acc << nbits) | (value & mask);
+    encoder->acc_bits += nbits;
+    while(encoder->acc_bits >= 8){
+        encoder->bytes[encoder->length++] = (uint8_t)(encoder->acc >> (encoder->acc_bits - 8));
+        encoder->acc_bits -= 8;
+    }
+}
+
+// delta-of-delta: a sensor reporting at a fixed interval costs a single '0' bit per timestamp
+static void archive_encode_timestamp(archive_encoder_t* encoder, sensor_ts_t ts){
+    int64_t delta = ts - encoder->prev_ts;
+    int64_t dod = delta - encoder->prev_delta;
+    if(dod == 0) archive_write_bits(encoder, 0x0, 1);
+    else if(dod >= -63 && dod <= 64) archive_write_bits(encoder, (0x2 << 7) | (uint64_t)(dod + 63), 9);
+    else if(dod >= -255 && dod <= 256) archive_write_bits(encoder, (0x6 << 9) | (uint64_t)(dod + 255), 12);
+    else if(dod >= -2047 && dod <= 2048) archive_write_bits(encoder, (0xe << 12) | (uint64_t)(dod + 2047), 16);
+    else {
+        archive_write_bits(encoder, 0xf, 4);
+        archive_write_bits(encoder, (uint64_t) dod, 64);
+    }
+    encoder->prev_delta = delta;
+    encoder->prev_ts = ts;
+}
+
+// XOR with the previous value: '0' if equal, '10' + bits inside the previous window, '11' + a new window
+static void archive_encode_value(archive_encoder_t* encoder, uint64_t value){
+    uint64_t xor = value ^ encoder->prev_value;
+    if(xor == 0){
+        archive_write_bits(encoder, 0x0, 1);
+        return;
+    }
+
+    int leading = __builtin_clzll(xor);
+    int trailing = __builtin_ctzll(xor);
+    if(leading > 31) leading = 31;
+    if(encoder->prev_leading >= 0 && leading >= encoder->prev_leading && trailing >= encoder->prev_trailing){
+        archive_write_bits(encoder, 0x2, 2);
+        archive_write_bits(encoder, xor >> encoder->prev_trailing, 64 - encoder->prev_leading - encoder->prev_trailing);
+        return;
+    }
+
+    int meaningful = 64 - leading - trailing;
+    archive_write_bits(encoder, 0x3, 2);
+    archive_write_bits(encoder, leading, 5);
+    archive_write_bits(encoder, meaningful - 1, 6);
+    archive_write_bits(encoder, xor >> trailing, meaningful);
+    encoder->prev_leading = leading;
+    encoder->prev_trailing = trailing;
+}
+
+// writes the open block of a sensor to the file and empties it
+static int archive_flush_block(archive_writer_t* writer, sensor_id_t sensor_id){
+    archive_encoder_t* encoder = writer->encoders[sensor_id];
+    if(encoder->count == 0) return 0;
+    if(encoder->acc_bits > 0){
+        encoder->bytes[encoder->length++] = (uint8_t)(encoder->acc << (8 - encoder->acc_bits));
+        encoder->acc_bits = 0;
+    }
+
+    uint8_t header[ARCHIVE_HEADER_LENGTH] = {0};
+    memcpy(header, &sensor_id, sizeof(sensor_id));
+    memcpy(header + 4, &(encoder->count), sizeof(encoder->count));
+    memcpy(header + 8, &(encoder->min_ts), sizeof(encoder->min_ts));
+    memcpy(header + 16, &(encoder->max_ts), sizeof(encoder->max_ts));
+    memcpy(header + 24, &(encoder->length), sizeof(encoder->length));
+
+    encoder->count = 0;
+    if(fwrite(header, ARCHIVE_HEADER_LENGTH, 1, writer->fp) != 1) return -1;
+    if(fwrite(encoder->bytes, encoder->length, 1, writer->fp) != 1) return -1;
+    return 0;
+}
+
+// reads up to 64 bits from the stream, most significant bit first
+static inline uint64_t archive_read_bits(bit_reader_t* reader, int nbits){
+    if(nbits == 0) return 0;
+    if(nbits > 56){
+        uint64_t high = archive_read_bits(reader, nbits - 32);
+        return (high << 32) | archive_read_bits(reader, 32);
+    }
+    uint64_t word;
+    memcpy(&word, reader->bytes + (reader->position >> 3), sizeof(word));
+    word = __builtin_bswap64(word) << (reader->position & 7);
+    reader->position += nbits;
+    return word >> (64 - nbits);
+}
+
+static int archive_decode_block(const uint8_t* bytes, uint32_t length, sensor_id_t sensor_id, uint32_t count,
+    sensor_data_t* readings){
+    bit_reader_t reader = { bytes, 0 };
+    uint64_t limit = (uint64_t) length * 8;
+    if(limit < 128) return -1;
+
+    sensor_ts_t ts = (sensor_ts_t) archive_read_bits(&reader, 64);
+    uint64_t value = archive_read_bits(&reader, 64);
+    int64_t delta = 0;
+    int leading = 0, trailing = 0;
+    readings[0].id = sensor_id;
+    readings[0].ts = ts;
+    memcpy(&(readings[0].value), &value, sizeof(value));
+
+    for(uint32_t i = 1; i < count; i++){
+        // timestamp: count the '1' bits of the prefix, at most 4
+        int prefix = 0;
+        while(prefix < 4 && archive_read_bits(&reader, 1) == 1) prefix++;
+        int64_t dod;
+        switch(prefix){
+            case 0: dod = 0; break;
+            case 1: dod = (int64_t) archive_read_bits(&reader, 7) - 63; break;
+            case 2: dod = (int64_t) archive_read_bits(&reader, 9) - 255; break;
+            case 3: dod = (int64_t) archive_read_bits(&reader, 12) - 2047; break;
+            default: dod = (int64_t) archive_read_bits(&reader, 64); break;
+        }
+        delta += dod;
+        ts += delta;
+
+        // value
+        if(archive_read_bits(&reader, 1) == 1){
+            if(archive_read_bits(&reader, 1) == 1){
+                leading = (int) archive_read_bits(&reader, 5);
+                int meaningful = (int) archive_read_bits(&reader, 6) + 1;
+                trailing = 64 - leading - meaningful;
+                if(trailing < 0) return -1;
+            }
+            value ^= archive_read_bits(&reader, 64 - leading - trailing) << trailing;
+        }
+        if(reader.position > limit) return -1;
+
+        readings[i].id = sensor_id;
+        readings[i].ts = ts;
+        memcpy(&(readings[i].value), &value, sizeof(value));
+    }
+    return count;
+}
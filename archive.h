@@ -0,0 +1,85 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+#include "config.h"
+
+// readings in one compressed block, a block holds a single sensor
+#ifndef ARCHIVE_BLOCK_READINGS
+#define ARCHIVE_BLOCK_READINGS 1024
+#endif
+
+// directory the archive files of closed partitions are written to
+#ifndef ARCHIVE_DIR
+#define ARCHIVE_DIR "."
+#endif
+
+// sensor filter of archive_read_block that accepts every block
+#define ARCHIVE_ANY_SENSOR -1
+
+/*
+ * File format: the magic "SGA1", then blocks of
+ *     uint16 sensor_id, uint16 reserved, uint32 count, int64 min_ts, int64 max_ts, uint32 length, 'length' bytes
+ * in the byte order of the machine that wrote it.
+ * The bytes are a bit stream (most significant bit first) with the first timestamp and value as 64 raw bits, then per reading
+ * the timestamp as a delta-of-delta and the value XOR-ed with the previous one, as in Facebook's Gorilla paper.
+ */
+
+typedef struct archive_writer archive_writer_t;
+typedef struct archive_reader archive_reader_t;
+
+/**
+ * Creates a new archive file, an existing file is replaced
+ * \param path the path of the file
+ * \return a writer, or NULL if the file could not be created
+ */
+archive_writer_t* archive_writer_open(const char* path);
+
+/**
+ * Adds a reading to the open block of its sensor, a full block is written to the file
+ * Readings of a sensor compress best in timestamp order, but any order is stored losslessly.
+ * \param writer a pointer to the writer
+ * \param data the reading to add
+ * \return zero for success, -1 if the block could not be written
+ */
+int archive_writer_add(archive_writer_t* writer, const sensor_data_t* data);
+
+/**
+ * Writes the open blocks, syncs the file to disk and frees the writer
+ * \param writer a double pointer to the writer, set to NULL
+ * \return the size of the file in bytes, -1 if an error occurs
+ */
+long archive_writer_close(archive_writer_t** writer);
+
+/**
+ * Opens an archive file for scanning, the whole file is read into memory
+ * \param path the path of the file
+ * \return a reader positioned at the first block, or NULL if the file can not be read or is not an archive
+ */
+archive_reader_t* archive_reader_open(const char* path);
+
+/**
+ * Decodes the next block in one go, blocks of other sensors are skipped without decoding
+ * \param reader a pointer to the reader
+ * \param sensor_id the sensor to scan, or ARCHIVE_ANY_SENSOR
+ * \param readings filled out with up to ARCHIVE_BLOCK_READINGS readings
+ * \return the number of decoded readings, 0 at the end of the file and -1 if the file is corrupt
+ */
+int archive_read_block(archive_reader_t* reader, int sensor_id, sensor_data_t* readings);
+
+/**
+ * Moves the reader back to the first block
+ * \param reader a pointer to the reader
+ */
+void archive_reader_rewind(archive_reader_t* reader);
+
+/**
+ * Frees the reader and sets '*reader' to NULL
+ * \param reader a double pointer to the reader
+ */
+void archive_reader_close(archive_reader_t** reader);
+
+#endif /* _ARCHIVE_H_ */
@@ -0,0 +1,60 @@
+/**
+ * \author Alken Rrokaj
+ *
+ * Measures the cost of the streaming anomaly detector per reading
+ * usage: anomaly_bench [readings] [sensors]
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "config.h"
+#include "anomaly.h"
+
+#define DEFAULT_READINGS 50000000
+#define DEFAULT_SENSORS 1000
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end){
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char* argv[]){
+    long readings = (argc > 1) ? atol(argv[1]) : DEFAULT_READINGS;
+    int sensors = (argc > 2) ? atoi(argv[2]) : DEFAULT_SENSORS;
+
+    anomaly_state_t* states = calloc(sensors, sizeof(anomaly_state_t));
+    sensor_value_t* temperature = malloc(sensors * sizeof(sensor_value_t));
+    ERROR_HANDLER(states == NULL || temperature == NULL, "CANNOT ALLOCATE BENCHMARK STATE");
+
+    // pre-generate the noise so the benchmark does not measure drand48
+    #define NOISE_LENGTH 4096
+    double noise[NOISE_LENGTH];
+    srand48(42);
+    for(int i = 0; i < NOISE_LENGTH; i++) noise[i] = (drand48() - 0.5) / 4;
+    for(int i = 0; i < sensors; i++) temperature[i] = 15 + i % 10;
+
+    long anomalies = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < readings; i++){
+        int sensor = i % sensors;
+        temperature[sensor] += noise[i % NOISE_LENGTH];
+        if(anomaly_update(&states[sensor], temperature[sensor], NULL) != ANOMALY_NONE) anomalies++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = elapsed_seconds(&start, &end);
+    double ns_per_reading = seconds * 1e9 / readings;
+    printf("readings:             %ld over %d sensors\n", readings, sensors);
+    printf("anomalies flagged:    %ld\n", anomalies);
+    printf("time:                 %.3f s\n", seconds);
+    printf("cost per reading:     %.2f ns\n", ns_per_reading);
+    printf("throughput:           %.1f M readings/s\n", readings / seconds / 1e6);
+    printf("CPU at 1M readings/s: %.2f %% of one core\n", ns_per_reading * 1e6 / 1e9 * 100);
+    printf("state per sensor:     %zu bytes\n", sizeof(anomaly_state_t));
+
+    free(states);
+    free(temperature);
+    return 0;
+}
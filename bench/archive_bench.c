@@ -0,0 +1,119 @@
+/**
+ * \author Alken Rrokaj
+ *
+ * Compression ratio and decode speed of the sensor archive on a file_creator data file
+ * usage: archive_bench [sensor_data] [repeat]
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "config.h"
+#include "archive.h"
+
+#define ARCHIVE_BENCH_FILE "bench.sga"
+#define DEFAULT_REPEAT 20000
+
+// a reading in the sensor_data file: uint16 id, double value, time_t timestamp
+#define RAW_READING_BYTES (sizeof(sensor_id_t) + sizeof(sensor_value_t) + sizeof(sensor_ts_t))
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end){
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int compare_reading(const void* a, const void* b){
+    const sensor_data_t* x = a;
+    const sensor_data_t* y = b;
+    if(x->id != y->id) return (x->id > y->id) - (x->id < y->id);
+    if(x->ts != y->ts) return (x->ts > y->ts) - (x->ts < y->ts);
+    return (x->value > y->value) - (x->value < y->value);
+}
+
+static long read_sensor_data(const char* path, sensor_data_t** readings){
+    FILE* fp = fopen(path, "r");
+    if(fp == NULL) return -1;
+    long count = 0, capacity = 1024;
+    *readings = malloc(capacity * sizeof(sensor_data_t));
+    while(*readings != NULL){
+        sensor_data_t data;
+        if(fread(&data.id, sizeof(data.id), 1, fp) != 1) break;
+        if(fread(&data.value, sizeof(data.value), 1, fp) != 1) break;
+        if(fread(&data.ts, sizeof(data.ts), 1, fp) != 1) break;
+        if(count == capacity){
+            capacity *= 2;
+            *readings = realloc(*readings, capacity * sizeof(sensor_data_t));
+            if(*readings == NULL) break;
+        }
+        (*readings)[count++] = data;
+    }
+    fclose(fp);
+    return (*readings == NULL) ? -1 : count;
+}
+
+int main(int argc, char* argv[]){
+    const char* path = (argc > 1) ? argv[1] : "sensor_data";
+    long repeat = (argc > 2) ? atol(argv[2]) : DEFAULT_REPEAT;
+
+    sensor_data_t* readings;
+    long count = read_sensor_data(path, &readings);
+    ERROR_HANDLER(count <= 0, "CANNOT READ THE SENSOR DATA FILE, RUN file_creator FIRST");
+
+    // encode, the last pass leaves the archive behind for the decode and the size
+    struct timespec start, end;
+    long size = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long encode_passes = (repeat / 10 > 0) ? repeat / 10 : 1;
+    for(long pass = 0; pass < encode_passes; pass++){
+        archive_writer_t* writer = archive_writer_open(ARCHIVE_BENCH_FILE);
+        ERROR_HANDLER(writer == NULL, "CANNOT CREATE THE ARCHIVE");
+        for(long i = 0; i < count; i++) archive_writer_add(writer, &readings[i]);
+        size = archive_writer_close(&writer);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double encode_seconds = elapsed_seconds(&start, &end);
+    ERROR_HANDLER(size <= 0, "CANNOT WRITE THE ARCHIVE");
+
+    // decode every block 'repeat' times
+    archive_reader_t* reader = archive_reader_open(ARCHIVE_BENCH_FILE);
+    ERROR_HANDLER(reader == NULL, "CANNOT OPEN THE ARCHIVE");
+    sensor_data_t* decoded = malloc((count + ARCHIVE_BLOCK_READINGS) * sizeof(sensor_data_t));
+    ERROR_HANDLER(decoded == NULL, "CANNOT ALLOCATE THE DECODE BUFFER");
+    long total = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long pass = 0; pass < repeat; pass++){
+        archive_reader_rewind(reader);
+        long position = 0;
+        int n;
+        while((n = archive_read_block(reader, ARCHIVE_ANY_SENSOR, decoded + position)) > 0 && position + n <= count)
+            position += n;
+        total += position;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double decode_seconds = elapsed_seconds(&start, &end);
+    archive_reader_close(&reader);
+
+    // the archive is lossless: the same readings come back, grouped per sensor
+    long decoded_count = total / repeat;
+    qsort(readings, count, sizeof(sensor_data_t), compare_reading);
+    qsort(decoded, decoded_count, sizeof(sensor_data_t), compare_reading);
+    bool lossless = (decoded_count == count);
+    for(long i = 0; lossless && i < count; i++)
+        lossless = readings[i].id == decoded[i].id && readings[i].ts == decoded[i].ts
+            && memcmp(&readings[i].value, &decoded[i].value, sizeof(sensor_value_t)) == 0;
+
+    printf("readings:             %ld from %s\n", count, path);
+    printf("raw size:             %ld bytes (%zu bytes/reading)\n", count * (long) RAW_READING_BYTES, RAW_READING_BYTES);
+    printf("archive size:         %ld bytes (%.2f bytes/reading)\n", size, (double) size / count);
+    printf("compression ratio:    %.2fx\n", (double)(count * RAW_READING_BYTES) / size);
+    printf("encode:               %.1f M readings/s\n", encode_passes * count / encode_seconds / 1e6);
+    printf("decode:               %.1f M readings/s\n", total / decode_seconds / 1e6);
+    printf("lossless:             %s\n", lossless ? "yes" : "NO");
+
+    free(readings);
+    free(decoded);
+    unlink(ARCHIVE_BENCH_FILE);
+    return lossless ? 0 : -1;
+}
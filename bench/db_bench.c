@@ -0,0 +1,823 @@
+/**
+ * \author Alken Rrokaj
+ *
+ * Microbenchmarks for the storage path of the gateway
+ * usage: db_bench insert|commit|profiles|query|readers|export|aggregate|backends|recent [rows]
+ *        db_bench_partitioned archive [rows]
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+#include "config.h"
+#include "sensor_db.h"
+#include "archive.h"
+#include "storage.h"
+#include "tsdb.h"
+
+#define QUOTE(str) #str
+#define EXPAND_AND_QUOTE(str) QUOTE(str)
+#define DB_NAME_STRING EXPAND_AND_QUOTE(DB_NAME)
+#define TABLE_NAME_STRING EXPAND_AND_QUOTE(TABLE_NAME)
+
+#define DEFAULT_ROWS 200000
+
+// every autocommitted row waits for the disk, so that path only gets a sample
+#define AUTOCOMMIT_ROWS 2000
+
+// the query benchmark needs a table the size of a real deployment
+#define QUERY_DEFAULT_ROWS 50000000L
+#define QUERY_RUNS 200
+#define QUERY_SCAN_RUNS 3
+#define BENCH_SENSORS 100
+
+// a large export makes the per row conversion cost visible
+#define EXPORT_DEFAULT_ROWS 2000000L
+
+// the aggregate benchmark groups hourly, per sensor and per room of AGGREGATE_ROOM_SENSORS sensors
+#define AGGREGATE_DEFAULT_ROWS 10000000L
+#define AGGREGATE_BUCKET 3600
+#define AGGREGATE_ROOM_SENSORS 10
+
+// the recent benchmark asks for the last RECENT_SECONDS of a sensor or a room, RECENT_RUNS times each
+#define RECENT_SECONDS 300
+#define RECENT_RUNS 1000
+
+// reporting threads of the readers benchmark, each runs a range query and then pauses
+#define READER_THREADS 4
+#define READER_PAUSE_US 10000
+
+// the sensor_db module expects the synchronisation variables of the gateway
+static pthread_cond_t data_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t datamgr_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t db_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t connmgr_lock = PTHREAD_RWLOCK_INITIALIZER;
+static int data_mgr, data_sensor_db;
+static bool connmgr_working = true;
+
+static void bench_init_thread(){
+    config_thread_t config_thread = {
+        .data_cond = &data_cond,        .datamgr_lock = &datamgr_lock,  .data_mgr = &data_mgr,
+        .db_cond = &db_cond,            .db_lock = &db_lock,            .data_sensor_db = &data_sensor_db,
+        .connmgr_lock = &connmgr_lock,  .connmgr_working = &connmgr_working
+    };
+    sensor_db_init(&config_thread);
+}
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end){
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static sensor_data_t bench_reading(long i){
+    sensor_data_t data = {
+        .id = (sensor_id_t)(i % BENCH_SENSORS),
+        .value = 15 + (i % 1000) / 97.0,
+        .ts = 1700000000 + i / BENCH_SENSORS
+    };
+    return data;
+}
+
+// the old insert path: format the SQL text and run it through sqlite3_exec
+static double bench_insert_exec(long rows){
+    sqlite3* db;
+    sqlite3_open(DB_NAME_STRING, &db);
+    sqlite3_exec(db, "BEGIN", 0, 0, 0);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < rows; i++){
+        sensor_data_t data = bench_reading(i);
+        char* sql = sqlite3_mprintf("INSERT INTO `%s` (`sensor_id`, `sensor_value`, `timestamp`)"
+            "VALUES ('%d', '%f', '%ld');", TABLE_NAME_STRING, data.id, data.value, data.ts);
+        sqlite3_exec(db, sql, 0, 0, 0);
+        sqlite3_free(sql);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    sqlite3_exec(db, "COMMIT", 0, 0, 0);
+    sqlite3_close(db);
+    return elapsed_seconds(&start, &end);
+}
+
+// the prepared statement path of insert_sensor
+static double bench_insert_prepared(DBCONN* conn, long rows){
+    sql_query(conn, 0, sqlite3_mprintf("BEGIN"));
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < rows; i++){
+        sensor_data_t data = bench_reading(i);
+        insert_sensor(conn, data.id, data.value, data.ts);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    sql_query(conn, 0, sqlite3_mprintf("COMMIT"));
+    return elapsed_seconds(&start, &end);
+}
+
+static int bench_insert(long rows){
+    // both paths run inside one transaction, so only the per statement cost is compared
+    DBCONN* conn = init_connection(1);
+    if(conn == NULL) return -1;
+    double exec_seconds = bench_insert_exec(rows);
+    disconnect(conn);
+
+    conn = init_connection(1);
+    if(conn == NULL) return -1;
+    double prepared_seconds = bench_insert_prepared(conn, rows);
+    disconnect(conn);
+
+    printf("%-22s %12s %14s %12s\n", "insert path", "rows", "rows/s", "us/row");
+    printf("%-22s %12ld %14.0f %12.2f\n", "mprintf + exec", rows, rows / exec_seconds, exec_seconds * 1e6 / rows);
+    printf("%-22s %12ld %14.0f %12.2f\n", "prepared + bind", rows, rows / prepared_seconds, prepared_seconds * 1e6 / rows);
+    printf("speedup: %.2fx\n", exec_seconds / prepared_seconds);
+    return 0;
+}
+
+// one transaction per row, the way the listener stored readings before group commit
+static double bench_commit_autocommit(DBCONN* conn, long rows){
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < rows; i++){
+        sensor_data_t data = bench_reading(i);
+        insert_sensor(conn, data.id, data.value, data.ts);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_seconds(&start, &end);
+}
+
+static double bench_commit_grouped(DBCONN* conn, long rows){
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < rows; i++){
+        sensor_data_t data = bench_reading(i);
+        sensor_db_insert_batched(conn, &data);
+    }
+    sensor_db_commit(conn);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_seconds(&start, &end);
+}
+
+static int bench_commit(long rows){
+    long autocommit_rows = (rows < AUTOCOMMIT_ROWS) ? rows : AUTOCOMMIT_ROWS;
+    DBCONN* conn = init_connection(1);
+    if(conn == NULL) return -1;
+    double autocommit_seconds = bench_commit_autocommit(conn, autocommit_rows);
+    disconnect(conn);
+
+    conn = init_connection(1);
+    if(conn == NULL) return -1;
+    double grouped_seconds = bench_commit_grouped(conn, rows);
+    sensor_db_stats_t stats;
+    sensor_db_get_stats(conn, &stats);
+    disconnect(conn);
+
+    double autocommit_rate = autocommit_rows / autocommit_seconds;
+    double grouped_rate = rows / grouped_seconds;
+    printf("%-22s %12s %14s %12s\n", "commit mode", "rows", "rows/s", "us/row");
+    printf("%-22s %12ld %14.0f %12.2f\n", "autocommit", autocommit_rows, autocommit_rate, autocommit_seconds * 1e6 / autocommit_rows);
+    printf("%-22s %12ld %14.0f %12.2f\n", "group commit", rows, grouped_rate, grouped_seconds * 1e6 / rows);
+    if(stats.commits > 0)
+        printf("commits: %lu, rows/commit: avg %lu max %lu, commit latency: avg %lu us max %lu us\n",
+            stats.commits, stats.rows_committed / stats.commits, stats.rows_per_commit_max,
+            stats.commit_latency_total_us / stats.commits, stats.commit_latency_max_us);
+    printf("speedup: %.2fx\n", grouped_rate / autocommit_rate);
+    return 0;
+}
+
+static int compare_long(const void* a, const void* b){
+    long x = *(const long*) a, y = *(const long*) b;
+    return (x > y) - (x < y);
+}
+
+static long percentile(long* sorted, long count, double p){
+    long index = (long)(p * (count - 1));
+    return sorted[index];
+}
+
+// group commit inserts under every storage profile, with the latency of every single insert call
+static int bench_profiles(long rows){
+    long* latency_ns = malloc(rows * sizeof(long));
+    if(latency_ns == NULL) return -1;
+
+    printf("%-10s %-7s %-7s %12s %10s %10s %10s %10s %8s\n",
+        "profile", "journal", "sync", "rows/s", "p50 us", "p99 us", "p99.9 us", "max us", "ckpts");
+    for(db_profile_t profile = 0; profile < DB_PROFILE_COUNT; profile++){
+        unlink(DB_NAME_STRING);
+        sensor_db_set_profile(profile);
+        DBCONN* conn = init_connection(1);
+        if(conn == NULL){
+            free(latency_ns);
+            return -1;
+        }
+
+        struct timespec start, end, before, after;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(long i = 0; i < rows; i++){
+            sensor_data_t data = bench_reading(i);
+            clock_gettime(CLOCK_MONOTONIC, &before);
+            sensor_db_insert_batched(conn, &data);
+            clock_gettime(CLOCK_MONOTONIC, &after);
+            latency_ns[i] = (after.tv_sec - before.tv_sec) * 1000000000L + (after.tv_nsec - before.tv_nsec);
+        }
+        sensor_db_commit(conn);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        sensor_db_stats_t stats;
+        sensor_db_get_stats(conn, &stats);
+        disconnect(conn);
+
+        qsort(latency_ns, rows, sizeof(long), compare_long);
+        const sensor_db_profile_t* settings = sensor_db_get_profile(profile);
+        printf("%-10s %-7s %-7s %12.0f %10.2f %10.2f %10.2f %10.2f %8lu\n",
+            settings->name, settings->journal_mode, settings->synchronous, rows / elapsed_seconds(&start, &end),
+            percentile(latency_ns, rows, 0.50) / 1e3, percentile(latency_ns, rows, 0.99) / 1e3,
+            percentile(latency_ns, rows, 0.999) / 1e3, latency_ns[rows - 1] / 1e3, stats.checkpoints);
+    }
+    free(latency_ns);
+    return 0;
+}
+
+static long query_rows;
+
+// the find_sensor_* callbacks get no user argument, the rows are counted in a global
+static int count_rows(void* arg, int columns, char** values, char** names){
+    query_rows++;
+    return 0;
+}
+
+typedef int (*bench_query_t)(DBCONN* conn, long run, sensor_ts_t first_ts, sensor_ts_t last_ts);
+
+static int query_by_timestamp(DBCONN* conn, long run, sensor_ts_t first_ts, sensor_ts_t last_ts){
+    return find_sensor_by_timestamp(conn, first_ts + (run * 7919) % (last_ts - first_ts + 1), count_rows);
+}
+
+static int query_after_timestamp(DBCONN* conn, long run, sensor_ts_t first_ts, sensor_ts_t last_ts){
+    return find_sensor_after_timestamp(conn, last_ts - 60, count_rows);
+}
+
+static int query_by_id_in_range(DBCONN* conn, long run, sensor_ts_t first_ts, sensor_ts_t last_ts){
+    sensor_ts_t from = first_ts + (run * 7919) % (last_ts - first_ts + 1);
+    return find_sensor_by_id_in_range(conn, (sensor_id_t)(run % BENCH_SENSORS), from, from + 3600, count_rows);
+}
+
+static int query_by_id_after_timestamp(DBCONN* conn, long run, sensor_ts_t first_ts, sensor_ts_t last_ts){
+    return find_sensor_by_id_after_timestamp(conn, (sensor_id_t)(run % BENCH_SENSORS), last_ts - 600, count_rows);
+}
+
+static void bench_query_run(DBCONN* conn, const char* name, bench_query_t query, long runs, sensor_ts_t first_ts, sensor_ts_t last_ts){
+    long* latency_us = malloc(runs * sizeof(long));
+    if(latency_us == NULL) return;
+
+    query_rows = 0;
+    struct timespec before, after;
+    for(long run = 0; run < runs; run++){
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        query(conn, run, first_ts, last_ts);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        latency_us[run] = (long)(elapsed_seconds(&before, &after) * 1e6);
+    }
+    qsort(latency_us, runs, sizeof(long), compare_long);
+    printf("%-34s %6ld %10ld %12ld %12ld %12ld\n", name, runs, query_rows / runs,
+        percentile(latency_us, runs, 0.50), percentile(latency_us, runs, 0.99), latency_us[runs - 1]);
+    free(latency_us);
+}
+
+static void bench_query_all(DBCONN* conn, const char* label, long runs, sensor_ts_t first_ts, sensor_ts_t last_ts){
+    const char* names[] = {"find_sensor_by_timestamp", "find_sensor_after_timestamp (60s)",
+        "find_sensor_by_id_in_range (1h)", "find_sensor_by_id_after_ts (10m)"};
+    bench_query_t queries[] = {query_by_timestamp, query_after_timestamp, query_by_id_in_range, query_by_id_after_timestamp};
+    printf("%s\n%-34s %6s %10s %12s %12s %12s\n", label, "query", "runs", "rows/query", "p50 us", "p99 us", "max us");
+    for(int i = 0; i < 4; i++) bench_query_run(conn, names[i], queries[i], runs, first_ts, last_ts);
+}
+
+// bulk loads a synthetic table with the indexes deferred, then times the queries as full scans and through the indexes
+static int bench_query(long rows){
+    DBCONN* conn = init_connection(1);
+    if(conn == NULL) return -1;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sensor_db_bulk_load_begin(conn);
+    for(long i = 0; i < rows; i++){
+        sensor_data_t data = bench_reading(i);
+        if(sensor_db_insert_batched(conn, &data) != 0) break;
+    }
+    sensor_db_commit(conn);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double load_seconds = elapsed_seconds(&start, &end);
+    printf("loaded %ld rows in %.1f s (%.0f rows/s)\n", rows, load_seconds, rows / load_seconds);
+
+    sensor_ts_t first_ts = bench_reading(0).ts;
+    sensor_ts_t last_ts = bench_reading(rows - 1).ts;
+    bench_query_all(conn, "\nwithout indexes", QUERY_SCAN_RUNS, first_ts, last_ts);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sensor_db_bulk_load_end(conn);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("\nbuilt indexes in %.1f s\n", elapsed_seconds(&start, &end));
+    bench_query_all(conn, "\nwith indexes", QUERY_RUNS, first_ts, last_ts);
+
+    disconnect(conn);
+    return 0;
+}
+
+typedef struct {
+    db_pool_t* pool;
+    long queries;
+    long rows;
+    sensor_ts_t first_ts;
+    sensor_ts_t last_ts;
+} bench_reader_t;
+
+static atomic_bool readers_running;
+
+static int count_rows_arg(void* count, int columns, char** values, char** names){
+    (*(long*) count)++;
+    return 0;
+}
+
+// one reporting thread: ten minutes of a sensor through sensor_db_pool_query, over and over
+static void* bench_reader(void* arg){
+    bench_reader_t* reader = arg;
+    while(atomic_load(&readers_running)){
+        sensor_ts_t from = reader->first_ts + (reader->queries * 7919) % (reader->last_ts - reader->first_ts + 1);
+        char* sql = sqlite3_mprintf("SELECT `sensor_value`, `timestamp` FROM `%s` WHERE sensor_id = %u AND timestamp BETWEEN %ld AND %ld;",
+            TABLE_NAME_STRING, (unsigned)(reader->queries % BENCH_SENSORS), from, from + 600);
+        sensor_db_pool_query(reader->pool, sql, count_rows_arg, &(reader->rows));
+        sqlite3_free(sql);
+        reader->queries++;
+        usleep(READER_PAUSE_US);
+    }
+    return NULL;
+}
+
+static double bench_readers_ingest(DBCONN* conn, long first, long rows){
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = first; i < first + rows; i++){
+        sensor_data_t data = bench_reading(i);
+        sensor_db_insert_batched(conn, &data);
+    }
+    sensor_db_commit(conn);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_seconds(&start, &end);
+}
+
+// ingest throughput of the writer alone and with READER_THREADS reporting threads on the reader pool
+static int bench_readers(long rows){
+    DBCONN* conn = init_connection(1);
+    if(conn == NULL) return -1;
+    bench_readers_ingest(conn, 0, rows);    // data for the readers to find
+
+    db_pool_t* pool = sensor_db_pool_create(DB_READERS);
+    if(pool == NULL){
+        disconnect(conn);
+        return -1;
+    }
+
+    double alone_seconds = bench_readers_ingest(conn, rows, rows);
+
+    pthread_t threads[READER_THREADS];
+    bench_reader_t readers[READER_THREADS];
+    atomic_store(&readers_running, true);
+    for(int i = 0; i < READER_THREADS; i++){
+        readers[i] = (bench_reader_t){ .pool = pool, .first_ts = bench_reading(0).ts, .last_ts = bench_reading(rows - 1).ts };
+        pthread_create(&threads[i], NULL, &bench_reader, &readers[i]);
+    }
+    double shared_seconds = bench_readers_ingest(conn, 2 * rows, rows);
+    atomic_store(&readers_running, false);
+
+    long queries = 0, found = 0;
+    for(int i = 0; i < READER_THREADS; i++){
+        pthread_join(threads[i], NULL);
+        queries += readers[i].queries;
+        found += readers[i].rows;
+    }
+    sensor_db_pool_free(&pool);
+    disconnect(conn);
+
+    printf("%-30s %12s %14s\n", "writer", "rows", "rows/s");
+    printf("%-30s %12ld %14.0f\n", "alone", rows, rows / alone_seconds);
+    printf("%-30s %12ld %14.0f\n", "with reader pool", rows, rows / shared_seconds);
+    printf("readers: %d threads on %d connections, %ld queries (%.0f/s), %ld rows/query\n", READER_THREADS, DB_READERS,
+        queries, queries / shared_seconds, queries ? found / queries : 0);
+    return 0;
+}
+
+// an export has to turn every row back into a reading, from text for the callbacks and as numbers for the cursor
+static sensor_value_t export_sum;
+
+static int export_text_row(void* arg, int columns, char** values, char** names){
+    sensor_data_t data = { (sensor_id_t) atoi(values[1]), atof(values[2]), (sensor_ts_t) atol(values[3]) };
+    export_sum += data.value;
+    query_rows++;
+    return 0;
+}
+
+static int export_batch(void* arg, const sensor_data_t* batch, int count){
+    for(int i = 0; i < count; i++) export_sum += batch[i].value;
+    return 0;
+}
+
+// the full table through find_sensor_all and through sensor_db_scan, then a ranged cursor that stops after one batch
+static int bench_export(long rows){
+    DBCONN* conn = init_connection(1);
+    if(conn == NULL) return -1;
+    for(long i = 0; i < rows; i++){
+        sensor_data_t data = bench_reading(i);
+        sensor_db_insert_batched(conn, &data);
+    }
+    sensor_db_commit(conn);
+
+    struct timespec start, end;
+    query_rows = 0;
+    export_sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    find_sensor_all(conn, export_text_row);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double text_seconds = elapsed_seconds(&start, &end);
+    long text_rows = query_rows;
+    sensor_value_t text_sum = export_sum;
+
+    export_sum = 0;
+    db_range_t all = DB_RANGE_ALL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long cursor_rows = sensor_db_scan(conn, &all, export_batch, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double cursor_seconds = elapsed_seconds(&start, &end);
+
+    // the first batch of one sensor in a time window, the cursor is closed before it is exhausted
+    db_range_t window = DB_RANGE_ALL;
+    window.sensor_id = 1;
+    window.from = bench_reading(rows / 2).ts;
+    sensor_data_t batch[DB_CURSOR_BATCH];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    db_cursor_t* cursor = sensor_db_cursor_open(conn, &window);
+    int first_batch = (cursor != NULL) ? sensor_db_cursor_next(cursor, batch, DB_CURSOR_BATCH) : -1;
+    sensor_db_cursor_close(&cursor);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double early_seconds = elapsed_seconds(&start, &end);
+    disconnect(conn);
+
+    printf("%-34s %12s %14s %12s\n", "export", "rows", "rows/s", "seconds");
+    printf("%-34s %12ld %14.0f %12.3f\n", "find_sensor_all (text callback)", text_rows, text_rows / text_seconds, text_seconds);
+    printf("%-34s %12ld %14.0f %12.3f\n", "sensor_db_scan (typed batches)", cursor_rows, cursor_rows / cursor_seconds, cursor_seconds);
+    printf("%-34s %12d %14s %12.6f\n", "cursor, one batch of one sensor", first_batch, "-", early_seconds);
+    printf("same readings: %s\n", (text_rows == cursor_rows && text_sum == export_sum) ? "yes" : "NO");
+    return 0;
+}
+
+// hourly per sensor statistics computed in the callback, the way a report had to be built from find_sensor_all
+// rooms of AGGREGATE_ROOM_SENSORS sensors each
+static sensor_map_t* bench_rooms(){
+    FILE* fp_map = tmpfile();
+    if(fp_map == NULL) return NULL;
+    for(int id = 0; id < BENCH_SENSORS; id++) fprintf(fp_map, "%d %d\n", id / AGGREGATE_ROOM_SENSORS + 1, id);
+    rewind(fp_map);
+    sensor_map_t* rooms = sensor_map_load(fp_map);
+    fclose(fp_map);
+    return rooms;
+}
+
+static db_aggregate_t* pulled;
+static long pulled_buckets;
+static sensor_ts_t pulled_first_bucket;
+
+static int pull_row(void* arg, int columns, char** values, char** names){
+    sensor_id_t id = (sensor_id_t) atoi(values[1]);
+    sensor_value_t value = atof(values[2]);
+    long bucket = (atol(values[3]) / AGGREGATE_BUCKET) * AGGREGATE_BUCKET;
+    long slot = ((bucket - pulled_first_bucket) / AGGREGATE_BUCKET) * BENCH_SENSORS + id;
+    if(slot < 0 || slot >= pulled_buckets * BENCH_SENSORS) return 0;
+    db_aggregate_t* a = &pulled[slot];
+    if(a->count == 0 || value < a->min) a->min = value;
+    if(a->count == 0 || value > a->max) a->max = value;
+    a->avg += value;
+    a->count++;
+    return 0;
+}
+
+// hourly statistics per sensor and per room, pulled through the callback and computed by sensor_db_aggregate
+static int bench_aggregate(long rows){
+    DBCONN* conn = init_connection(1);
+    if(conn == NULL) return -1;
+    sensor_db_bulk_load_begin(conn);
+    for(long i = 0; i < rows; i++){
+        sensor_data_t data = bench_reading(i);
+        sensor_db_insert_batched(conn, &data);
+    }
+    sensor_db_bulk_load_end(conn);
+
+    sensor_map_t* rooms = bench_rooms();
+    if(rooms == NULL){
+        disconnect(conn);
+        return -1;
+    }
+
+    struct timespec start, end;
+    pulled_first_bucket = (bench_reading(0).ts / AGGREGATE_BUCKET) * AGGREGATE_BUCKET;
+    pulled_buckets = (bench_reading(rows - 1).ts - pulled_first_bucket) / AGGREGATE_BUCKET + 1;
+    pulled = calloc(pulled_buckets * BENCH_SENSORS, sizeof(db_aggregate_t));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    find_sensor_all(conn, pull_row);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double pull_seconds = elapsed_seconds(&start, &end);
+
+    db_range_t all = DB_RANGE_ALL;
+    db_aggregate_t* per_sensor = NULL;
+    db_aggregate_t* per_room = NULL;
+    db_aggregate_t* one_sensor = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long sensor_results = sensor_db_aggregate(conn, &all, AGGREGATE_BUCKET, NULL, &per_sensor);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sensor_seconds = elapsed_seconds(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long room_results = sensor_db_aggregate(conn, &all, AGGREGATE_BUCKET, rooms, &per_room);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double room_seconds = elapsed_seconds(&start, &end);
+
+    db_range_t day = DB_RANGE_ALL;
+    day.sensor_id = 1;
+    day.from = bench_reading(rows / 2).ts;
+    day.to = day.from + 86400;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long one_results = sensor_db_aggregate(conn, &day, AGGREGATE_BUCKET, NULL, &one_sensor);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double one_seconds = elapsed_seconds(&start, &end);
+
+    // the pushed down results have to match the ones computed from every row, up to the digits sqlite3_exec prints
+    bool same = (sensor_results > 0);
+    for(long i = 0; same && i < sensor_results; i++){
+        long slot = ((per_sensor[i].bucket - pulled_first_bucket) / AGGREGATE_BUCKET) * BENCH_SENSORS + per_sensor[i].key;
+        same = slot >= 0 && slot < pulled_buckets * BENCH_SENSORS && pulled[slot].count == per_sensor[i].count
+            && fabs(pulled[slot].min - per_sensor[i].min) < 1e-9 && fabs(pulled[slot].max - per_sensor[i].max) < 1e-9;
+    }
+
+    printf("%-40s %10s %12s\n", "hourly min/max/avg/count", "results", "seconds");
+    printf("%-40s %10ld %12.3f\n", "every row through find_sensor_all", pulled_buckets * BENCH_SENSORS, pull_seconds);
+    printf("%-40s %10ld %12.3f\n", "sensor_db_aggregate per sensor", sensor_results, sensor_seconds);
+    printf("%-40s %10ld %12.3f\n", "sensor_db_aggregate per room", room_results, room_seconds);
+    printf("%-40s %10ld %12.6f\n", "sensor_db_aggregate one sensor, one day", one_results, one_seconds);
+    printf("same results: %s\n", same ? "yes" : "NO");
+
+    free(pulled);
+    free(per_sensor);
+    free(per_room);
+    free(one_sensor);
+    sensor_map_free(&rooms);
+    disconnect(conn);
+    return same ? 0 : -1;
+}
+
+static int count_batch(void* count, const sensor_data_t* batch, int n){
+    *(long*) count += n;
+    return 0;
+}
+
+// the cost of each storage backend alone: batches of STORAGE_BATCH readings and a flush, then a full scan
+static int bench_backends(long rows){
+    const storage_backend_t* backends[] = { &storage_memory, &storage_file, &storage_tsdb, &storage_sqlite };
+    sensor_data_t batch[STORAGE_BATCH];
+    printf("%-10s %12s %14s %14s %14s\n", "backend", "rows", "insert rows/s", "scan rows/s", "rows found");
+    for(int b = 0; b < sizeof(backends) / sizeof(backends[0]); b++){
+        storage_t* storage = storage_open(backends[b], 1);
+        if(storage == NULL) return -1;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(long i = 0; i < rows; i += STORAGE_BATCH){
+            int count = (rows - i < STORAGE_BATCH) ? (int)(rows - i) : STORAGE_BATCH;
+            for(int j = 0; j < count; j++) batch[j] = bench_reading(i + j);
+            storage_insert_batch(storage, batch, count);
+        }
+        storage_flush(storage);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double insert_seconds = elapsed_seconds(&start, &end);
+
+        long found = 0;
+        db_range_t all = DB_RANGE_ALL;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        storage_query_range(storage, &all, count_batch, &found);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double scan_seconds = elapsed_seconds(&start, &end);
+
+        storage_close(&storage);
+        printf("%-10s %12ld %14.0f %14.0f %14ld\n", backends[b]->name, rows, rows / insert_seconds, found / scan_seconds, found);
+    }
+    unlink(STORAGE_FILE);
+    char path[64];
+    for(int number = 0; ; number++){
+        snprintf(path, sizeof(path), "%s/%s_%06d.seg", TSDB_DIR, TSDB_PREFIX, number);
+        if(unlink(path) != 0) break;
+    }
+    return 0;
+}
+
+static const sensor_map_t* room_filter_map;
+
+// counts the readings of room 1, what a room query without the cache has to do with a scan over every sensor
+static int count_room_batch(void* count, const sensor_data_t* batch, int n){
+    room_id_t room;
+    for(int i = 0; i < n; i++)
+        if(sensor_map_lookup(room_filter_map, batch[i].id, &room) && room == 1) (*(long*) count)++;
+    return 0;
+}
+
+// hot queries on the last minutes through the storage (and its cache) against the same queries on a SQLite connection
+static int bench_recent(long rows){
+    storage_t* storage = storage_open(&storage_sqlite, 1);
+    if(storage == NULL) return -1;
+    sensor_data_t batch[STORAGE_BATCH];
+    for(long i = 0; i < rows; i += STORAGE_BATCH){
+        int count = (rows - i < STORAGE_BATCH) ? (int)(rows - i) : STORAGE_BATCH;
+        for(int j = 0; j < count; j++) batch[j] = bench_reading(i + j);
+        storage_insert_batch(storage, batch, count);
+    }
+    storage_flush(storage);
+    DBCONN* conn = init_connection(0);
+    sensor_map_t* rooms = bench_rooms();
+    if(conn == NULL || rooms == NULL) return -1;
+    room_filter_map = rooms;
+
+    sensor_ts_t last_ts = bench_reading(rows - 1).ts;
+    db_range_t sensor_recent = DB_RANGE_ALL;
+    sensor_recent.sensor_id = 1;
+    sensor_recent.from = last_ts - RECENT_SECONDS;
+    db_range_t room_recent = DB_RANGE_ALL;
+    room_recent.from = last_ts - RECENT_SECONDS;
+    db_range_t sensor_day = sensor_recent;
+    sensor_day.from = last_ts - 86400;
+    db_range_t sensor_all = DB_RANGE_ALL;
+    sensor_all.sensor_id = 1;
+
+    struct timespec start, end;
+    long cached_found = 0, sqlite_found = 0;
+    sensor_data_t latest;
+    printf("%-38s %12s %12s %12s\n", "query", "readings", "storage us", "sqlite us");
+    for(int query = 0; query < 4; query++){
+        const char* names[] = { "one sensor, last 5 minutes", "room of 10 sensors, last 5 minutes", "latest value of a sensor", "one sensor, last day (past horizon)" };
+        cached_found = 0;
+        sqlite_found = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int run = 0; run < RECENT_RUNS; run++){
+            if(query == 0) storage_query_range(storage, &sensor_recent, count_batch, &cached_found);
+            else if(query == 1) storage_query_room(storage, rooms, 1, &room_recent, count_batch, &cached_found);
+            else if(query == 2) cached_found += (storage_latest(storage, 1, &latest) == 0);
+            else storage_query_range(storage, &sensor_day, count_batch, &cached_found);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double cached_seconds = elapsed_seconds(&start, &end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int run = 0; run < RECENT_RUNS; run++){
+            if(query == 0) sensor_db_scan(conn, &sensor_recent, count_batch, &sqlite_found);
+            else if(query == 1) sensor_db_scan(conn, &room_recent, count_room_batch, &sqlite_found);
+            else if(query == 2) sqlite_found += (sensor_db_scan(conn, &sensor_all, count_batch, &(long){0}) > 0);
+            else sensor_db_scan(conn, &sensor_day, count_batch, &sqlite_found);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double sqlite_seconds = elapsed_seconds(&start, &end);
+        printf("%-38s %12ld %12.1f %12.1f%s\n", names[query], cached_found / RECENT_RUNS, cached_seconds / RECENT_RUNS * 1e6,
+            sqlite_seconds / RECENT_RUNS * 1e6, (cached_found == sqlite_found) ? "" : "  DIFFERENT RESULTS");
+    }
+
+    storage_stats_t stats;
+    storage_get_stats(storage, &stats);
+    printf("cache: %lu range hits, %lu misses, %lu latest hits, %lu latest misses, %lu readings evicted\n", stats.cache.hits,
+        stats.cache.misses, stats.cache.latest_hits, stats.cache.latest_misses, stats.cache.evicted);
+    sensor_map_free(&rooms);
+    disconnect(conn);
+    storage_close(&storage);
+    return (cached_found == sqlite_found) ? 0 : -1;
+}
+
+// readings of the archive benchmark are ARCHIVE_INTERVAL seconds apart per sensor, so they span many partitions
+#define ARCHIVE_INTERVAL 60
+
+static sensor_data_t archive_reading(long i){
+    sensor_data_t data = bench_reading(i);
+    data.ts = 1700000000 + (i / BENCH_SENSORS) * ARCHIVE_INTERVAL;
+    return data;
+}
+
+// group commit into hourly partitions, with DB_ARCHIVE_PARTITIONS retention archives the oldest ones as it goes and
+// sensor_db_archive_partitions_before archives all but the newest; then every file is read back with archive_read_block
+static int bench_archive(long rows){
+    if(!DB_PARTITIONED || DB_PARTITION_SECONDS != 3600){
+        printf("the archive benchmark needs hourly partitions, run bench/db_bench_partitioned\n");
+        return -1;
+    }
+    DBCONN* conn = init_connection(1);
+    if(conn == NULL) return -1;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < rows; i++){
+        sensor_data_t data = archive_reading(i);
+        sensor_db_insert_batched(conn, &data);
+    }
+    sensor_db_commit(conn);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double insert_seconds = elapsed_seconds(&start, &end);
+    sensor_db_stats_t stats;
+    sensor_db_get_stats(conn, &stats);
+    unsigned long retention_rows = stats.archived_rows;
+
+    sensor_ts_t first = archive_reading(0).ts - archive_reading(0).ts % 3600;
+    sensor_ts_t newest = archive_reading(rows - 1).ts - archive_reading(rows - 1).ts % 3600;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int archived = sensor_db_archive_partitions_before(conn, newest);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double archive_seconds = elapsed_seconds(&start, &end);
+    sensor_db_get_stats(conn, &stats);
+    int kept = sensor_db_partition_count(conn);
+    disconnect(conn);
+    if(archived < 0) return -1;
+
+    // what went to the archives: every reading of the partitions before the newest one
+    long expected = 0;
+    double expected_sum = 0;
+    for(long i = 0; i < rows; i++){
+        sensor_data_t data = archive_reading(i);
+        if(data.ts >= newest) break;
+        expected++;
+        expected_sum += data.value;
+    }
+
+    long found = 0, bytes = 0;
+    int files = 0;
+    double sum = 0;
+    sensor_data_t* block = malloc(ARCHIVE_BLOCK_READINGS * sizeof(sensor_data_t));
+    if(block == NULL) return -1;
+    char path[128];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(sensor_ts_t partition = first; partition < newest; partition += 3600){
+        snprintf(path, sizeof(path), "%s/%s_%ld.sga", ARCHIVE_DIR, TABLE_NAME_STRING, partition);
+        archive_reader_t* reader = archive_reader_open(path);
+        if(reader == NULL) continue;
+        int n;
+        while((n = archive_read_block(reader, ARCHIVE_ANY_SENSOR, block)) > 0){
+            for(int j = 0; j < n; j++) sum += block[j].value;
+            found += n;
+        }
+        archive_reader_close(&reader);
+        if(n < 0) printf("corrupt archive: %s\n", path);
+        files++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double read_seconds = elapsed_seconds(&start, &end);
+    for(sensor_ts_t partition = first; partition < newest; partition += 3600){
+        snprintf(path, sizeof(path), "%s/%s_%ld.sga", ARCHIVE_DIR, TABLE_NAME_STRING, partition);
+        struct stat st;
+        if(stat(path, &st) == 0) bytes += st.st_size;
+        unlink(path);
+    }
+    free(block);
+
+    printf("%-34s %12s %14s\n", "step", "rows", "rows/s");
+    printf("%-34s %12ld %14.0f\n", "group commit, retention archives", rows, rows / insert_seconds);
+    printf("%-34s %12lu %14.0f\n", "archive_partitions_before", stats.archived_rows - retention_rows,
+        (stats.archived_rows - retention_rows) / archive_seconds);
+    printf("%-34s %12ld %14.0f\n", "archive_read_block", found, found / read_seconds);
+    printf("partitions: %d archived by retention (DB_RETENTION_PARTITIONS %d), %d on demand, %d kept; %d files\n",
+        (int)(stats.partitions_dropped - archived), DB_RETENTION_PARTITIONS, archived, kept, files);
+    printf("archives: %ld bytes, %.2f bytes/reading\n", bytes, found ? (double) bytes / found : 0);
+    bool same = (found == expected && (unsigned long) found == stats.archived_rows && fabs(sum - expected_sum) < 1e-6 * expected);
+    printf("read back %ld of %ld archived readings, values %s\n", found, expected, same ? "match" : "DIFFER");
+    return same ? 0 : -1;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        printf("usage: %s insert|commit|profiles|query|readers|export|aggregate|backends|recent|archive [rows]\n", argv[0]);
+        return -1;
+    }
+    long rows = (argc > 2) ? atol(argv[2]) : DEFAULT_ROWS;
+    bench_init_thread();
+
+    int result = -1;
+    if(strcmp(argv[1], "insert") == 0) result = bench_insert(rows);
+    else if(strcmp(argv[1], "commit") == 0) result = bench_commit(rows);
+    else if(strcmp(argv[1], "profiles") == 0) result = bench_profiles(rows);
+    else if(strcmp(argv[1], "readers") == 0) result = bench_readers(rows);
+    else if(strcmp(argv[1], "export") == 0) result = bench_export((argc > 2) ? rows : EXPORT_DEFAULT_ROWS);
+    else if(strcmp(argv[1], "aggregate") == 0) result = bench_aggregate((argc > 2) ? rows : AGGREGATE_DEFAULT_ROWS);
+    else if(strcmp(argv[1], "backends") == 0) result = bench_backends(rows);
+    else if(strcmp(argv[1], "recent") == 0) result = bench_recent(rows);
+    else if(strcmp(argv[1], "archive") == 0) result = bench_archive(rows);
+    else if(strcmp(argv[1], "query") == 0) result = bench_query((argc > 2) ? rows : QUERY_DEFAULT_ROWS);
+    else printf("unknown benchmark: %s\n", argv[1]);
+
+    unlink(DB_NAME_STRING);
+    return result;
+}
@@ -0,0 +1,107 @@
+/**
+ * \author Alken Rrokaj
+ *
+ * Cost of writing log events as text against the binary event log
+ * usage: log_bench [events]
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "config.h"
+#include "logger.h"
+#include "rotate.h"
+
+#define DEFAULT_EVENTS 2000000L
+#define BENCH_FILE "log_bench.tmp"
+
+// every event opens and closes the file, only a sample of them
+#define REOPEN_EVENTS 100000L
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end){
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static log_record_t bench_record(long i){
+    log_record_t record = {
+        .sequence = i,
+        .ts_ns = 1700000000000000000LL + i * 1000,
+        .value = 15 + (i % 1000) / 97.0,
+        .event = LOG_TOO_HOT + i % 3,
+        .sensor_id = i % 100
+    };
+    return record;
+}
+
+static long file_size(){
+    FILE* fp = fopen(BENCH_FILE, "r");
+    if(fp == NULL) return 0;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+static void report(const char* name, long events, struct timespec* start, struct timespec* end){
+    double seconds = elapsed_seconds(start, end);
+    printf("%-36s %10ld %12.1f %12.0f %10.1f\n", name, events, seconds / events * 1e9, events / seconds,
+        (double) file_size() / events);
+    unlink(BENCH_FILE);
+}
+
+int main(int argc, char* argv[]){
+    long events = (argc > 1) ? atol(argv[1]) : DEFAULT_EVENTS;
+    if(events <= 0){
+        printf("usage: %s [events]\n", argv[0]);
+        return -1;
+    }
+    long reopen_events = (events < REOPEN_EVENTS) ? events : REOPEN_EVENTS;
+    struct timespec start, end;
+    char line[256];
+    printf("%-36s %10s %12s %12s %10s\n", "writer", "events", "ns/event", "events/s", "bytes/event");
+
+    // what the threads did before the log process: open, fprintf, close for every event
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < reopen_events; i++){
+        log_record_t record = bench_record(i);
+        FILE* fp = fopen(BENCH_FILE, "a");
+        fprintf(fp, "\nSEQ_NR: %d  TIME: %ld\nSENSOR ID: %d TOO HOT! (AVG_TEMP = %f)\n", 1,
+            (long)(record.ts_ns / 1000000000LL), record.sensor_id, record.value);
+        fclose(fp);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("fopen, fprintf, fclose per event", reopen_events, &start, &end);
+
+    // formatted lines through a buffered FILE, what the log process writes with LOG_BINARY 0
+    FILE* fp = fopen(BENCH_FILE, "w");
+    static char file_buffer[ROTATE_BUFFER];
+    setvbuf(fp, file_buffer, _IOFBF, sizeof(file_buffer));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < events; i++){
+        log_record_t record = bench_record(i);
+        int length = logger_format(&record, line, sizeof(line));
+        fwrite(line, 1, length, fp);
+    }
+    fclose(fp);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("logger_format, buffered fwrite", events, &start, &end);
+
+    // packed records through the same buffer, the binary event log
+    fp = fopen(BENCH_FILE, "w");
+    setvbuf(fp, file_buffer, _IOFBF, sizeof(file_buffer));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fwrite(LOG_BINARY_MAGIC, 1, LOG_BINARY_MAGIC_LENGTH, fp);
+    for(long i = 0; i < events; i++){
+        log_record_t record = bench_record(i);
+        uint8_t packed[LOG_RECORD_LENGTH];
+        logger_pack(&record, packed);
+        fwrite(packed, 1, LOG_RECORD_LENGTH, fp);
+    }
+    fclose(fp);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("logger_pack, buffered fwrite", events, &start, &end);
+    return 0;
+}
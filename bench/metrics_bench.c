@@ -0,0 +1,110 @@
+/**
+ * \author Alken Rrokaj
+ *
+ * Cost of the instrumentation: counters and histograms of metrics.h per call, from one and from several threads,
+ * against one shared atomic counter, and the cost of rendering the endpoint
+ * usage: metrics_bench [operations] [threads]
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "metrics.h"
+
+#define DEFAULT_OPERATIONS 50000000L
+#define DEFAULT_THREADS 4
+#define RENDERS 1000
+
+typedef enum {
+    BENCH_COUNT,                // metrics_count
+    BENCH_OBSERVE,              // metrics_observe of a fixed duration
+    BENCH_TIMED_OBSERVE,        // clock_gettime, metrics_elapsed_ns and metrics_observe, what an instrumented call adds
+    BENCH_SHARED_ATOMIC         // atomic_fetch_add on one counter of all threads
+} bench_op_t;
+
+typedef struct {
+    bench_op_t op;
+    long operations;
+} bench_arg_t;
+
+static atomic_ullong shared_counter;
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end){
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void* bench_thread(void* arg){
+    bench_arg_t* bench = arg;
+    struct timespec start;
+    switch(bench->op){
+    case BENCH_COUNT:
+        for(long i = 0; i < bench->operations; i++) metrics_count(METRIC_READINGS_RECEIVED, 1);
+        break;
+    case BENCH_OBSERVE:
+        for(long i = 0; i < bench->operations; i++) metrics_observe(METRIC_STORAGE_INSERT, 1000 + (i & 0xffff));
+        break;
+    case BENCH_TIMED_OBSERVE:
+        for(long i = 0; i < bench->operations; i++){
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            metrics_observe(METRIC_STORAGE_COMMIT, metrics_elapsed_ns(&start));
+        }
+        break;
+    case BENCH_SHARED_ATOMIC:
+        for(long i = 0; i < bench->operations; i++) atomic_fetch_add_explicit(&shared_counter, 1, memory_order_relaxed);
+        break;
+    }
+    return NULL;
+}
+
+// runs 'op' on 'threads' threads at once and prints the wall time per operation over all threads
+static void bench_run(const char* name, bench_op_t op, long operations, int threads){
+    pthread_t ids[threads];
+    bench_arg_t arg = { .op = op, .operations = operations };
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < threads; i++) pthread_create(&ids[i], NULL, &bench_thread, &arg);
+    for(int i = 0; i < threads; i++) pthread_join(ids[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = elapsed_seconds(&start, &end);
+    printf("%-34s %8d %10.2f %14.0f\n", name, threads, seconds / (threads * operations) * 1e9, threads * operations / seconds);
+}
+
+int main(int argc, char* argv[]){
+    long operations = (argc > 1) ? atol(argv[1]) : DEFAULT_OPERATIONS;
+    int threads = (argc > 2) ? atoi(argv[2]) : DEFAULT_THREADS;
+    if(operations <= 0 || threads <= 0){
+        printf("usage: %s [operations] [threads]\n", argv[0]);
+        return -1;
+    }
+
+    // on fewer cores than threads the threads take turns, and the shared counter is not contended
+    printf("%ld online cpus\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-34s %8s %10s %14s\n", "operation", "threads", "ns/op", "ops/s");
+    bench_run("metrics_count", BENCH_COUNT, operations, 1);
+    bench_run("metrics_count", BENCH_COUNT, operations, threads);
+    bench_run("shared atomic_fetch_add", BENCH_SHARED_ATOMIC, operations, 1);
+    bench_run("shared atomic_fetch_add", BENCH_SHARED_ATOMIC, operations, threads);
+    bench_run("metrics_observe", BENCH_OBSERVE, operations, 1);
+    bench_run("metrics_observe", BENCH_OBSERVE, operations, threads);
+    bench_run("clock_gettime + metrics_observe", BENCH_TIMED_OBSERVE, operations / 10, 1);
+
+    // what a scrape costs the endpoint thread
+    char* body = NULL;
+    size_t body_length = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < RENDERS; i++){
+        FILE* out = open_memstream(&body, &body_length);
+        metrics_render(out);
+        fclose(out);
+        if(i < RENDERS - 1) free(body);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("metrics_render: %.1f us for %zu bytes\n", elapsed_seconds(&start, &end) / RENDERS * 1e6, body_length);
+    free(body);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * \author Alken Rrokaj
+ *
+ * Ingest rate and range queries of the native time-series engine
+ * usage: tsdb_bench [readings]
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include "config.h"
+#include "tsdb.h"
+
+#define DEFAULT_READINGS 20000000L
+#define BENCH_SENSORS 100
+#define BENCH_BATCH 256
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end){
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// the same readings as db_bench: BENCH_SENSORS sensors that report once a second
+static sensor_data_t bench_reading(long i){
+    sensor_data_t data = {
+        .id = (sensor_id_t)(i % BENCH_SENSORS),
+        .value = 15 + (i % 1000) / 97.0,
+        .ts = 1700000000 + i / BENCH_SENSORS
+    };
+    return data;
+}
+
+static int count_batch(void* count, const sensor_data_t* batch, int n){
+    *(long*) count += n;
+    return 0;
+}
+
+static void bench_query(tsdb_t* db, const char* name, const db_range_t* range){
+    tsdb_stats_t before, after;
+    struct timespec start, end;
+    long found = 0;
+    tsdb_get_stats(db, &before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tsdb_query(db, range, count_batch, &found);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    tsdb_get_stats(db, &after);
+    printf("%-34s %12ld %12.3f %10lu %10lu\n", name, found, elapsed_seconds(&start, &end) * 1e3,
+        after.chunks_scanned - before.chunks_scanned, after.chunks_pruned - before.chunks_pruned);
+}
+
+int main(int argc, char* argv[]){
+    long readings = (argc > 1) ? atol(argv[1]) : DEFAULT_READINGS;
+    if(readings < BENCH_SENSORS){
+        printf("usage: %s [readings >= %d]\n", argv[0], BENCH_SENSORS);
+        return -1;
+    }
+
+    // ingest, the close seals the open chunks and syncs the segment
+    tsdb_t* db = tsdb_open(".", 1);
+    ERROR_HANDLER(db == NULL, "CANNOT OPEN THE ENGINE");
+    sensor_data_t batch[BENCH_BATCH];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < readings; i += BENCH_BATCH){
+        int count = (readings - i < BENCH_BATCH) ? (int)(readings - i) : BENCH_BATCH;
+        for(int j = 0; j < count; j++) batch[j] = bench_reading(i + j);
+        ERROR_HANDLER(tsdb_insert_batch(db, batch, count) != 0, "CANNOT WRITE A CHUNK");
+    }
+    tsdb_stats_t stats;
+    tsdb_get_stats(db, &stats);
+    ERROR_HANDLER(tsdb_close(&db) != 0, "CANNOT CLOSE THE ENGINE");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ingest_seconds = elapsed_seconds(&start, &end);
+
+    // reopen, the index is rebuilt from the chunk headers
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    db = tsdb_open(".", 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ERROR_HANDLER(db == NULL, "CANNOT REOPEN THE ENGINE");
+    double open_seconds = elapsed_seconds(&start, &end);
+    tsdb_stats_t reopened;
+    tsdb_get_stats(db, &reopened);
+
+    printf("ingest:  %ld readings in %.2f s, %.2f M readings/s\n", readings, ingest_seconds, readings / ingest_seconds / 1e6);
+    printf("stored:  %lu bytes (%.1f bytes/reading) in %lu segments, %lu chunks\n", stats.bytes_written,
+        (double) stats.bytes_written / readings, reopened.segments, reopened.chunks_indexed);
+    printf("reopen:  %.1f ms to rebuild the index\n\n", open_seconds * 1e3);
+
+    sensor_ts_t last_ts = bench_reading(readings - 1).ts;
+    printf("%-34s %12s %12s %10s %10s\n", "query", "readings", "ms", "scanned", "pruned");
+    db_range_t recent = DB_RANGE_ALL;
+    recent.from = last_ts - 60;
+    bench_query(db, "after timestamp (last 60 s)", &recent);
+    db_range_t hour = DB_RANGE_ALL;
+    hour.sensor_id = 1;
+    hour.from = bench_reading(readings / 2).ts;
+    hour.to = hour.from + 3600;
+    bench_query(db, "one sensor, one hour", &hour);
+    db_range_t hot = DB_RANGE_ALL;
+    hot.min_value = 25;
+    bench_query(db, "value above 25 (full scan)", &hot);
+    db_range_t all = DB_RANGE_ALL;
+    bench_query(db, "everything", &all);
+    tsdb_close(&db);
+
+    char path[PATH_MAX];
+    for(int number = 0; ; number++){
+        snprintf(path, sizeof(path), "./%s_%06d.seg", TSDB_PREFIX, number);
+        if(unlink(path) != 0) break;
+    }
+    return 0;
+}
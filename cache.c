@@ -0,0 +1,207 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "config.h"
+#include "cache.h"
+
+// the latest readings of one sensor, 'oldest' is the slot of the reading that is dropped next
+typedef struct {
+    sensor_ts_t ts[CACHE_SENSOR_READINGS];
+    sensor_value_t value[CACHE_SENSOR_READINGS];
+    uint32_t oldest;
+    uint32_t count;
+    sensor_ts_t horizon;            // every reading of the sensor from this timestamp on is in the ring
+    sensor_ts_t newest_ts;          // the reading with the newest timestamp, kept apart from the ring
+    sensor_value_t newest_value;
+} cache_ring_t;
+
+// only the storage thread touches the cache, it fills it and answers the queries on the same thread
+struct cache {
+    sensor_ts_t complete_from;
+    sensor_ts_t max_horizon;        // the latest horizon of all sensors, what a query over every sensor must start at
+    cache_ring_t* rings[SENSOR_ID_RANGE];
+    sensor_id_t sensors[SENSOR_ID_RANGE];   // the sensors that have a ring, in the order they were first seen
+    int sensor_count;
+    unsigned long readings;
+    unsigned long evicted;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long latest_hits;
+    unsigned long latest_misses;
+};
+
+// where a query is in its output
+typedef struct {
+    const db_range_t* range;
+    batch_callback_t f;
+    void* arg;
+    sensor_data_t batch[DB_CURSOR_BATCH];
+    int count;
+    long total;
+    bool stop;
+} cache_output_t;
+
+// helper methods
+static sensor_ts_t cache_horizon(cache_t* cache, sensor_id_t sensor_id);
+static void cache_evict(cache_t* cache, cache_ring_t* ring);
+static void cache_emit_sensor(cache_t* cache, sensor_id_t sensor_id, cache_output_t* output);
+static void cache_emit_flush(cache_output_t* output);
+
+cache_t* cache_create(sensor_ts_t complete_from){
+    cache_t* cache = calloc(1, sizeof(cache_t));
+    if(cache == NULL) return NULL;
+    cache->complete_from = complete_from;
+    cache->max_horizon = complete_from;
+    return cache;
+}
+
+void cache_free(cache_t** cache){
+    if(cache == NULL || *cache == NULL) return;
+    for(int i = 0; i < (*cache)->sensor_count; i++) free((*cache)->rings[(*cache)->sensors[i]]);
+    free(*cache);
+    *cache = NULL;
+}
+
+void cache_insert_batch(cache_t* cache, const sensor_data_t* batch, int count){
+    for(int i = 0; i < count; i++){
+        cache_ring_t* ring = cache->rings[batch[i].id];
+        if(ring == NULL){
+            ring = malloc(sizeof(cache_ring_t));
+            if(ring == NULL){
+                // the sensor can not be cached, nothing from here on is complete
+                cache->complete_from = LONG_MAX;
+                cache->max_horizon = LONG_MAX;
+                continue;
+            }
+            ring->oldest = 0;
+            ring->count = 0;
+            ring->horizon = cache->complete_from;
+            ring->newest_ts = LONG_MIN;
+            ring->newest_value = 0;
+            cache->rings[batch[i].id] = ring;
+            cache->sensors[cache->sensor_count++] = batch[i].id;
+        }
+
+        if(ring->count == CACHE_SENSOR_READINGS) cache_evict(cache, ring);
+        uint32_t slot = (ring->oldest + ring->count) % CACHE_SENSOR_READINGS;
+        ring->ts[slot] = batch[i].ts;
+        ring->value[slot] = batch[i].value;
+        ring->count++;
+        if(batch[i].ts >= ring->newest_ts){
+            ring->newest_ts = batch[i].ts;
+            ring->newest_value = batch[i].value;
+        }
+        // readings leave in the order they came in, a late one stays until the ones before it are gone
+        while(ring->count > 0 && ring->ts[ring->oldest] < ring->newest_ts - CACHE_SECONDS) cache_evict(cache, ring);
+    }
+    cache->readings += count;
+}
+
+long cache_query_range(cache_t* cache, const db_range_t* range, batch_callback_t f, void* arg){
+    sensor_ts_t horizon = (range->sensor_id == DB_ANY_SENSOR) ? cache->max_horizon : cache_horizon(cache, range->sensor_id);
+    if(range->from < horizon){
+        cache->misses++;
+        return CACHE_MISS;
+    }
+
+    cache_output_t output = { .range = range, .f = f, .arg = arg };
+    if(range->sensor_id != DB_ANY_SENSOR)
+        cache_emit_sensor(cache, range->sensor_id, &output);
+    else
+        for(int i = 0; i < cache->sensor_count && !output.stop; i++) cache_emit_sensor(cache, cache->sensors[i], &output);
+    cache_emit_flush(&output);
+    cache->hits++;
+    return output.total;
+}
+
+long cache_query_room(cache_t* cache, const sensor_map_t* rooms, room_id_t room_id, const db_range_t* range, batch_callback_t f, void* arg){
+    // sensors without a ring have not reported since complete_from
+    sensor_ts_t horizon = cache->complete_from;
+    room_id_t room;
+    for(int i = 0; i < cache->sensor_count; i++){
+        sensor_id_t sensor_id = cache->sensors[i];
+        if(sensor_map_lookup(rooms, sensor_id, &room) && room == room_id && cache->rings[sensor_id]->horizon > horizon)
+            horizon = cache->rings[sensor_id]->horizon;
+    }
+    if(range->from < horizon){
+        cache->misses++;
+        return CACHE_MISS;
+    }
+
+    cache_output_t output = { .range = range, .f = f, .arg = arg };
+    for(int i = 0; i < cache->sensor_count && !output.stop; i++)
+        if(sensor_map_lookup(rooms, cache->sensors[i], &room) && room == room_id) cache_emit_sensor(cache, cache->sensors[i], &output);
+    cache_emit_flush(&output);
+    cache->hits++;
+    return output.total;
+}
+
+int cache_latest(cache_t* cache, sensor_id_t sensor_id, sensor_data_t* latest){
+    cache_ring_t* ring = cache->rings[sensor_id];
+    bool found = (ring != NULL && ring->newest_ts != LONG_MIN);
+    if(found){
+        latest->id = sensor_id;
+        latest->ts = ring->newest_ts;
+        latest->value = ring->newest_value;
+    }
+    if(found) cache->latest_hits++;
+    else cache->latest_misses++;
+    return found ? 0 : CACHE_MISS;
+}
+
+void cache_get_stats(cache_t* cache, cache_stats_t* stats){
+    stats->readings = cache->readings;
+    stats->evicted = cache->evicted;
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->latest_hits = cache->latest_hits;
+    stats->latest_misses = cache->latest_misses;
+}
+
+// the timestamp a query of one sensor must start at to be a hit
+static sensor_ts_t cache_horizon(cache_t* cache, sensor_id_t sensor_id){
+    cache_ring_t* ring = cache->rings[sensor_id];
+    if(ring == NULL || ring->horizon < cache->complete_from) return cache->complete_from;
+    return ring->horizon;
+}
+
+// drops the oldest reading of a ring, the sensor is no longer complete up to and including its timestamp
+static void cache_evict(cache_t* cache, cache_ring_t* ring){
+    sensor_ts_t ts = ring->ts[ring->oldest];
+    if(ts != LONG_MAX && ts + 1 > ring->horizon) ring->horizon = ts + 1;
+    if(ring->horizon > cache->max_horizon) cache->max_horizon = ring->horizon;
+    ring->oldest = (ring->oldest + 1) % CACHE_SENSOR_READINGS;
+    ring->count--;
+    cache->evicted++;
+}
+
+// adds the readings of one sensor that match the range to the output, oldest first
+static void cache_emit_sensor(cache_t* cache, sensor_id_t sensor_id, cache_output_t* output){
+    cache_ring_t* ring = cache->rings[sensor_id];
+    if(ring == NULL) return;
+    const db_range_t* range = output->range;
+    for(uint32_t i = 0; i < ring->count && !output->stop; i++){
+        uint32_t slot = (ring->oldest + i) % CACHE_SENSOR_READINGS;
+        if(ring->ts[slot] < range->from || ring->ts[slot] > range->to) continue;
+        if(ring->value[slot] < range->min_value || ring->value[slot] > range->max_value) continue;
+        sensor_data_t* data = &output->batch[output->count++];
+        data->id = sensor_id;
+        data->value = ring->value[slot];
+        data->ts = ring->ts[slot];
+        if(range->limit > 0 && output->total + output->count >= range->limit) output->stop = true;
+        if(output->count == DB_CURSOR_BATCH) cache_emit_flush(output);
+    }
+}
+
+// hands the collected batch to the callback
+static void cache_emit_flush(cache_output_t* output){
+    if(output->count == 0) return;
+    output->total += output->count;
+    if(output->f(output->arg, output->batch, output->count) != 0) output->stop = true;
+    output->count = 0;
+}
@@ -0,0 +1,102 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include "config.h"
+#include "sensor_db.h"
+#include "sensor_map.h"
+
+// seconds of readings every sensor keeps in the cache, counted back from its newest reading; 0 turns the cache off
+#ifndef CACHE_SECONDS
+#define CACHE_SECONDS 600
+#endif
+
+// readings per sensor at most, a sensor that reports faster than this over CACHE_SECONDS gets a shorter horizon
+#ifndef CACHE_SENSOR_READINGS
+#define CACHE_SENSOR_READINGS 1024
+#endif
+
+// the query could not be answered from the cache, it reaches back past the horizon of a sensor
+#define CACHE_MISS -2
+
+/*
+ * The cache keeps a ring of the latest readings per sensor, in the order they came in. A sensor 'covers' every
+ * timestamp from the oldest one it never dropped: a query hits when its 'from' is at or after the horizon of every
+ * sensor it asks for, anything earlier has to go to the storage backend.
+ * The cache has no lock, it is filled and queried by the storage thread only.
+ */
+typedef struct cache cache_t;
+
+typedef struct {
+    unsigned long readings;         // readings added
+    unsigned long evicted;          // readings dropped because they got too old or the ring was full
+    unsigned long hits;             // range queries answered from the cache
+    unsigned long misses;           // range queries that reached past the horizon
+    unsigned long latest_hits;      // latest value lookups answered from the cache
+    unsigned long latest_misses;    // latest value lookups of sensors the cache has not seen
+} cache_stats_t;
+
+/**
+ * Creates an empty cache
+ * \param complete_from the cache holds every reading from this timestamp on that is added later, LONG_MIN when the
+ *        storage behind it starts out empty
+ * \return the cache, or NULL if it can not be allocated
+ */
+cache_t* cache_create(sensor_ts_t complete_from);
+
+/**
+ * Frees the cache and sets '*cache' to NULL
+ * \param cache a double pointer to the cache
+ */
+void cache_free(cache_t** cache);
+
+/**
+ * Adds readings to the rings of their sensors and drops what falls out of CACHE_SECONDS
+ * \param cache a pointer to the cache
+ * \param batch the readings
+ * \param count the number of readings in 'batch'
+ */
+void cache_insert_batch(cache_t* cache, const sensor_data_t* batch, int count);
+
+/**
+ * Streams the cached readings that match 'range' to a callback, sensor by sensor
+ * \param cache a pointer to the cache
+ * \param range the predicates of the query
+ * \param f called for every batch, a non-zero return value ends the query early
+ * \param arg passed as the first argument of every callback
+ * \return the number of readings handed to the callback, or CACHE_MISS without calling 'f'
+ */
+long cache_query_range(cache_t* cache, const db_range_t* range, batch_callback_t f, void* arg);
+
+/**
+ * Like cache_query_range, for the sensors of one room (range->sensor_id is ignored)
+ * \param cache a pointer to the cache
+ * \param rooms the sensor map that puts sensors in rooms
+ * \param room_id the room
+ * \param range the predicates of the query
+ * \param f called for every batch, a non-zero return value ends the query early
+ * \param arg passed as the first argument of every callback
+ * \return the number of readings handed to the callback, or CACHE_MISS without calling 'f'
+ */
+long cache_query_room(cache_t* cache, const sensor_map_t* rooms, room_id_t room_id, const db_range_t* range, batch_callback_t f, void* arg);
+
+/**
+ * Looks up the reading with the newest timestamp of a sensor
+ * \param cache a pointer to the cache
+ * \param sensor_id the sensor
+ * \param latest filled out with the reading
+ * \return zero if the sensor has a reading in the cache, CACHE_MISS otherwise
+ */
+int cache_latest(cache_t* cache, sensor_id_t sensor_id, sensor_data_t* latest);
+
+/**
+ * Copies the counters of the cache
+ * \param cache a pointer to the cache
+ * \param stats filled out with the counters
+ */
+void cache_get_stats(cache_t* cache, cache_stats_t* stats);
+
+#endif /* _CACHE_H_ */
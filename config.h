@@ -29,9 +29,56 @@
 
 #define FIFO_NAME "logFifo"
 #define LOG_FILE "gateway.log"
+#define LOG_BINARY_FILE "gateway.evlog"
+#define SENSOR_MAP_FILE "room_sensor.map"
+#define RULES_FILE "room_sensor.rules"
+#define LATE_DATA_FILE "sensor_data_late"
+#define SENSOR_DATA_FILE "sensor_data_recv"
+#define RECORDER_FILE "sensor_data.rec"
 
 #ifndef RUN_AVG_LENGTH
 #define RUN_AVG_LENGTH 5
+#endif
+
+// set EVENT_TIME_WINDOW to 1 to average over time windows of the reading timestamps instead of the last RUN_AVG_LENGTH readings
+#ifndef EVENT_TIME_WINDOW
+#define EVENT_TIME_WINDOW 0
+#endif
+
+// readings held back per sensor to put them back in timestamp order
+#ifndef REORDER_BUFFER_LENGTH
+#define REORDER_BUFFER_LENGTH 8
+#endif
+
+// seconds a reading may lag behind the newest reading of its sensor before it is late
+#ifndef ALLOWED_LATENESS
+#define ALLOWED_LATENESS 30
+#endif
+
+// length and slide of the time windows in seconds, equal values give tumbling windows
+#ifndef WINDOW_LENGTH
+#define WINDOW_LENGTH 60
+#endif
+
+#ifndef WINDOW_SLIDE
+#define WINDOW_SLIDE WINDOW_LENGTH
+#endif
+
+#if WINDOW_SLIDE <= 0 || WINDOW_LENGTH % WINDOW_SLIDE != 0
+#error WINDOW_LENGTH must be a multiple of WINDOW_SLIDE
+#endif
+
+#define WINDOW_PANES (WINDOW_LENGTH / WINDOW_SLIDE)
+
+// the connmgr keeps the last RECORDER_READINGS readings in the RECORDER_FILE flight recorder, see recorder.h
+// set SENSOR_DATA_RECORDER to 0 to have every reading printed to SENSOR_DATA_FILE instead
+#ifndef SENSOR_DATA_RECORDER
+#define SENSOR_DATA_RECORDER 1
+#endif
+
+// set ANOMALY_DETECTION to 1 to run the streaming anomaly detector on every reading, see anomaly.h
+#ifndef ANOMALY_DETECTION
+#define ANOMALY_DETECTION 0
 #endif
  /*
   * Use ERROR_HANDLER() for handling memory allocation problems, invalid sensor IDs, non-existing files, etc.
@@ -51,6 +98,51 @@ typedef double sensor_value_t;
 typedef time_t sensor_ts_t;
 typedef struct pollfd pollfd_t;
 
+// every possible sensor_id_t (and room_id_t) gets a slot in a lookup table
+#define SENSOR_ID_RANGE (UINT16_MAX + 1)
+
+// alert state of a sensor, see rules.h
+typedef enum {
+    ALERT_NORMAL, ALERT_COLD, ALERT_HOT
+} alert_t;
+
+typedef struct {
+    alert_t state;              // state that was last reported
+    alert_t pending;            // state the sensor is moving to
+    sensor_ts_t pending_since;  // timestamp at which 'pending' started
+    sensor_ts_t last_alert;     // timestamp of the last reported alert, for the cooldown
+} alert_state_t;
+
+// structure to hold sensor_data
+typedef struct {
+    sensor_id_t id;         /** < sensorkk id */
+    sensor_value_t value;   /** < sensor value */
+    sensor_ts_t ts;         /** < sensor timestamp */
+} sensor_data_t;
+
+// event time window state of a sensor, see window.h
+typedef struct {
+    sensor_data_t reorder[REORDER_BUFFER_LENGTH + 1];   // held back readings sorted on timestamp, plus a slot for the new one
+    uint16_t reorder_count;
+    sensor_ts_t max_ts;                                 // newest timestamp seen
+    sensor_ts_t watermark;                              // readings older than this are late
+    sensor_ts_t pane_start;                             // start of the pane being filled, once 'pane_open'
+    bool pane_open;                                     // false until the first reading is released to a pane
+    sensor_value_t pane_sum[WINDOW_PANES];              // one pane per slide, the window is the sum of all panes
+    uint32_t pane_count[WINDOW_PANES];
+    uint16_t pane_position;
+    uint32_t late;                                      // readings that arrived behind the watermark
+} event_window_t;
+
+// streaming anomaly detector state of a sensor, see anomaly.h
+typedef struct {
+    double mean;                // exponentially weighted moving average
+    double variance;            // exponentially weighted moving variance
+    sensor_value_t last;        // previous reading
+    uint32_t count;             // readings seen, the z-score is only used after a warm up
+    uint32_t flat_count;        // consecutive readings that did not change
+} anomaly_state_t;
+
 // structure to hold sensors
 typedef struct{
     sensor_id_t sensor_id;
@@ -60,14 +152,10 @@ typedef struct{
     sensor_value_t data_buffer[RUN_AVG_LENGTH]; //circular buffer to hold the variables
     bool take_avg;
     uint16_t buffer_position;
-}sensor_t; //element t in the dplist
-
-// structure to hold sensor_data
-typedef struct {
-    sensor_id_t id;         /** < sensorkk id */
-    sensor_value_t value;   /** < sensor value */
-    sensor_ts_t ts;         /** < sensor timestamp */
-} sensor_data_t;
+    alert_state_t alert;
+    event_window_t window;
+    anomaly_state_t anomaly;
+}sensor_t; //window state of a sensor in the datamgr
 
 // structure for multi-threading
 typedef struct {
@@ -81,11 +169,6 @@ typedef struct {
 
     pthread_rwlock_t* connmgr_lock;
     bool* connmgr_working;
-
-    pthread_mutex_t* fifo_mutex;
-    int* fifo_fd;
-
-    pthread_mutex_t* log_mutex;
 } config_thread_t;
 
 #endif /* _CONFIG_H_ */
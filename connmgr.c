@@ -13,12 +13,27 @@
 #include "connmgr.h"
 #include "config.h"
 #include "sbuffer.h"
+#include "dedup.h"
+#include "rotate.h"
+#include "recorder.h"
+#include "logger.h"
+#include "metrics.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
 
 typedef struct pollfd pollfd_t;
 
+// returned by connmgr_add_sensor_data when a reading was already received
+#define CONNMGR_DUPLICATE -1
+
+// where the connmgr keeps the readings it received
+#if SENSOR_DATA_RECORDER
+typedef recorder_t sensor_data_sink_t;
+#else
+typedef rotate_t sensor_data_sink_t;
+#endif
+
 typedef struct{
 	pollfd_t file_d;
 	sensor_id_t sensor_id;
@@ -32,16 +47,19 @@ void element_free(void** element);
 int element_compare(void* x, void* y);
 
 // helper functions
-static void log_event(char* log_event, int sensor_id);
 int connmgr_add_sensor(poll_info_t** poll_at_index, int* list_size);
 int connmgr_add_sensor_data(sbuffer_t** buffer, poll_info_t** poll_at_index, sensor_data_t* sensor_data);
 void connmgr_remove_sensor(int* list_size, int index, poll_info_t** poll_at_index, poll_info_t* poll_server);
-void connmgr_close_connection(int port_number, poll_info_t** poll_at_index, poll_info_t* poll_server, FILE* fp_sensor_data_text);
+void connmgr_close_connection(int port_number, poll_info_t** poll_at_index, poll_info_t* poll_server, sensor_data_sink_t** sensor_data_sink);
+static sensor_data_sink_t* connmgr_open_sensor_data();
+static void connmgr_write_sensor_data(sensor_data_sink_t* sensor_data_sink, const sensor_data_t* sensor_data);
+static void connmgr_close_sensor_data(sensor_data_sink_t** sensor_data_sink);
 void connmgr_update_threads();
 void connmgr_close_threads();
 
 // global variables
 static dplist_t* dpl_connections;
+static dedup_table_t* dedup_table;	// per sensor state to drop readings that are sent twice
 // multithreading variables
 static pthread_cond_t* data_cond;
 static pthread_mutex_t* datamgr_lock;
@@ -54,10 +72,6 @@ static int* data_sensor_db;
 static pthread_rwlock_t* connmgr_lock;
 static bool* connmgr_working;
 
-static pthread_mutex_t* fifo_mutex;
-static pthread_mutex_t* log_mutex;
-static int* fifo_fd;
-
 void connmgr_init(config_thread_t* config_thread){
 	data_cond = config_thread->data_cond;
 	datamgr_lock = config_thread->datamgr_lock;
@@ -69,10 +83,6 @@ void connmgr_init(config_thread_t* config_thread){
 
 	connmgr_lock = config_thread->connmgr_lock;
 	connmgr_working = config_thread->connmgr_working;
-
-	fifo_fd = config_thread->fifo_fd;
-	fifo_mutex = config_thread->fifo_mutex;
-	log_mutex = config_thread->log_mutex;
 }
 
 
@@ -82,9 +92,11 @@ void connmgr_listen(int port_number, sbuffer_t** buffer){
 #endif
 	// create and initialize dpl_connections
 	dpl_connections = dpl_create(element_copy, element_free, element_compare);
+	dedup_table = dedup_create();
+	ERROR_HANDLER(dedup_table == NULL, "CANNOT ALLOCATE THE DUPLICATE FILTER");
 
-	// open file 
-	FILE* fp_sensor_data_text = fopen("sensor_data_recv", "w");
+	// open the flight recorder or the text file
+	sensor_data_sink_t* sensor_data_sink = connmgr_open_sensor_data();
 
 	//open tcp socket
 	tcpsock_t* socket;
@@ -131,22 +143,23 @@ void connmgr_listen(int port_number, sbuffer_t** buffer){
 			sensor_data_t sensor_data;
 
 			// add it in the buffer
-			if(connmgr_add_sensor_data(buffer, &(poll_at_index), &sensor_data) != TCP_NO_ERROR){
+			int result = connmgr_add_sensor_data(buffer, &(poll_at_index), &sensor_data);
+			if(result == TCP_NO_ERROR){
+				// update the datamgr and db threads
+				connmgr_update_threads();
+
+				// record it for a post-mortem
+				connmgr_write_sensor_data(sensor_data_sink, &sensor_data);
+#ifdef DEBUG
+				printf(PURPLE_CLR "CONNMGR: ID: %u   VAL: %f   TIME: %ld\n"OFF_CLR,
+					sensor_data.id, sensor_data.value, sensor_data.ts);
+#endif
+			}
+			else if(result != CONNMGR_DUPLICATE){
 				// if error remove the sensor
 				connmgr_remove_sensor(&list_size, index, &poll_at_index, &poll_server);
 				continue;
 			}
-
-			// update the datamgr and db threads
-			connmgr_update_threads();
-
-			// print it in the text file
-			fprintf(fp_sensor_data_text, "ID: %u   VAL: %f   TIME: %ld\n",
-				sensor_data.id, sensor_data.value, sensor_data.ts);
-#ifdef DEBUG
-			printf(PURPLE_CLR "CONNMGR: ID: %u   VAL: %f   TIME: %ld\n"OFF_CLR,
-				sensor_data.id, sensor_data.value, sensor_data.ts);
-#endif
 		}
 
 		// REMOVE THE SENSOR IF:
@@ -158,7 +171,7 @@ void connmgr_listen(int port_number, sbuffer_t** buffer){
 		// STOP THE CONNMGR IF:
 		// no sensors in the list && TIMEOUT seconds have passed
 		if(list_size == 1 && poll_server.last_modified < timeout_ts){
-			connmgr_close_connection(port_number, &poll_at_index, &poll_server, fp_sensor_data_text);
+			connmgr_close_connection(port_number, &poll_at_index, &poll_server, &sensor_data_sink);
 			break;
 		}
 
@@ -172,27 +185,67 @@ void connmgr_listen(int port_number, sbuffer_t** buffer){
 
 void connmgr_free(){
 	dpl_free(&dpl_connections, true);
+	dedup_free(&dedup_table);
+}
+
+unsigned long connmgr_get_duplicates(){
+	return (dedup_table == NULL) ? 0 : dedup_get_suppressed(dedup_table);
 }
 
-void connmgr_close_connection(int port_number, poll_info_t** poll_at_index, poll_info_t* poll_server, FILE* fp_sensor_data_text){
+void connmgr_close_connection(int port_number, poll_info_t** poll_at_index, poll_info_t* poll_server, sensor_data_sink_t** sensor_data_sink){
 	connmgr_close_threads();
-	tcp_close(&((*poll_at_index)->socket_id));
-	log_event("CLOSED CONNECTION MANAGER: ", port_number);
+	// the element at index 0 shares its socket with poll_server, do not close it twice
+	if((*poll_at_index)->socket_id != poll_server->socket_id)
+		tcp_close(&((*poll_at_index)->socket_id));
+	log_event(LOG_DUPLICATES_SUPPRESSED, 0, dedup_get_suppressed(dedup_table));
+	log_event(LOG_CONNMGR_CLOSED, 0, port_number);
 	tcp_close(&(poll_server->socket_id));
-	fclose(fp_sensor_data_text);
+	connmgr_close_sensor_data(sensor_data_sink);
 	connmgr_free();
 }
 
 
+static sensor_data_sink_t* connmgr_open_sensor_data(){
+#if SENSOR_DATA_RECORDER
+	recorder_t* recorder = recorder_open(RECORDER_FILE, RECORDER_READINGS);
+	ERROR_HANDLER(recorder == NULL, "CANNOT MAP " RECORDER_FILE);
+	return recorder;
+#else
+	// the text file rotates like the log
+	rotate_t* sensor_data_text = rotate_open(SENSOR_DATA_FILE, "w", NULL, 0);
+	ERROR_HANDLER(sensor_data_text == NULL, "CANNOT OPEN " SENSOR_DATA_FILE);
+	return sensor_data_text;
+#endif
+}
+
+static void connmgr_write_sensor_data(sensor_data_sink_t* sensor_data_sink, const sensor_data_t* sensor_data){
+#if SENSOR_DATA_RECORDER
+	recorder_record(sensor_data_sink, sensor_data);
+#else
+	int length = fprintf(rotate_stream(sensor_data_sink), "ID: %u   VAL: %f   TIME: %ld\n",
+		sensor_data->id, sensor_data->value, sensor_data->ts);
+	if(length > 0) rotate_account(sensor_data_sink, length);
+#endif
+}
+
+static void connmgr_close_sensor_data(sensor_data_sink_t** sensor_data_sink){
+#if SENSOR_DATA_RECORDER
+	recorder_close(sensor_data_sink);
+#else
+	rotate_close(sensor_data_sink);
+#endif
+}
+
 void connmgr_remove_sensor(int* list_size, int index, poll_info_t** poll_at_index, poll_info_t* poll_server){
 #ifdef DEBUG
 	printf(PURPLE_CLR "CLOSED CONNECTION SENSOR ID: %d\n"OFF_CLR, (*poll_at_index)->sensor_id);
 #endif
 	// remove the sensor
-	log_event("CLOSED CONNECTION SENSOR ID:", (*poll_at_index)->sensor_id);
+	log_event(LOG_CONNECTION_CLOSED, (*poll_at_index)->sensor_id, 0);
 	tcp_close(&((*poll_at_index)->socket_id));
 	dpl_connections = dpl_remove_at_index(dpl_connections, index, true);
 	(*list_size)--; // decrement the list size
+	metrics_gauge_add(METRIC_CONNECTIONS_OPEN, -1);
 
 	// update the last modified time of the poll_server
 	poll_server->last_modified = time(NULL);
@@ -227,6 +280,8 @@ int connmgr_add_sensor(poll_info_t** poll_at_index, int* list_size){
 	// insert the sensor in the list
 	dpl_connections = dpl_insert_at_index(dpl_connections, &insert_sensor, dpl_size(dpl_connections), true);
 	(*list_size)++; //update list_size
+	metrics_count(METRIC_CONNECTIONS_ACCEPTED, 1);
+	metrics_gauge_add(METRIC_CONNECTIONS_OPEN, 1);
 	return TCP_NO_ERROR;
 }
 
@@ -255,7 +310,7 @@ int connmgr_add_sensor_data(sbuffer_t** buffer, poll_info_t** poll_at_index, sen
 
 		// update the sensor ID and log the event
 		(*poll_at_index)->sensor_id = sensor_data->id;
-		log_event("NEW CONNECTION SENSOR ID:", (*poll_at_index)->sensor_id);
+		log_event(LOG_CONNECTION_NEW, (*poll_at_index)->sensor_id, 0);
 #ifdef DEBUG
 		printf(PURPLE_CLR "NEW CONNECTION SENSOR ID: %d\n"OFF_CLR, (*poll_at_index)->sensor_id);
 #endif
@@ -264,8 +319,18 @@ int connmgr_add_sensor_data(sbuffer_t** buffer, poll_info_t** poll_at_index, sen
 	//update the poll_at_index time
 	(*poll_at_index)->last_modified = sensor_data->ts;
 
+	// a sensor that reconnects may send the same readings again
+	if(dedup_is_duplicate(dedup_table, sensor_data)){
+#ifdef DEBUG
+		printf(PURPLE_CLR "CONNMGR: DUPLICATE READING ID: %u   TIME: %ld\n"OFF_CLR, sensor_data->id, sensor_data->ts);
+#endif
+		metrics_count(METRIC_READINGS_DUPLICATE, 1);
+		return CONNMGR_DUPLICATE;
+	}
+
 	if(sbuffer_insert(*buffer, sensor_data) != SBUFFER_SUCCESS)
 		printf("CONNMGR: SBUFFER ERROR\n");
+	metrics_count(METRIC_READINGS_RECEIVED, 1);
 	return TCP_NO_ERROR;
 }
 
@@ -329,12 +394,3 @@ int element_compare(void* x, void* y){
 	sensor_id_t y_id = ((poll_info_t*) y)->sensor_id;
 	return (x_id == y_id) ? 0 : ((x_id > y_id) ? 1 : -1);
 }
-
-
-// log event
-static void log_event(char* log_event, int sensor_id){
-	// open gateway in append mode
-	FILE* fp_log = fopen("gateway.log", "a");
-	fprintf(fp_log, "\nSEQ_NR: 2  TIME: %ld\n%s %d\n", time(NULL), log_event, sensor_id);
-	fclose(fp_log);
-}
@@ -20,8 +20,9 @@ void connmgr_init(config_thread_t* config_thread);
 
 /**
  * This method holds the core functionality of the connmgr. 
- * It starts listening on the given port and when when a sensor node connects it writes the data to a sensor_data_recv file.
- * This file must have the same format as the sensor_data file in assignment 6 and 7.
+ * It starts listening on the given port and when when a sensor node connects it puts the data in the buffer.
+ * The last readings are kept in the RECORDER_FILE flight recorder, or with SENSOR_DATA_RECORDER 0 printed to a
+ * sensor_data_recv file.
  * \param port_number port number to listen too
  * \param buffer to write data too
  */
@@ -33,4 +34,10 @@ void connmgr_listen(int port_number, sbuffer_t** buffer);
  */
 void connmgr_free();
 
+/**
+ * Returns the number of readings that were dropped because the same (id, ts, value) reading was already received
+ * \return the number of suppressed duplicates
+ */
+unsigned long connmgr_get_duplicates();
+
 #endif
\ No newline at end of file
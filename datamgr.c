@@ -5,37 +5,47 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
 #include "config.h"
 #include "sbuffer.h"
-#include "lib/dplist.h"
+#include "sensor_map.h"
+#include "rules.h"
+#include "window.h"
+#include "anomaly.h"
 #include "datamgr.h"
+#include "logger.h"
+#include "metrics.h"
 
 // definition of error codes
-#define DPLIST_NO_ERROR 0
-#define DPLIST_MEMORY_ERROR 1 // error due to mem alloc failure
-#define DPLIST_INVALID_ERROR 2 //error due to a list operation applied on a NULL list 
 #define ERROR_NULL_POINTER 3
 
-// used in log_event
-typedef enum {
-    COLD, HOT, ERROR
-} DATAMGR_CASE;
-
-// global variables
-static dplist_t* sensor_list;
+// how often the map watcher checks if the gateway is shutting down (ms)
+#define MAP_WATCH_TIMEOUT 1000
 
 // helper methods
-static void log_event(sensor_id_t id, sensor_value_t temp, DATAMGR_CASE check);
-void datamgr_read_sensor_map(FILE* fp_sensor_map);
 void datamgr_add_sensor_data(sensor_data_t* new_data);
-
-// methods for dpl_create
-void sensor_free(void** element);
-void* sensor_copy(void* element);
-int sensor_compare(void* x, void* y);
+static void datamgr_sync_sensor_map();
+static void* datamgr_watch_sensor_map(void* arg);
+static bool datamgr_reload_sensor_map();
+static void datamgr_check_alerts(sensor_t* sns);
+static void datamgr_window_closed(void* arg, const window_result_t* result);
+static void datamgr_route_late_data(sensor_data_t* data);
+static void datamgr_check_anomalies(sensor_t* sns, sensor_value_t value);
 
 // global variables
-static dplist_t* sensor_list;
+static sensor_map_t* sensor_map;                 // map used by the datamgr thread
+static _Atomic(sensor_map_t*) pending_map;       // freshly loaded map waiting to be swapped in
+static rule_table_t* rule_table;                 // alert rules, loaded once at startup
+static FILE* fp_late_data;                       // readings that arrived behind the watermark
+static unsigned long late_readings;
+static sensor_t* sensors[SENSOR_ID_RANGE];       // window state of every sensor that sent data
+static pthread_t map_watcher;
 
 static pthread_cond_t* data_cond;
 static pthread_mutex_t* datamgr_lock;
@@ -48,9 +58,6 @@ static int* data_sensor_db;
 static pthread_rwlock_t* connmgr_lock;
 static bool* connmgr_working;
 
-static pthread_mutex_t* fifo_mutex;
-static int* fifo_fd;
-
 void datamgr_init(config_thread_t* config_thread){
     data_cond = config_thread->data_cond;
     datamgr_lock = config_thread->datamgr_lock;
@@ -62,20 +69,38 @@ void datamgr_init(config_thread_t* config_thread){
 
     connmgr_lock = config_thread->connmgr_lock;
     connmgr_working = config_thread->connmgr_working;
-
-    fifo_fd = config_thread->fifo_fd;
-    fifo_mutex = config_thread->fifo_mutex;
 }
 
 void datamgr_parse_sensor_files(FILE* fp_sensor_map, sbuffer_t** sbuffer){
 #ifdef DEBUG
     printf(GREEN_CLR "DATAMGR: INITIATING DATAMGR.\n"OFF_CLR);
 #endif
-    // initialize the sensor_list
-    sensor_list = dpl_create(sensor_copy, sensor_free, sensor_compare);
+    if(fp_sensor_map == NULL){
+        fprintf(stderr, "Error: NULL pointer fp_sensor_map\n");
+        exit(ERROR_NULL_POINTER);
+    }
 
     // read the sensor_map file
-    datamgr_read_sensor_map(fp_sensor_map);
+    sensor_map = sensor_map_load(fp_sensor_map);
+    ERROR_HANDLER(sensor_map == NULL, "CANNOT READ THE SENSOR MAP");
+#ifdef DEBUG
+    printf(GREEN_CLR "DATAMGR: LOADED %d SENSORS.\n"OFF_CLR, sensor_map_size(sensor_map));
+#endif
+
+    // read the alert rules, without a rules file every sensor uses SET_MIN_TEMP and SET_MAX_TEMP
+    FILE* fp_rules = fopen(RULES_FILE, "r");
+    rule_table = rules_load(fp_rules);
+    if(fp_rules != NULL) fclose(fp_rules);
+    ERROR_HANDLER(rule_table == NULL, "CANNOT LOAD THE ALERT RULES");
+
+    // in event time mode late readings are set aside in their own file
+    if(EVENT_TIME_WINDOW){
+        fp_late_data = fopen(LATE_DATA_FILE, "w");
+        ERROR_HANDLER(fp_late_data == NULL, "CANNOT OPEN THE LATE DATA FILE");
+    }
+
+    // reload the map on SIGHUP or when the file changes, without stopping the datamgr
+    pthread_create(&map_watcher, NULL, &datamgr_watch_sensor_map, NULL);
 
     // parse sensor_data, and insert it to the appropriate sensor
     while(*connmgr_working){
@@ -101,177 +126,285 @@ void datamgr_parse_sensor_files(FILE* fp_sensor_map, sbuffer_t** sbuffer){
             break;
         }
 
-        //add the sensor_data to the sensor_list
+        // pick up a reloaded map before handling the data
+        datamgr_sync_sensor_map();
+
+        //add the sensor_data to its sensor
         datamgr_add_sensor_data(&new_data);
         
         pthread_mutex_lock(datamgr_lock);
         (*data_mgr)--;
         pthread_mutex_unlock(datamgr_lock);
     }
-}
 
-void datamgr_read_sensor_map(FILE* fp_sensor_map){
-    if(fp_sensor_map == NULL){
-        fprintf(stderr, "Error: NULL pointer fp_sensor_map\n");
-        exit(ERROR_NULL_POINTER);
+    // the watcher stops by itself once the connmgr is closed
+    pthread_join(map_watcher, NULL);
+
+    // the readings still held back and the last pane of every sensor make their final windows
+    if(EVENT_TIME_WINDOW){
+        for(int i = 0; i < SENSOR_ID_RANGE; i++)
+            if(sensors[i] != NULL) window_flush(&(sensors[i]->window), datamgr_window_closed, sensors[i]);
     }
 
-    //add the room_id and sensor_id to the sensor_list
-    while(!feof(fp_sensor_map)){
-        //read each line in str unless empty/NULL 
-        char str[8];
-        if(fgets(str, 8, fp_sensor_map) == NULL) continue;
-
-        //parse the room_id and sensor_id
-        sensor_id_t s_id;
-        room_id_t r_id;
-        sscanf(str, "%hu %hu", &r_id, &s_id);
-
-        // initialize the sensor
-        sensor_t sens = {
-            .room_id = r_id,  .sensor_id = s_id,
-            .running_avg = 0.0,     .last_modified = 0,
-            .buffer_position = 0,   .take_avg = false
-        };
-#ifdef DEBUG
-        printf(GREEN_CLR "DATAMGR: NEW SENSOR ID: %d  ROOM ID: %d\n"OFF_CLR, sens.sensor_id, sens.room_id);
-#endif
-        //add the sensor_t to the sensor_list
-        sensor_list = dpl_insert_at_index(sensor_list, &sens, 0, true);
+    if(fp_late_data != NULL){
+        fclose(fp_late_data);
+        fp_late_data = NULL;
     }
 }
 
 void datamgr_add_sensor_data(sensor_data_t* new_data){
-    //find element in list where sensor_id = buffer_id and add the element
-    bool added = false;
+    // only sensors in the map are tracked
+    room_id_t room_id;
+    if(!sensor_map_lookup(sensor_map, new_data->id, &room_id)){
+#ifdef DEBUG
+        printf(GREEN_CLR "DATAMGR: DID NOT ADD DATA\n" OFF_CLR);
+#endif
+        return;
+    }
 
+    // the window state is created on the first reading of a sensor
+    sensor_t* sns = sensors[new_data->id];
+    if(sns == NULL){
+        sns = calloc(1, sizeof(sensor_t));
+        ERROR_HANDLER(sns == NULL, "CANNOT ALLOCATE SENSOR");
+        sns->sensor_id = new_data->id;
+        sensors[new_data->id] = sns;
+    }
+    sns->room_id = room_id;
 
-    for(int i = 0; i < dpl_size(sensor_list);i++){
-        sensor_t* sns = dpl_get_element_at_index(sensor_list, i);
+    // the anomaly detector looks at every raw reading, not at the average
+    if(ANOMALY_DETECTION) datamgr_check_anomalies(sns, new_data->value);
 
-        // if the sensor_id is not the same, continue
-        if(sns->sensor_id != new_data->id) continue;
+    // in event time mode the average is updated when a time window closes
+    if(EVENT_TIME_WINDOW){
+        if(window_add(&(sns->window), new_data, datamgr_window_closed, sns) == WINDOW_LATE)
+            datamgr_route_late_data(new_data);
+        return;
+    }
 
-        //add the new data point in the circular buffer
-        sns->data_buffer[sns->buffer_position] = new_data->value;
+    //add the new data point in the circular buffer
+    sns->data_buffer[sns->buffer_position] = new_data->value;
 
-        //update buffer pointer position
-        sns->buffer_position++;
+    //update buffer pointer position
+    sns->buffer_position++;
 
-        //act as a circular buffer
-        if(sns->buffer_position == RUN_AVG_LENGTH){
-            sns->buffer_position = 0;
-            sns->take_avg = true; //if the buffer is full, start taking the average
-        }
+    //act as a circular buffer
+    if(sns->buffer_position == RUN_AVG_LENGTH){
+        sns->buffer_position = 0;
+        sns->take_avg = true; //if the buffer is full, start taking the average
+    }
 
-        //update the timestamp
-        sns->last_modified = new_data->ts;
-                
-        added = true;
+    //update the timestamp
+    sns->last_modified = new_data->ts;
 
-        //if the buffer is not full we don't take the average
-        if(sns->take_avg == false){
+    //if the buffer is not full we don't take the average
+    if(sns->take_avg == false){
 #ifdef DEBUG
-            printf(GREEN_CLR "DATAMGR: ID: %u ROOM: %d  AVG: %f   TIME: %ld\n" OFF_CLR,
-                sns->sensor_id, sns->room_id, sns->running_avg, sns->last_modified);
+        printf(GREEN_CLR "DATAMGR: ID: %u ROOM: %d  AVG: %f   TIME: %ld\n" OFF_CLR,
+            sns->sensor_id, sns->room_id, sns->running_avg, sns->last_modified);
 #endif
-            continue;
-        }
+        return;
+    }
 
-        //update the running average
-        sensor_value_t avg = 0;
+    //update the running average
+    sensor_value_t avg = 0;
 
-        // calculate sum of all elements in the buffer
-        for(int i = 0; i < RUN_AVG_LENGTH; i++) avg = avg + sns->data_buffer[i];
+    // calculate sum of all elements in the buffer
+    for(int i = 0; i < RUN_AVG_LENGTH; i++) avg = avg + sns->data_buffer[i];
 
-        // calculate the average
-        sns->running_avg = (avg / RUN_AVG_LENGTH);
+    // calculate the average
+    sns->running_avg = (avg / RUN_AVG_LENGTH);
 
-        // log in case it is an extreme
-        if(sns->running_avg > SET_MAX_TEMP) log_event(sns->sensor_id, sns->running_avg, HOT);
-        if(sns->running_avg < SET_MIN_TEMP) log_event(sns->sensor_id, sns->running_avg, COLD);
+    datamgr_check_alerts(sns);
 #ifdef DEBUG
-        printf(GREEN_CLR "DATAMGR: ID: %u ROOM: %d  AVG: %f   TIME: %ld\n" OFF_CLR,
-                sns->sensor_id, sns->room_id, sns->running_avg, sns->last_modified);
+    printf(GREEN_CLR "DATAMGR: ID: %u ROOM: %d  AVG: %f   TIME: %ld\n" OFF_CLR,
+            sns->sensor_id, sns->room_id, sns->running_avg, sns->last_modified);
 #endif
+}
+
+// only log when the alert state of the sensor changes
+static void datamgr_check_alerts(sensor_t* sns){
+    const rule_t* rule = rules_lookup(rule_table, sns->sensor_id, sns->room_id);
+    if(!rules_evaluate(rule, &(sns->alert), sns->running_avg, sns->last_modified)) return;
+
+    switch(sns->alert.state){
+    case ALERT_HOT:
+        log_event(LOG_TOO_HOT, sns->sensor_id, sns->running_avg);
+        metrics_count(METRIC_ALERTS_HOT, 1);
+        break;
+    case ALERT_COLD:
+        log_event(LOG_TOO_COLD, sns->sensor_id, sns->running_avg);
+        metrics_count(METRIC_ALERTS_COLD, 1);
+        break;
+    case ALERT_NORMAL:
+        log_event(LOG_BACK_IN_RANGE, sns->sensor_id, sns->running_avg);
+        metrics_count(METRIC_ALERTS_NORMAL, 1);
+        break;
+    }
+}
+
+// logs outliers, spikes and flat lines in the readings of a sensor
+static void datamgr_check_anomalies(sensor_t* sns, sensor_value_t value){
+    double zscore;
+    int anomalies = anomaly_update(&(sns->anomaly), value, &zscore);
+    if(anomalies == ANOMALY_NONE) return;
+
+    if(anomalies & ANOMALY_ZSCORE){
+        log_event(LOG_OUTLIER, sns->sensor_id, zscore);
+        metrics_count(METRIC_ANOMALIES_OUTLIER, 1);
     }
-    if(!added){
+    if(anomalies & ANOMALY_SPIKE){
+        log_event(LOG_SPIKE, sns->sensor_id, value);
+        metrics_count(METRIC_ANOMALIES_SPIKE, 1);
+    }
+    if(anomalies & ANOMALY_FLATLINE){
+        log_event(LOG_STUCK, sns->sensor_id, value);
+        metrics_count(METRIC_ANOMALIES_STUCK, 1);
+    }
+}
+
+// a time window of the sensor in 'arg' closed, its average becomes the running average
+static void datamgr_window_closed(void* arg, const window_result_t* result){
+    sensor_t* sns = (sensor_t*) arg;
+    sns->running_avg = result->avg;
+    sns->last_modified = result->end;
+    datamgr_check_alerts(sns);
 #ifdef DEBUG
-        printf(GREEN_CLR "DATAMGR: DID NOT ADD DATA\n" OFF_CLR);
+    printf(GREEN_CLR "DATAMGR: ID: %u ROOM: %d  WINDOW: %ld - %ld  READINGS: %u  AVG: %f\n" OFF_CLR,
+            sns->sensor_id, sns->room_id, result->start, result->end, result->count, result->avg);
+#endif
+}
+
+// late readings never reach the windows, they are kept in LATE_DATA_FILE
+static void datamgr_route_late_data(sensor_data_t* data){
+    late_readings++;
+    fprintf(fp_late_data, "ID: %u   VAL: %f   TIME: %ld\n", data->id, data->value, data->ts);
+#ifdef DEBUG
+    printf(GREEN_CLR "DATAMGR: LATE READING ID: %u   TIME: %ld\n" OFF_CLR, data->id, data->ts);
 #endif
-    }
 }
 
 void datamgr_free(){
-    dpl_free(&sensor_list, true);
+    for(int i = 0; i < SENSOR_ID_RANGE; i++){
+        free(sensors[i]);
+        sensors[i] = NULL;
+    }
+    sensor_map_t* pending = atomic_exchange(&pending_map, NULL);
+    sensor_map_free(&pending);
+    sensor_map_free(&sensor_map);
+    rules_free(&rule_table);
 }
 
 
 room_id_t datamgr_get_room_id(sensor_id_t sensor_id){
-    for(int i = 0; i < dpl_size(sensor_list); i++){
-        sensor_t* sensor = (sensor_t*) dpl_get_element_at_index(sensor_list, i);
-        if(sensor->sensor_id == sensor_id) return sensor->room_id;
-    }
-    return 0;
+    room_id_t room_id;
+    return sensor_map_lookup(sensor_map, sensor_id, &room_id) ? room_id : 0;
 }
 
 
 sensor_value_t datamgr_get_avg(sensor_id_t sensor_id){
-    for(int i = 0; i < dpl_size(sensor_list); i++){
-        sensor_t* sensor = (sensor_t*) dpl_get_element_at_index(sensor_list, i);
-        if(sensor->sensor_id == sensor_id) return sensor->running_avg;
-    }
-    return 0;
+    return (sensors[sensor_id] == NULL) ? 0 : sensors[sensor_id]->running_avg;
 }
 
 
 time_t datamgr_get_last_modified(sensor_id_t sensor_id){
-    for(int i = 0; i < dpl_size(sensor_list); i++){
-        sensor_t* sensor = (sensor_t*) dpl_get_element_at_index(sensor_list, i);
-        if(sensor->sensor_id == sensor_id) return sensor->last_modified;
-    }
-    return 0;
+    return (sensors[sensor_id] == NULL) ? 0 : sensors[sensor_id]->last_modified;
 }
 
 
 int datamgr_get_total_sensors(){
-    return dpl_size(sensor_list);
+    return sensor_map_size(sensor_map);
 }
 
-void sensor_free(void** element){
-    free(*element);
-    *element = NULL;
+
+unsigned long datamgr_get_late_readings(){
+    return late_readings;
 }
 
-void* sensor_copy(void* element){
-    sensor_t* sensor = (sensor_t*) element;
-    sensor_t* copy = malloc(sizeof(sensor_t));
-    copy->sensor_id = sensor->sensor_id;
-    copy->room_id = sensor->room_id;
-    copy->running_avg = sensor->running_avg;
-    copy->last_modified = sensor->running_avg;
-    return (void*) copy;
+// swaps in a map published by the watcher, only called from the datamgr thread
+static void datamgr_sync_sensor_map(){
+    sensor_map_t* next = atomic_exchange(&pending_map, NULL);
+    if(next == NULL) return;
+
+    // keep the window state of sensors that are still mapped, drop the others
+    for(int i = 0; i < SENSOR_ID_RANGE; i++){
+        if(sensors[i] == NULL || sensor_map_lookup(next, i, NULL)) continue;
+        free(sensors[i]);
+        sensors[i] = NULL;
+    }
+    sensor_map_free(&sensor_map);
+    sensor_map = next;
+#ifdef DEBUG
+    printf(GREEN_CLR "DATAMGR: SWAPPED IN SENSOR MAP WITH %d SENSORS.\n"OFF_CLR, sensor_map_size(sensor_map));
+#endif
 }
 
-int sensor_compare(void* x, void* y){
-    sensor_t* sensor_y = (sensor_t*) y;
-    sensor_t* sensor_x = (sensor_t*) x;
-    if(sensor_y->sensor_id == sensor_x->sensor_id) return 0;
-    if(sensor_y->sensor_id < sensor_x->sensor_id) return 1;
-    if(sensor_y->sensor_id > sensor_x->sensor_id) return -1;
-    else return -1;
+// parses the map file off the hot path and publishes it for the datamgr thread
+static bool datamgr_reload_sensor_map(){
+    FILE* fp_sensor_map = fopen(SENSOR_MAP_FILE, "r");
+    sensor_map_t* next = sensor_map_load(fp_sensor_map);
+    if(fp_sensor_map != NULL) fclose(fp_sensor_map);
+    if(next == NULL){
+        log_event(LOG_MAP_RELOAD_FAILED, 0, 0);
+        return false;
+    }
+
+    // a map that was never picked up is replaced by the newer one
+    int size = sensor_map_size(next);
+    sensor_map_t* stale = atomic_exchange(&pending_map, next);
+    sensor_map_free(&stale);
+    log_event(LOG_MAP_RELOADED, 0, size);
+    return true;
 }
 
-// log event
-static void log_event(sensor_id_t id, sensor_value_t temp, DATAMGR_CASE check){
-    FILE* fp_log = fopen("gateway.log", "a");
-    switch(check){
-    case COLD:
-        fprintf(fp_log, "\nSEQ_NR: %d  TIME: %ld\nSENSOR ID: %d TOO HOT! (AVG_TEMP = %f)\n", COLD, time(NULL), id, temp);
-    case HOT:
-        fprintf(fp_log, "\nSEQ_NR: %d  TIME: %ld\nSENSOR ID: %d TOO HOT! (AVG_TEMP = %f)\n", HOT, time(NULL), id, temp);
-    case ERROR:
-        fprintf(fp_log, "\nSEQ_NR: %d  TIME: %ld\nSENSOR DATA FROM INVALID SENSOR ID: %d\n", ERROR, time(NULL), id);
+// waits for a SIGHUP or an inotify event on the map file and reloads it
+static void* datamgr_watch_sensor_map(void* arg){
+    // SIGHUP is blocked in every thread, so it can be read from a signalfd here
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    // watch the directory, editors often replace the file instead of writing it
+    char directory[256] = ".";
+    const char* file_name = SENSOR_MAP_FILE;
+    const char* slash = strrchr(SENSOR_MAP_FILE, '/');
+    if(slash != NULL){
+        snprintf(directory, sizeof(directory), "%.*s", (int)(slash - SENSOR_MAP_FILE), SENSOR_MAP_FILE);
+        file_name = slash + 1;
+    }
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd >= 0) inotify_add_watch(inotify_fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+
+    pollfd_t watch[2] = {
+        { .fd = signal_fd, .events = POLLIN },
+        { .fd = inotify_fd, .events = POLLIN }
+    };
+
+    while(*connmgr_working){
+        if(poll(watch, 2, MAP_WATCH_TIMEOUT) <= 0) continue;
+        bool reload = false;
+
+        if(watch[0].revents & POLLIN){
+            struct signalfd_siginfo info;
+            while(read(signal_fd, &info, sizeof(info)) == sizeof(info)) reload = true;
+        }
+
+        if(watch[1].revents & POLLIN){
+            char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t length;
+            while((length = read(inotify_fd, events, sizeof(events))) > 0){
+                for(char* e = events; e < events + length; e += sizeof(struct inotify_event) + ((struct inotify_event*) e)->len){
+                    struct inotify_event* event = (struct inotify_event*) e;
+                    if(event->len > 0 && strcmp(event->name, file_name) == 0) reload = true;
+                }
+            }
+        }
+
+        if(reload) datamgr_reload_sensor_map();
     }
-    fclose(fp_log);
+
+    if(signal_fd >= 0) close(signal_fd);
+    if(inotify_fd >= 0) close(inotify_fd);
+    return NULL;
 }
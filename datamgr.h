@@ -29,10 +29,10 @@
 void datamgr_init(config_thread_t* config_thread);
 
 /**
- *  This method holds the core functionality of your datamgr. It takes in 2 file pointers to the sensor files and parses them.
- *  When the method finishes all data should be in the internal pointer list and all log messages should be printed to stderr.
+ *  This method holds the core functionality of your datamgr. It reads the sensor map and then parses the sensor data in the buffer.
+ *  While it runs, SENSOR_MAP_FILE is reloaded on SIGHUP or when the file changes; sensors that stay mapped keep their running average.
  *  \param fp_sensor_map file pointer to the map file
- *  \param fp_sensor_data file pointer to the binary data file
+ *  \param sbuffer the buffer to read the sensor data from
  */
 void datamgr_parse_sensor_files(FILE* fp_sensor_map, sbuffer_t** sbuffer);
 
@@ -72,4 +72,10 @@ time_t datamgr_get_last_modified(sensor_id_t sensor_id);
  */
 int datamgr_get_total_sensors();
 
+/**
+ *  Return the number of readings that arrived behind the watermark (only in EVENT_TIME_WINDOW mode)
+ *  \return the total amount of late readings
+ */
+unsigned long datamgr_get_late_readings();
+
 #endif  //DATAMGR_H_
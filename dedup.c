@@ -0,0 +1,119 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "dedup.h"
+
+// recent timestamps of a sensor: bit i of 'seen' is set if a reading at last_ts - i was accepted,
+// the bit patterns of the values of the readings in a second are kept in 'values' at index ts % DEDUP_WINDOW
+typedef struct {
+    sensor_ts_t last_ts;
+    uint64_t seen;
+    uint16_t counts[DEDUP_WINDOW];                              // readings accepted in the second
+    uint64_t values[DEDUP_WINDOW][DEDUP_READINGS_PER_SECOND];   // the last ones overwrite the first
+} dedup_state_t;
+
+struct dedup_table {
+    dedup_state_t* states[SENSOR_ID_RANGE];
+    unsigned long accepted;
+    unsigned long suppressed;
+};
+
+// helper methods
+static uint64_t dedup_value_bits(sensor_value_t value);
+static bool dedup_seen_value(const dedup_state_t* state, int slot, uint64_t bits);
+static void dedup_remember(dedup_state_t* state, int slot, bool new_second, uint64_t bits);
+
+dedup_table_t* dedup_create(){
+    return calloc(1, sizeof(dedup_table_t));
+}
+
+void dedup_free(dedup_table_t** table){
+    if(table == NULL || *table == NULL) return;
+    for(int i = 0; i < SENSOR_ID_RANGE; i++) free((*table)->states[i]);
+    free(*table);
+    *table = NULL;
+}
+
+bool dedup_is_duplicate(dedup_table_t* table, const sensor_data_t* data){
+    dedup_state_t* state = table->states[data->id];
+    uint64_t bits = dedup_value_bits(data->value);
+    int slot = (int)((uint64_t) data->ts % DEDUP_WINDOW);
+
+    // first reading of this sensor
+    if(state == NULL){
+        state = calloc(1, sizeof(dedup_state_t));
+        if(state != NULL){
+            state->last_ts = data->ts;
+            state->seen = 1;
+            dedup_remember(state, slot, true, bits);
+            table->states[data->id] = state;
+        }
+        table->accepted++;
+        return false;
+    }
+
+    // a newer reading moves the window forward
+    if(data->ts > state->last_ts){
+        sensor_ts_t shift = data->ts - state->last_ts;
+        state->seen = (shift >= DEDUP_WINDOW) ? 0 : state->seen << shift;
+        state->seen |= 1;
+        state->last_ts = data->ts;
+        dedup_remember(state, slot, true, bits);
+        table->accepted++;
+        return false;
+    }
+
+    // too old to tell
+    sensor_ts_t age = state->last_ts - data->ts;
+    if(age >= DEDUP_WINDOW){
+        table->accepted++;
+        return false;
+    }
+
+    uint64_t bit = (uint64_t) 1 << age;
+    bool new_second = !(state->seen & bit);
+    if(!new_second && dedup_seen_value(state, slot, bits)){
+        table->suppressed++;
+        return true;
+    }
+
+    state->seen |= bit;
+    dedup_remember(state, slot, new_second, bits);
+    table->accepted++;
+    return false;
+}
+
+unsigned long dedup_get_suppressed(const dedup_table_t* table){
+    return table->suppressed;
+}
+
+unsigned long dedup_get_accepted(const dedup_table_t* table){
+    return table->accepted;
+}
+
+// true if one of the remembered readings of the second had this value
+static bool dedup_seen_value(const dedup_state_t* state, int slot, uint64_t bits){
+    int held = (state->counts[slot] < DEDUP_READINGS_PER_SECOND) ? state->counts[slot] : DEDUP_READINGS_PER_SECOND;
+    for(int i = 0; i < held; i++)
+        if(state->values[slot][i] == bits) return true;
+    return false;
+}
+
+// adds the value of an accepted reading to its second, a second that was not seen before starts empty
+static void dedup_remember(dedup_state_t* state, int slot, bool new_second, uint64_t bits){
+    if(new_second) state->counts[slot] = 0;
+    state->values[slot][state->counts[slot] % DEDUP_READINGS_PER_SECOND] = bits;
+    if(state->counts[slot] < UINT16_MAX - DEDUP_READINGS_PER_SECOND) state->counts[slot]++;
+}
+
+// the value as its 64 bits, a retransmit carries the same bits and a NaN equals itself unlike with ==
+static uint64_t dedup_value_bits(sensor_value_t value){
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
@@ -0,0 +1,58 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include "config.h"
+
+// seconds behind the newest reading of a sensor in which duplicates are detected
+#define DEDUP_WINDOW 64
+
+// distinct readings of a sensor with the same timestamp that are told apart, a second with more keeps the last ones
+#ifndef DEDUP_READINGS_PER_SECOND
+#define DEDUP_READINGS_PER_SECOND 4
+#endif
+
+typedef struct dedup_table dedup_table_t;
+
+/**
+ * Allocates an empty duplicate filter, the state of a sensor (about 2.2 KB) is allocated on its first reading
+ * \return a pointer to the new filter, or NULL if memory allocation failed
+ */
+dedup_table_t* dedup_create();
+
+/**
+ * Frees the filter and sets '*table' to NULL
+ * \param table a double pointer to the filter
+ */
+void dedup_free(dedup_table_t** table);
+
+/**
+ * Checks in O(1) if the same (id, ts, value) reading was already accepted, and remembers it if not
+ * Readings more than DEDUP_WINDOW seconds behind the newest reading of the sensor cannot be checked and are accepted.
+ * A second remembers the full values of its last DEDUP_READINGS_PER_SECOND accepted readings and compares them bit for
+ * bit, so distinct values never collide and a retransmit of an earlier reading with the same timestamp is caught as long
+ * as no more than that arrived in its second.
+ * \param table a pointer to the filter
+ * \param data the reading to check
+ * \return true if the reading is a duplicate and has to be dropped, false otherwise
+ */
+bool dedup_is_duplicate(dedup_table_t* table, const sensor_data_t* data);
+
+/**
+ * Returns the number of readings that were dropped as duplicates
+ * \param table a pointer to the filter
+ * \return the number of suppressed readings
+ */
+unsigned long dedup_get_suppressed(const dedup_table_t* table);
+
+/**
+ * Returns the number of readings that were accepted
+ * \param table a pointer to the filter
+ * \return the number of accepted readings
+ */
+unsigned long dedup_get_accepted(const dedup_table_t* table);
+
+#endif /* _DEDUP_H_ */
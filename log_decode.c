@@ -0,0 +1,120 @@
+/**
+ * \author Alken Rrokaj
+ *
+ * Renders a binary event log (LOG_BINARY_FILE or a rotated segment of it, gzipped or not) as the text of gateway.log or as CSV
+ * usage: log_decode [-c] [-e <event>] [-s <sensor_id>] [-f <from>] [-t <to>] [<file>]
+ *     -c  CSV: sequence,time_ns,event,sensor_id,value
+ *     -e  only events of this type, by name (CONNECTION_NEW, TOO_HOT, ...), can be given more than once
+ *     -s  only events about this sensor
+ *     -f  only events at or after this unix time
+ *     -t  only events at or before this unix time
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "config.h"
+#include "logger.h"
+
+// records read at once
+#define DECODE_CHUNK 4096
+
+typedef struct {
+    bool events[LOG_EVENT_TYPES];
+    bool any_event;
+    int sensor_id;              // -1 for every sensor
+    long from;
+    long to;
+} decode_filter_t;
+
+static bool decode_match(const decode_filter_t* filter, const log_record_t* record){
+    long ts = (long)(record->ts_ns / 1000000000LL);
+    return (filter->any_event || (record->event < LOG_EVENT_TYPES && filter->events[record->event]))
+        && (filter->sensor_id < 0 || record->sensor_id == filter->sensor_id)
+        && ts >= filter->from && ts <= filter->to;
+}
+
+static int decode_event_type(const char* name){
+    for(int event = 0; event < LOG_EVENT_TYPES; event++)
+        if(strcmp(logger_event_name(event), name) == 0) return event;
+    return -1;
+}
+
+static int print_usage(const char* name){
+    printf("usage: %s [-c] [-e <event>] [-s <sensor_id>] [-f <from>] [-t <to>] [<file>]\n", name);
+    printf("events:");
+    for(int event = 0; event < LOG_EVENT_TYPES; event++) printf(" %s", logger_event_name(event));
+    printf("\n");
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]){
+    decode_filter_t filter = { .any_event = true, .sensor_id = -1, .from = LONG_MIN, .to = LONG_MAX };
+    bool csv = false;
+    int option;
+    while((option = getopt(argc, argv, "ce:s:f:t:")) != -1){
+        switch(option){
+        case 'c':
+            csv = true;
+            break;
+        case 'e': {
+            int event = decode_event_type(optarg);
+            if(event < 0) return print_usage(argv[0]);
+            filter.events[event] = true;
+            filter.any_event = false;
+            break;
+        }
+        case 's':
+            filter.sensor_id = atoi(optarg);
+            break;
+        case 'f':
+            filter.from = atol(optarg);
+            break;
+        case 't':
+            filter.to = atol(optarg);
+            break;
+        default:
+            return print_usage(argv[0]);
+        }
+    }
+    const char* path = (optind < argc) ? argv[optind] : LOG_BINARY_FILE;
+
+    // gzread reads a file that is not compressed as it is
+    gzFile fp = gzopen(path, "rb");
+    char magic[LOG_BINARY_MAGIC_LENGTH];
+    if(fp == NULL || gzread(fp, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) != 0){
+        fprintf(stderr, "%s IS NOT A BINARY EVENT LOG\n", path);
+        if(fp != NULL) gzclose(fp);
+        return EXIT_FAILURE;
+    }
+
+    if(csv) printf("sequence,time_ns,event,sensor_id,value\n");
+    static uint8_t records[DECODE_CHUNK * LOG_RECORD_LENGTH];
+    char line[256];
+    int read;
+    size_t tail = 0;
+    while((read = gzread(fp, records, sizeof(records))) > 0){
+        size_t count = read / LOG_RECORD_LENGTH;
+        tail = read % LOG_RECORD_LENGTH;
+        for(size_t i = 0; i < count; i++){
+            log_record_t record;
+            logger_unpack(records + i * LOG_RECORD_LENGTH, &record);
+            if(!decode_match(&filter, &record)) continue;
+            if(csv){
+                printf("%lu,%lld,%s,%d,%.6f\n", (unsigned long) record.sequence, (long long) record.ts_ns,
+                    logger_event_name(record.event), record.sensor_id, record.value);
+            }else{
+                logger_format(&record, line, sizeof(line));
+                fputs(line, stdout);
+            }
+        }
+    }
+    // a record cut off at the end is one the gateway was writing when it stopped
+    if(tail > 0) fprintf(stderr, "IGNORED %zu BYTES OF AN INCOMPLETE RECORD AT THE END\n", tail);
+    gzclose(fp);
+    return EXIT_SUCCESS;
+}
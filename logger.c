@@ -0,0 +1,424 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include "config.h"
+#include "logger.h"
+#include "rotate.h"
+
+// the ring of one thread: only that thread moves 'head', only the flusher moves 'tail'
+typedef struct {
+    log_record_t records[LOG_RING_RECORDS];
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_ulong dropped;           // events that found the ring full
+    unsigned long dropped_reported; // the part of 'dropped' the flusher already logged
+} log_ring_t;
+
+#if LOG_BINARY
+#define LOG_PATH LOG_BINARY_FILE
+#else
+#define LOG_PATH LOG_FILE
+#endif
+
+static const char* const event_names[LOG_EVENT_TYPES] = {
+    "CONNECTION_NEW", "CONNECTION_CLOSED", "CONNMGR_CLOSED", "DUPLICATES_SUPPRESSED", "TOO_COLD", "TOO_HOT",
+    "BACK_IN_RANGE", "OUTLIER", "SPIKE", "STUCK", "INVALID_SENSOR", "MAP_RELOADED", "MAP_RELOAD_FAILED",
+    "DB_CONNECT_FAILED", "DB_CONNECTED", "DB_TABLE_CREATED", "DB_CONNECTION_LOST", "DB_RECONNECTED",
+    "DB_READINGS_LOST", "EVENTS_DROPPED"
+};
+
+// write end of the FIFO in the gateway, -1 while there is no log process
+static int fifo_fd = -1;
+static pid_t logger_pid = -1;
+
+static pthread_t flusher;
+static atomic_bool flusher_running;
+
+static atomic_ulong sequence_number;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_ring_t* rings[LOG_MAX_THREADS];
+static atomic_int ring_count;
+static atomic_ulong unregistered_dropped;      // events of threads beyond LOG_MAX_THREADS
+static _Thread_local log_ring_t* thread_ring;
+static _Thread_local bool thread_without_ring;
+
+// records packed or formatted by the flusher, waiting for the next writev
+typedef struct {
+    char buffer[LOG_WRITE_BUFFER];
+    size_t length;
+    struct iovec iov[IOV_MAX];
+    int iov_count;
+} log_output_t;
+
+// helper methods
+static void logger_process();
+static void* logger_flusher(void* arg);
+static void logger_flush_rings(log_output_t* output);
+static int logger_encode(const log_record_t* record, char* out, size_t size);
+static void logger_output_record(log_output_t* output, const log_record_t* record);
+static void logger_write_magic(FILE* fp_log);
+static size_t logger_records_end(const char* buffer, size_t length);
+static void logger_output_write(log_output_t* output);
+static log_ring_t* logger_register_thread();
+static void logger_write_direct(const log_record_t* record);
+
+int logger_start(){
+    if(mkfifo(FIFO_NAME, 0660) < 0 && errno != EEXIST){
+        perror("CANNOT CREATE THE LOG FIFO");
+        return -1;
+    }
+    // a log process that died must not take the gateway with it, writes then fail with EPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    logger_pid = fork();
+    if(logger_pid < 0){
+        perror("CANNOT FORK THE LOG PROCESS");
+        return -1;
+    }
+    if(logger_pid == 0) logger_process();
+
+    // blocks until the log process opened its end
+    fifo_fd = open(FIFO_NAME, O_WRONLY);
+    atomic_store(&flusher_running, true);
+    if(fifo_fd < 0 || pthread_create(&flusher, NULL, &logger_flusher, NULL) != 0){
+        perror("CANNOT START THE LOGGER");
+        atomic_store(&flusher_running, false);
+        if(fifo_fd >= 0) close(fifo_fd);
+        fifo_fd = -1;
+        kill(logger_pid, SIGTERM);
+        waitpid(logger_pid, NULL, 0);
+        logger_pid = -1;
+        return -1;
+    }
+#ifdef DEBUG
+    printf(PURPLE_CLR "LOGGER: STARTED THE LOG PROCESS %d.\n" OFF_CLR, logger_pid);
+#endif
+    return 0;
+}
+
+void log_event(log_event_t event, sensor_id_t sensor_id, double value){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    log_record_t record = {
+        .sequence = atomic_fetch_add_explicit(&sequence_number, 1, memory_order_relaxed),
+        .ts_ns = now.tv_sec * 1000000000LL + now.tv_nsec,
+        .value = value,
+        .event = event,
+        .sensor_id = sensor_id
+    };
+    if(!atomic_load_explicit(&flusher_running, memory_order_acquire)){
+        logger_write_direct(&record);
+        return;
+    }
+
+    log_ring_t* ring = thread_ring;
+    if(ring == NULL && (ring = logger_register_thread()) == NULL){
+        atomic_fetch_add_explicit(&unregistered_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING_RECORDS){
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    ring->records[head & (LOG_RING_RECORDS - 1)] = record;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+int logger_format(const log_record_t* record, char* line, size_t size){
+    char text[128];
+    int id = record->sensor_id;
+    double value = record->value;
+    switch((log_event_t) record->event){
+    case LOG_CONNECTION_NEW:        snprintf(text, sizeof(text), "NEW CONNECTION SENSOR ID: %d", id); break;
+    case LOG_CONNECTION_CLOSED:     snprintf(text, sizeof(text), "CLOSED CONNECTION SENSOR ID: %d", id); break;
+    case LOG_CONNMGR_CLOSED:        snprintf(text, sizeof(text), "CLOSED CONNECTION MANAGER: %.0f", value); break;
+    case LOG_DUPLICATES_SUPPRESSED: snprintf(text, sizeof(text), "SUPPRESSED DUPLICATE READINGS: %.0f", value); break;
+    case LOG_TOO_COLD:              snprintf(text, sizeof(text), "SENSOR ID: %d TOO COLD! (AVG_TEMP = %f)", id, value); break;
+    case LOG_TOO_HOT:               snprintf(text, sizeof(text), "SENSOR ID: %d TOO HOT! (AVG_TEMP = %f)", id, value); break;
+    case LOG_BACK_IN_RANGE:         snprintf(text, sizeof(text), "SENSOR ID: %d BACK IN RANGE (AVG_TEMP = %f)", id, value); break;
+    case LOG_OUTLIER:               snprintf(text, sizeof(text), "SENSOR ID: %d OUTLIER (Z-SCORE = %f)", id, value); break;
+    case LOG_SPIKE:                 snprintf(text, sizeof(text), "SENSOR ID: %d SPIKE (TEMP = %f)", id, value); break;
+    case LOG_STUCK:                 snprintf(text, sizeof(text), "SENSOR ID: %d STUCK (TEMP = %f)", id, value); break;
+    case LOG_INVALID_SENSOR:        snprintf(text, sizeof(text), "SENSOR DATA FROM INVALID SENSOR ID: %d", id); break;
+    case LOG_MAP_RELOADED:          snprintf(text, sizeof(text), "RELOADED SENSOR MAP: %.0f SENSORS", value); break;
+    case LOG_MAP_RELOAD_FAILED:     snprintf(text, sizeof(text), "CANNOT RELOAD SENSOR MAP, KEEPING THE OLD ONE"); break;
+    case LOG_DB_CONNECT_FAILED:     snprintf(text, sizeof(text), "UNABLE TO CONNECT TO SQL SERVER."); break;
+    case LOG_DB_CONNECTED:          snprintf(text, sizeof(text), "ESTABLISHED SQL SERVER CONNECTION."); break;
+    case LOG_DB_TABLE_CREATED:      snprintf(text, sizeof(text), "NEW TABLE CREATED."); break;
+    case LOG_DB_CONNECTION_LOST:    snprintf(text, sizeof(text), "CONNECTION TO SQL SERVER LOST."); break;
+    case LOG_DB_RECONNECTED:        snprintf(text, sizeof(text), "RECONNECTED TO SQL SERVER."); break;
+    case LOG_DB_READINGS_LOST:      snprintf(text, sizeof(text), "LOST %.0f READINGS THAT WERE NOT STORED.", value); break;
+    case LOG_EVENTS_DROPPED:        snprintf(text, sizeof(text), "LOG RINGS FULL, DROPPED %.0f EVENTS", value); break;
+    default:                        snprintf(text, sizeof(text), "UNKNOWN EVENT %d", record->event); break;
+    }
+    return snprintf(line, size, "\nSEQ_NR: %lu  TIME: %ld\n%s\n", (unsigned long) record->sequence,
+        (long)(record->ts_ns / 1000000000LL), text);
+}
+
+void logger_pack(const log_record_t* record, uint8_t* out){
+    memcpy(out, &(record->sequence), sizeof(uint64_t));
+    memcpy(out + 8, &(record->ts_ns), sizeof(int64_t));
+    memcpy(out + 16, &(record->value), sizeof(double));
+    memcpy(out + 24, &(record->event), sizeof(uint16_t));
+    memcpy(out + 26, &(record->sensor_id), sizeof(uint16_t));
+}
+
+void logger_unpack(const uint8_t* in, log_record_t* record){
+    memcpy(&(record->sequence), in, sizeof(uint64_t));
+    memcpy(&(record->ts_ns), in + 8, sizeof(int64_t));
+    memcpy(&(record->value), in + 16, sizeof(double));
+    memcpy(&(record->event), in + 24, sizeof(uint16_t));
+    memcpy(&(record->sensor_id), in + 26, sizeof(uint16_t));
+}
+
+const char* logger_event_name(int event){
+    return (event >= 0 && event < LOG_EVENT_TYPES) ? event_names[event] : "UNKNOWN";
+}
+
+void logger_stop(){
+    if(!atomic_load(&flusher_running)) return;
+    // the flusher empties the rings once more before it returns
+    atomic_store(&flusher_running, false);
+    pthread_join(flusher, NULL);
+    for(int i = 0; i < atomic_load(&ring_count); i++){
+        free(rings[i]);
+        rings[i] = NULL;
+    }
+    atomic_store(&ring_count, 0);
+
+    // the log process writes out what is left when it reads the end of the FIFO
+    close(fifo_fd);
+    fifo_fd = -1;
+    waitpid(logger_pid, NULL, 0);
+    logger_pid = -1;
+    unlink(FIFO_NAME);
+#ifdef DEBUG
+    printf(PURPLE_CLR "LOGGER: STOPPED THE LOG PROCESS.\n" OFF_CLR);
+#endif
+}
+
+// the log process: appends what comes through the FIFO to the log file until the gateway closes it
+static void logger_process(){
+    // the gateway decides when logging ends, by closing the FIFO
+    signal(SIGINT, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+    int fifo = open(FIFO_NAME, O_RDONLY);
+#if LOG_BINARY
+    rotate_t* log = rotate_open(LOG_PATH, "a", LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LENGTH);
+#else
+    rotate_t* log = rotate_open(LOG_PATH, "a", NULL, 0);
+#endif
+    if(fifo < 0 || log == NULL){
+        perror("LOG PROCESS CANNOT OPEN ITS FILES");
+        _exit(EXIT_FAILURE);
+    }
+
+    // a read can end inside a record, that part waits for the next read so the log only rotates between records
+    char buffer[LOG_WRITE_BUFFER];
+    size_t held = 0;
+    struct pollfd pfd = { .fd = fifo, .events = POLLIN };
+    while(true){
+        int ready = poll(&pfd, 1, LOG_FLUSH_MS);
+        if(ready < 0 && errno == EINTR) continue;
+        if(ready == 0){
+            fflush(rotate_stream(log));
+            rotate_account(log, 0);
+            continue;
+        }
+        ssize_t n = read(fifo, buffer + held, sizeof(buffer) - held);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        held += n;
+        size_t complete = logger_records_end(buffer, held);
+        fwrite(buffer, 1, complete, rotate_stream(log));
+        rotate_account(log, complete);
+        memmove(buffer, buffer + complete, held - complete);
+        held -= complete;
+    }
+
+    fwrite(buffer, 1, held, rotate_stream(log));
+    rotate_close(&log);
+    close(fifo);
+    _exit(EXIT_SUCCESS);
+}
+
+// the length of the complete records at the start of 'buffer'
+static size_t logger_records_end(const char* buffer, size_t length){
+#if LOG_BINARY
+    return length - length % LOG_RECORD_LENGTH;
+#else
+    // a formatted record starts and ends with a newline, two of them are the border between records
+    for(size_t i = length - 1; i > 0; i--)
+        if(buffer[i] == '\n' && buffer[i - 1] == '\n') return i;
+    return 0;
+#endif
+}
+
+// empties the rings every LOG_FLUSH_INTERVAL_MS until the logger stops, then once more
+static void* logger_flusher(void* arg){
+    log_output_t* output = malloc(sizeof(log_output_t));
+    ERROR_HANDLER(output == NULL, "CANNOT ALLOCATE THE LOG OUTPUT");
+    output->length = 0;
+    output->iov_count = 0;
+    struct timespec interval = { LOG_FLUSH_INTERVAL_MS / 1000, (LOG_FLUSH_INTERVAL_MS % 1000) * 1000000L };
+    while(atomic_load(&flusher_running)){
+        nanosleep(&interval, NULL);
+        logger_flush_rings(output);
+    }
+    logger_flush_rings(output);
+    free(output);
+    return NULL;
+}
+
+// merges what is in the rings on timestamp, encodes it and writes it to the FIFO
+static void logger_flush_rings(log_output_t* output){
+    int count = atomic_load_explicit(&ring_count, memory_order_acquire);
+    size_t next[LOG_MAX_THREADS];
+    size_t end[LOG_MAX_THREADS];
+    for(int i = 0; i < count; i++){
+        next[i] = atomic_load_explicit(&rings[i]->tail, memory_order_relaxed);
+        end[i] = atomic_load_explicit(&rings[i]->head, memory_order_acquire);
+    }
+
+    // every ring is in timestamp order, take the oldest head of all of them until they are empty
+    while(true){
+        int oldest = -1;
+        const log_record_t* record = NULL;
+        for(int i = 0; i < count; i++){
+            if(next[i] == end[i]) continue;
+            const log_record_t* candidate = &rings[i]->records[next[i] & (LOG_RING_RECORDS - 1)];
+            if(record == NULL || candidate->ts_ns < record->ts_ns
+                || (candidate->ts_ns == record->ts_ns && candidate->sequence < record->sequence)){
+                record = candidate;
+                oldest = i;
+            }
+        }
+        if(oldest < 0) break;
+        logger_output_record(output, record);
+        next[oldest]++;
+        // hand the slot back once the record is encoded, the writev only needs the output buffer
+        atomic_store_explicit(&rings[oldest]->tail, next[oldest], memory_order_release);
+    }
+
+    // the drops since the last flush are an event of their own
+    unsigned long dropped = atomic_exchange_explicit(&unregistered_dropped, 0, memory_order_relaxed);
+    for(int i = 0; i < count; i++){
+        unsigned long total = atomic_load_explicit(&rings[i]->dropped, memory_order_relaxed);
+        dropped += total - rings[i]->dropped_reported;
+        rings[i]->dropped_reported = total;
+    }
+    if(dropped > 0){
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        log_record_t record = {
+            .sequence = atomic_fetch_add_explicit(&sequence_number, 1, memory_order_relaxed),
+            .ts_ns = now.tv_sec * 1000000000LL + now.tv_nsec,
+            .value = dropped,
+            .event = LOG_EVENTS_DROPPED
+        };
+        logger_output_record(output, &record);
+    }
+    logger_output_write(output);
+}
+
+// a record as it goes into the log file: packed, or formatted when LOG_BINARY is 0
+static int logger_encode(const log_record_t* record, char* out, size_t size){
+#if LOG_BINARY
+    logger_pack(record, (uint8_t*) out);
+    return LOG_RECORD_LENGTH;
+#else
+    int length = logger_format(record, out, size);
+    if(length >= (int) size) length = size - 1;
+    return length;
+#endif
+}
+
+// encodes a record into the output buffer, one iovec per record
+static void logger_output_record(log_output_t* output, const log_record_t* record){
+    char line[256];
+    int length = logger_encode(record, line, sizeof(line));
+    if(length < 0) return;
+    if(output->length + length > LOG_WRITE_BUFFER || output->iov_count == IOV_MAX) logger_output_write(output);
+    char* text = output->buffer + output->length;
+    memcpy(text, line, length);
+    output->length += length;
+    output->iov[output->iov_count].iov_base = text;
+    output->iov[output->iov_count].iov_len = length;
+    output->iov_count++;
+}
+
+// writes all collected lines to the FIFO in as few writev calls as it takes
+static void logger_output_write(log_output_t* output){
+    struct iovec* iov = output->iov;
+    int remaining = output->iov_count;
+    while(remaining > 0){
+        ssize_t n = writev(fifo_fd, iov, remaining);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) break;    // the log process is gone, nothing else can be done with the lines
+        // skip what was written, a partial iovec is advanced in place
+        while(remaining > 0 && (size_t) n >= iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            remaining--;
+        }
+        if(remaining > 0){
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    output->length = 0;
+    output->iov_count = 0;
+}
+
+// gives the calling thread a ring, NULL if all LOG_MAX_THREADS are taken
+static log_ring_t* logger_register_thread(){
+    if(thread_without_ring) return NULL;
+    pthread_mutex_lock(&rings_lock);
+    int count = atomic_load(&ring_count);
+    log_ring_t* ring = (count < LOG_MAX_THREADS) ? calloc(1, sizeof(log_ring_t)) : NULL;
+    if(ring != NULL){
+        rings[count] = ring;
+        atomic_store_explicit(&ring_count, count + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&rings_lock);
+    thread_ring = ring;
+    thread_without_ring = (ring == NULL);
+    return ring;
+}
+
+// a new binary log file starts with the magic
+static void logger_write_magic(FILE* fp_log){
+#if LOG_BINARY
+    fseek(fp_log, 0, SEEK_END);
+    if(ftell(fp_log) == 0) fwrite(LOG_BINARY_MAGIC, 1, LOG_BINARY_MAGIC_LENGTH, fp_log);
+#endif
+}
+
+// without a flusher the event is appended to the log file by the thread that logs it
+static void logger_write_direct(const log_record_t* record){
+    char line[256];
+    int length = logger_encode(record, line, sizeof(line));
+    if(length < 0) return;
+    FILE* fp_log = fopen(LOG_PATH, "a");
+    if(fp_log == NULL) return;
+    logger_write_magic(fp_log);
+    fwrite(line, 1, length, fp_log);
+    fclose(fp_log);
+}
@@ -0,0 +1,140 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include "config.h"
+
+// records in the log ring of every thread, a power of two
+#ifndef LOG_RING_RECORDS
+#define LOG_RING_RECORDS 4096
+#endif
+
+#if (LOG_RING_RECORDS & (LOG_RING_RECORDS - 1)) != 0
+#error LOG_RING_RECORDS must be a power of two
+#endif
+
+// threads that can have a ring, the events of any further thread are dropped
+#ifndef LOG_MAX_THREADS
+#define LOG_MAX_THREADS 16
+#endif
+
+// the flusher thread empties the rings this often
+#ifndef LOG_FLUSH_INTERVAL_MS
+#define LOG_FLUSH_INTERVAL_MS 20
+#endif
+
+// formatted lines are collected in a buffer of this size and written with one writev
+#ifndef LOG_WRITE_BUFFER
+#define LOG_WRITE_BUFFER (64 * 1024)
+#endif
+
+// the log process writes the binary records to LOG_BINARY_FILE, set LOG_BINARY to 0 for the formatted lines in LOG_FILE
+#ifndef LOG_BINARY
+#define LOG_BINARY 1
+#endif
+
+// the log process flushes the log file when the FIFO has been quiet for this long
+#ifndef LOG_FLUSH_MS
+#define LOG_FLUSH_MS 200
+#endif
+
+// the events of the gateway, the text of each one is in logger.c
+typedef enum {
+    LOG_CONNECTION_NEW,             // sensor_id
+    LOG_CONNECTION_CLOSED,          // sensor_id
+    LOG_CONNMGR_CLOSED,             // value: the port
+    LOG_DUPLICATES_SUPPRESSED,      // value: readings
+    LOG_TOO_COLD,                   // sensor_id, value: running average
+    LOG_TOO_HOT,                    // sensor_id, value: running average
+    LOG_BACK_IN_RANGE,              // sensor_id, value: running average
+    LOG_OUTLIER,                    // sensor_id, value: z-score
+    LOG_SPIKE,                      // sensor_id, value: reading
+    LOG_STUCK,                      // sensor_id, value: reading
+    LOG_INVALID_SENSOR,             // sensor_id
+    LOG_MAP_RELOADED,               // value: sensors in the map
+    LOG_MAP_RELOAD_FAILED,
+    LOG_DB_CONNECT_FAILED,
+    LOG_DB_CONNECTED,
+    LOG_DB_TABLE_CREATED,
+    LOG_DB_CONNECTION_LOST,
+    LOG_DB_RECONNECTED,
+    LOG_DB_READINGS_LOST,           // value: readings
+    LOG_EVENTS_DROPPED,             // value: events, written by the flusher for full rings
+    LOG_EVENT_TYPES
+} log_event_t;
+
+// an event as it sits in a ring, fixed size and not formatted
+typedef struct {
+    uint64_t sequence;              // global and increasing, a gap is an event that was dropped
+    int64_t ts_ns;                  // CLOCK_REALTIME
+    double value;
+    uint16_t event;                 // a log_event_t
+    sensor_id_t sensor_id;
+} log_record_t;
+
+/*
+ * Binary log format: the magic LOG_BINARY_MAGIC, then records of LOG_RECORD_LENGTH bytes
+ *     uint64 sequence, int64 ts_ns, double value, uint16 event, uint16 sensor_id
+ * packed, in the byte order of the machine that wrote it. log_decode renders it as text or CSV.
+ */
+#define LOG_BINARY_MAGIC "GWE1"
+#define LOG_BINARY_MAGIC_LENGTH 4
+#define LOG_RECORD_LENGTH (2 * sizeof(uint64_t) + sizeof(double) + 2 * sizeof(uint16_t))
+
+/**
+ * Creates FIFO_NAME, forks the log process that appends what comes through it to the log file and starts the flusher
+ * thread. Call it before any other thread is started. Until it is called (as in the tools and benchmarks), events are
+ * appended to the log file by the thread that logs them.
+ * \return zero for success, -1 if the FIFO, the process or the thread can not be created
+ */
+int logger_start();
+
+/**
+ * Logs an event: a record with the next sequence number and the current time goes into the ring of the calling
+ * thread, without formatting or I/O. If the ring is full the event is dropped and counted.
+ * \param event the type of the event
+ * \param sensor_id the sensor it is about, 0 if none
+ * \param value the number that goes with it, 0 if none
+ */
+void log_event(log_event_t event, sensor_id_t sensor_id, double value);
+
+/**
+ * Formats a record into a line of LOG_FILE
+ * \param record the record
+ * \param line the output
+ * \param size the size of 'line'
+ * \return the length of the line, as snprintf
+ */
+int logger_format(const log_record_t* record, char* line, size_t size);
+
+/**
+ * Packs a record into the binary log format
+ * \param record the record
+ * \param out LOG_RECORD_LENGTH bytes
+ */
+void logger_pack(const log_record_t* record, uint8_t* out);
+
+/**
+ * Unpacks a record of the binary log format
+ * \param in LOG_RECORD_LENGTH bytes
+ * \param record filled out with the record
+ */
+void logger_unpack(const uint8_t* in, log_record_t* record);
+
+/**
+ * Returns the name of an event type, as log_decode shows and filters it
+ * \param event a log_event_t
+ * \return the name without the LOG_ prefix, "UNKNOWN" for a value out of range
+ */
+const char* logger_event_name(int event);
+
+/**
+ * Stops the flusher after it emptied the rings, closes the FIFO, waits for the log process to write out what it has
+ * and removes the FIFO. Call it once the threads that log are joined.
+ */
+void logger_stop();
+
+#endif /* _LOGGER_H_ */
@@ -11,12 +11,16 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <time.h>
+#include <signal.h>
 
 #include "config.h"
 #include "sbuffer.h"
 #include "connmgr.h"
 #include "datamgr.h"
 #include "sensor_db.h"
+#include "storage.h"
+#include "logger.h"
+#include "metrics.h"
 
 #include "lib/tcpsock.h"
 #include "lib/dplist.h"
@@ -44,14 +48,9 @@ int* data_sensor_db;
 pthread_rwlock_t connmgr_lock;
 bool* connmgr_working;
 
-pthread_mutex_t fifo_mutex;
-
-pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-int* fifo_fd = 0;
-int log_sequence_number = 0;
-
 
 sbuffer_t* buffer;
+const storage_backend_t* storage_backend = &storage_sqlite;
 
 int main(int argc, char* argv[]){
     // check if port_number arguments passed
@@ -60,61 +59,14 @@ int main(int argc, char* argv[]){
     //get the port number
     int port_number = atoi(argv[1]);
 
-    // fork into two processes
-    // int pid = 1;
-    // if(pid == -1) return -1;
-
-    // // Create the FIFO if it doesn't already exist
-    // if (mkfifo(FIFO_NAME, 0660) < 0) {
-    //     if (errno != EEXIST) {
-    //         perror("Could not create log FIFO");
-    //         exit(1);
-    //     }
-    // }
-
-    // // the child handles the log process
-    // if(pid == 0){
-    //     int log_fifo;
-
-    //     // Open the FIFO for reading
-    //     log_fifo = open(FIFO_NAME, O_RDONLY);
-    //     if(log_fifo < 0){
-    //         perror("Could not open log FIFO");
-    //         exit(1);
-    //     }
-
-    //     while(1){
-    //         char log_event_info[256];
-    //         int bytes_read;
-
-    //         // Read a log event from the FIFO
-    //         bytes_read = read(log_fifo, log_event_info, sizeof(log_event_info));
-    //         if(bytes_read < 0){
-    //             perror("Error reading from log FIFO");
-    //             exit(1);
-    //         } else if(bytes_read == 0){
-    //             // End of file
-    //             break;
-    //         }
-
-    //         // Write the log event to the log file
-    //         pthread_mutex_lock(&log_mutex);
-    //         FILE* log_file = fopen(LOG_FILE, "a");
-    //         if(log_file == NULL){
-    //             perror("Could not open log file");
-    //             exit(1);
-    //         }
-    //         time_t now;
-    //         time(&now);
-    //         fprintf(log_file, "%d %s %s\n", log_sequence_number++, ctime(&now), log_event_info);
-    //         fclose(log_file);
-    //         printf("LOGGED");
-    //         pthread_mutex_unlock(&log_mutex);
-    //     }
-
-    //     close(log_fifo);
-    //     exit(EXIT_SUCCESS);
-    // }
+    // the storage backend is chosen at startup, SQLite unless told otherwise
+    if(argc > 2 && (storage_backend = storage_find_backend(argv[2])) == NULL) return print_help();
+
+    // the log process is forked before any thread exists, it appends the events of all threads to LOG_FILE
+    if(logger_start() != 0) return -1;
+
+    // the gateway runs without the endpoint when the port is taken
+    if(metrics_start() != 0) printf("CANNOT SERVE THE METRICS ON PORT %d\n", METRICS_PORT);
     
 #ifdef DEBUG
     printf("INITIALIZING SENSOR GATEWAY\n");
@@ -124,7 +76,6 @@ int main(int argc, char* argv[]){
     data_mgr = malloc(sizeof(int));
     data_sensor_db = malloc(sizeof(int));
     connmgr_working = malloc(sizeof(bool));
-    // fifo_fd = malloc(sizeof(int));
 
     *data_mgr = 0;
 	*data_sensor_db = 0;
@@ -140,12 +91,17 @@ int main(int argc, char* argv[]){
     pthread_cond_init(&db_cond, NULL);
     pthread_mutex_init(&db_lock, NULL);
 
-    pthread_rwlock_init(&connmgr_lock, NULL);    
-    pthread_mutex_init(&fifo_mutex, NULL);
+    pthread_rwlock_init(&connmgr_lock, NULL);
 
 #ifdef DEBUG
     printf("INITIALIZING THREADS\n");
 #endif
+    // block SIGHUP in every thread, the datamgr reads it to reload the sensor map
+    sigset_t reload_signals;
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &reload_signals, NULL);
+
     // create the threads
     pthread_t threads[MAIN_PROCESS_THREAD_NR];
     // connmgr thread
@@ -172,8 +128,7 @@ int main(int argc, char* argv[]){
     pthread_cond_destroy(&db_cond);
     pthread_mutex_destroy(&db_lock);
 
-    pthread_rwlock_destroy(&connmgr_lock);    
-    pthread_mutex_destroy(&fifo_mutex);
+    pthread_rwlock_destroy(&connmgr_lock);
 
     // free the threads
     free(data_mgr);
@@ -182,6 +137,8 @@ int main(int argc, char* argv[]){
 
 
     sbuffer_free(&buffer);
+    metrics_stop();
+    logger_stop();
 
 #ifdef DEBUG
     printf("CLOSING SENSOR GATEWAY\n");
@@ -200,10 +157,6 @@ void main_init_thread(config_thread_t* config_thread){
 
     config_thread->connmgr_lock = &connmgr_lock;
     config_thread->connmgr_working = connmgr_working;
-
-    config_thread->fifo_mutex = &fifo_mutex;
-    config_thread->fifo_fd = fifo_fd;
-    config_thread->log_mutex = &log_mutex;
 }
 
 void* connmgr_th(void* arg){
@@ -221,7 +174,7 @@ void* connmgr_th(void* arg){
 }
 
 void* datamgr_th(void* arg){
-    FILE* fp_sensor_map = fopen("room_sensor.map", "r");
+    FILE* fp_sensor_map = fopen(SENSOR_MAP_FILE, "r");
     config_thread_t datamgr_config_thread;
     main_init_thread(&datamgr_config_thread);
 
@@ -242,9 +195,16 @@ void* sensor_db_th(void* arg){
     main_init_thread(&sensor_db_config_thread);
 
     sensor_db_init(&sensor_db_config_thread);
-    DBCONN* conn = init_connection(DB_FLAG);
-    sensor_db_listen(conn, &buffer);
-    disconnect(conn);
+    storage_init(&sensor_db_config_thread);
+    storage_t* storage = storage_open(storage_backend, DB_FLAG);
+    if(storage == NULL){
+        // the other threads are stopped so the gateway shuts down instead of exiting from this thread
+        fprintf(stderr, "CANNOT OPEN THE STORAGE BACKEND\n");
+        sensor_close_threads();
+        return NULL;
+    }
+    storage_listen(storage, &buffer);
+    storage_close(&storage);
 #ifdef DEBUG
     printf(RED_CLR"CLOSING DB_THR\n"OFF_CLR);
 #endif
@@ -254,5 +214,6 @@ void* sensor_db_th(void* arg){
 int print_help(){
     printf("USE THIS PROGRAMME WITH A COMMAND LINE OPTION: \n");
     printf("\t%-15s : TCP SERVER PORT NUMBER\n", "\'SERVER PORT\'");
+    printf("\t%-15s : OPTIONAL STORAGE BACKEND: sqlite (DEFAULT), memory, file (%s) OR tsdb\n", "\'STORAGE\'", STORAGE_FILE);
     return -1;
 }
\ No newline at end of file
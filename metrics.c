@@ -0,0 +1,340 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "config.h"
+#include "metrics.h"
+
+// the counters and histograms of one thread: only that thread writes them, the endpoint thread reads them
+typedef struct {
+    atomic_ullong counters[METRIC_COUNTERS];
+    atomic_ullong buckets[METRIC_HISTOGRAMS][METRICS_BUCKETS];
+    atomic_ullong sum_ns[METRIC_HISTOGRAMS];
+    bool shared;                    // the set of the threads beyond METRICS_MAX_THREADS, written with atomic adds
+} metrics_shard_t;
+
+typedef struct {
+    const char* name;
+    const char* labels;             // NULL for none
+    const char* help;
+} metric_info_t;
+
+static const metric_info_t counter_info[METRIC_COUNTERS] = {
+    { "gateway_connections_accepted_total", NULL, "Sensor node connections accepted." },
+    { "gateway_readings_received_total", NULL, "Readings received and put in the sbuffer." },
+    { "gateway_readings_duplicate_total", NULL, "Readings dropped because they were received before." },
+    { "gateway_readings_stored_total", NULL, "Readings the storage backend accepted." },
+    { "gateway_storage_failures_total", NULL, "Inserts and flushes the storage backend failed." },
+    { "gateway_alerts_total", "state=\"hot\"", "Alert state changes of the sensors." },
+    { "gateway_alerts_total", "state=\"cold\"", NULL },
+    { "gateway_alerts_total", "state=\"normal\"", NULL },
+    { "gateway_anomalies_total", "kind=\"outlier\"", "Anomalies found in the readings." },
+    { "gateway_anomalies_total", "kind=\"spike\"", NULL },
+    { "gateway_anomalies_total", "kind=\"stuck\"", NULL }
+};
+
+static const metric_info_t gauge_info[METRIC_GAUGES] = {
+    { "gateway_connections_open", NULL, "Sensor node connections open." },
+    { "gateway_sbuffer_readings", NULL, "Readings in the sbuffer that not every reader has read." },
+    { "gateway_readings_per_second", NULL, "Readings received per second, over the last second." }
+};
+
+static const metric_info_t histogram_info[METRIC_HISTOGRAMS] = {
+    { "gateway_storage_insert_seconds", NULL, "Time to hand a batch of readings to the storage backend." },
+    { "gateway_storage_flush_seconds", NULL, "Time to flush the storage backend." },
+    { "gateway_storage_commit_seconds", NULL, "Time of the COMMIT of a SQLite group commit transaction." },
+    { "gateway_sbuffer_lag_seconds", "reader=\"datamgr\"", "Time a reading waited in the sbuffer for a reader." },
+    { "gateway_sbuffer_lag_seconds", "reader=\"storage\"", NULL }
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_shard_t* shards[METRICS_MAX_THREADS];
+static atomic_int shard_count;
+static metrics_shard_t shared_shard = { .shared = true };
+static _Thread_local metrics_shard_t* thread_shard;
+
+static atomic_llong gauges[METRIC_GAUGES];
+
+// the endpoint
+static int listen_fd = -1;
+static int wake_pipe[2] = { -1, -1 };
+static pthread_t server;
+static bool server_running;
+
+// helper methods
+static metrics_shard_t* metrics_register_thread();
+static void metrics_add(metrics_shard_t* shard, atomic_ullong* value, uint64_t n);
+static int metrics_bucket(uint64_t ns);
+static uint64_t metrics_bucket_upper(int bucket);
+static void metrics_render_header(FILE* out, const metric_info_t* info, const char* type);
+static void metrics_render_histogram(FILE* out, metric_histogram_t histogram);
+static void* metrics_server(void* arg);
+static void metrics_serve(int client);
+static int metrics_send_all(int client, const char* data, size_t length, const struct timespec* start);
+static int metrics_remaining_ms(const struct timespec* start);
+static uint64_t metrics_counter_total(metric_counter_t counter);
+
+void metrics_count(metric_counter_t counter, uint64_t n){
+    metrics_shard_t* shard = metrics_register_thread();
+    metrics_add(shard, &shard->counters[counter], n);
+}
+
+void metrics_gauge_set(metric_gauge_t gauge, int64_t value){
+    atomic_store_explicit(&gauges[gauge], value, memory_order_relaxed);
+}
+
+void metrics_gauge_add(metric_gauge_t gauge, int64_t delta){
+    atomic_fetch_add_explicit(&gauges[gauge], delta, memory_order_relaxed);
+}
+
+void metrics_observe(metric_histogram_t histogram, uint64_t ns){
+    metrics_shard_t* shard = metrics_register_thread();
+    metrics_add(shard, &shard->buckets[histogram][metrics_bucket(ns)], 1);
+    metrics_add(shard, &shard->sum_ns[histogram], ns);
+}
+
+uint64_t metrics_elapsed_ns(const struct timespec* start){
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1000000000ULL + end.tv_nsec - start->tv_nsec;
+}
+
+int metrics_render(FILE* out){
+    for(int counter = 0; counter < METRIC_COUNTERS; counter++){
+        metrics_render_header(out, &counter_info[counter], "counter");
+        fprintf(out, "%s%s%s%s %llu\n", counter_info[counter].name, counter_info[counter].labels ? "{" : "",
+            counter_info[counter].labels ? counter_info[counter].labels : "", counter_info[counter].labels ? "}" : "",
+            (unsigned long long) metrics_counter_total(counter));
+    }
+    for(int gauge = 0; gauge < METRIC_GAUGES; gauge++){
+        metrics_render_header(out, &gauge_info[gauge], "gauge");
+        fprintf(out, "%s %lld\n", gauge_info[gauge].name, (long long) atomic_load_explicit(&gauges[gauge], memory_order_relaxed));
+    }
+    for(int histogram = 0; histogram < METRIC_HISTOGRAMS; histogram++){
+        metrics_render_header(out, &histogram_info[histogram], "summary");
+        metrics_render_histogram(out, histogram);
+    }
+    return ferror(out) ? -1 : 0;
+}
+
+int metrics_start(){
+    if(METRICS_PORT == 0) return 0;
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(METRICS_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    int reuse = 1;
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listen_fd < 0 || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0
+        || bind(listen_fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listen_fd, 8) != 0
+        || pipe2(wake_pipe, O_CLOEXEC) != 0 || pthread_create(&server, NULL, &metrics_server, NULL) != 0){
+        metrics_stop();
+        return -1;
+    }
+    server_running = true;
+#ifdef DEBUG
+    printf(PURPLE_CLR "METRICS: SERVING http://127.0.0.1:%d/metrics\n" OFF_CLR, METRICS_PORT);
+#endif
+    return 0;
+}
+
+void metrics_stop(){
+    if(server_running){
+        // the endpoint thread polls the pipe next to the socket
+        close(wake_pipe[1]);
+        wake_pipe[1] = -1;
+        pthread_join(server, NULL);
+        server_running = false;
+    }
+    if(wake_pipe[1] >= 0) close(wake_pipe[1]);
+    if(wake_pipe[0] >= 0) close(wake_pipe[0]);
+    if(listen_fd >= 0) close(listen_fd);
+    wake_pipe[0] = wake_pipe[1] = listen_fd = -1;
+}
+
+// gives the calling thread its counters and histograms, the shared set if all METRICS_MAX_THREADS are taken
+static metrics_shard_t* metrics_register_thread(){
+    if(thread_shard != NULL) return thread_shard;
+    pthread_mutex_lock(&shards_lock);
+    int count = atomic_load(&shard_count);
+    metrics_shard_t* shard = (count < METRICS_MAX_THREADS) ? calloc(1, sizeof(metrics_shard_t)) : NULL;
+    if(shard != NULL){
+        shards[count] = shard;
+        atomic_store_explicit(&shard_count, count + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&shards_lock);
+    thread_shard = (shard != NULL) ? shard : &shared_shard;
+    return thread_shard;
+}
+
+// one writer needs no read-modify-write, the endpoint thread only ever sees a value before or after the store
+static void metrics_add(metrics_shard_t* shard, atomic_ullong* value, uint64_t n){
+    if(shard->shared){
+        atomic_fetch_add_explicit(value, n, memory_order_relaxed);
+        return;
+    }
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// HDR-style: the first METRICS_SUB_BUCKETS values have a bucket each, every next power of two is split in as many
+static int metrics_bucket(uint64_t ns){
+    if(ns < METRICS_SUB_BUCKETS) return ns;
+    int exponent = 63 - __builtin_clzll(ns);
+    int shift = exponent - METRICS_SUB_BUCKET_BITS;
+    return (shift + 1) * METRICS_SUB_BUCKETS + (int)((ns >> shift) & (METRICS_SUB_BUCKETS - 1));
+}
+
+// the largest value that goes in 'bucket'
+static uint64_t metrics_bucket_upper(int bucket){
+    if(bucket < METRICS_SUB_BUCKETS) return bucket;
+    int shift = bucket / METRICS_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % METRICS_SUB_BUCKETS;
+    return ((METRICS_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+// a metric with labels only has a help text on its first entry, the others share it
+static void metrics_render_header(FILE* out, const metric_info_t* info, const char* type){
+    if(info->help == NULL) return;
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", info->name, info->help, info->name, type);
+}
+
+static void metrics_render_histogram(FILE* out, metric_histogram_t histogram){
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t count = 0, sum_ns = atomic_load_explicit(&shared_shard.sum_ns[histogram], memory_order_relaxed);
+    int shard_total = atomic_load_explicit(&shard_count, memory_order_acquire);
+    for(int bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+        buckets[bucket] = atomic_load_explicit(&shared_shard.buckets[histogram][bucket], memory_order_relaxed);
+    for(int i = 0; i < shard_total; i++){
+        for(int bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+            buckets[bucket] += atomic_load_explicit(&shards[i]->buckets[histogram][bucket], memory_order_relaxed);
+        sum_ns += atomic_load_explicit(&shards[i]->sum_ns[histogram], memory_order_relaxed);
+    }
+    for(int bucket = 0; bucket < METRICS_BUCKETS; bucket++) count += buckets[bucket];
+
+    const metric_info_t* info = &histogram_info[histogram];
+    const char* separator = (info->labels != NULL) ? "," : "";
+    const char* labels = (info->labels != NULL) ? info->labels : "";
+    int bucket = 0;
+    uint64_t below = 0;
+    for(size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++){
+        // the upper end of the bucket in which the quantile falls, NaN without observations
+        uint64_t rank = (uint64_t) ceil(quantiles[q] * count);
+        while(bucket < METRICS_BUCKETS - 1 && below + buckets[bucket] < rank) below += buckets[bucket++];
+        double value = (count > 0) ? metrics_bucket_upper(bucket) / 1e9 : NAN;
+        fprintf(out, "%s{%s%squantile=\"%g\"} %.9g\n", info->name, labels, separator, quantiles[q], value);
+    }
+    const char* open = (info->labels != NULL) ? "{" : "";
+    const char* close = (info->labels != NULL) ? "}" : "";
+    fprintf(out, "%s_sum%s%s%s %.9f\n", info->name, open, labels, close, sum_ns / 1e9);
+    fprintf(out, "%s_count%s%s%s %llu\n", info->name, open, labels, close, (unsigned long long) count);
+}
+
+static uint64_t metrics_counter_total(metric_counter_t counter){
+    uint64_t total = atomic_load_explicit(&shared_shard.counters[counter], memory_order_relaxed);
+    int shard_total = atomic_load_explicit(&shard_count, memory_order_acquire);
+    for(int i = 0; i < shard_total; i++) total += atomic_load_explicit(&shards[i]->counters[counter], memory_order_relaxed);
+    return total;
+}
+
+// serves the endpoint at idle priority and updates the readings per second, until metrics_stop closes the pipe
+static void* metrics_server(void* arg){
+    struct sched_param param = { .sched_priority = 0 };
+    if(pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) setpriority(PRIO_PROCESS, gettid(), 19);
+
+    struct pollfd pfds[2] = { { .fd = listen_fd, .events = POLLIN }, { .fd = wake_pipe[0], .events = POLLIN } };
+    struct timespec last_rate;
+    clock_gettime(CLOCK_MONOTONIC, &last_rate);
+    uint64_t last_received = metrics_counter_total(METRIC_READINGS_RECEIVED);
+    while(true){
+        int ready = poll(pfds, 2, METRICS_RATE_MS);
+        if(ready < 0 && errno != EINTR) break;
+        if(pfds[1].revents != 0) break;
+
+        uint64_t elapsed_ns = metrics_elapsed_ns(&last_rate);
+        if(elapsed_ns >= METRICS_RATE_MS * 1000000ULL){
+            uint64_t received = metrics_counter_total(METRIC_READINGS_RECEIVED);
+            metrics_gauge_set(METRIC_READINGS_PER_SECOND, llround((received - last_received) * 1e9 / elapsed_ns));
+            last_received = received;
+            clock_gettime(CLOCK_MONOTONIC, &last_rate);
+        }
+        if(ready > 0 && (pfds[0].revents & POLLIN)){
+            int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if(client >= 0){
+                metrics_serve(client);
+                close(client);
+            }
+        }
+    }
+    return NULL;
+}
+
+// answers one HTTP request; reading the request and writing the answer each get METRICS_CLIENT_TIMEOUT_MS in total,
+// so a client that stops sending or reading can not hold the endpoint thread (and metrics_stop)
+static void metrics_serve(int client){
+    char request[1024] = "";
+    size_t length = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct pollfd pfd = { .fd = client, .events = POLLIN };
+    while(length < sizeof(request) - 1 && strstr(request, "\r\n\r\n") == NULL){
+        int remaining = metrics_remaining_ms(&start);
+        if(remaining <= 0 || poll(&pfd, 1, remaining) <= 0) break;
+        ssize_t n = recv(client, request + length, sizeof(request) - 1 - length, MSG_DONTWAIT);
+        if(n <= 0) break;
+        length += n;
+        request[length] = '\0';
+    }
+
+    char* body = NULL;
+    size_t body_length = 0;
+    FILE* out = open_memstream(&body, &body_length);
+    if(out == NULL) return;
+    bool found = (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0);
+    if(found) metrics_render(out);
+    else fprintf(out, "not found, try /metrics\n");
+    fclose(out);
+
+    char header[256];
+    int header_length = snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %zu\r\nConnection: close\r\n\r\n", found ? "200 OK" : "404 Not Found", body_length);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(metrics_send_all(client, header, header_length, &start) == 0) metrics_send_all(client, body, body_length, &start);
+    free(body);
+}
+
+// writes all of 'data' without blocking past METRICS_CLIENT_TIMEOUT_MS after 'start', -1 if it could not
+static int metrics_send_all(int client, const char* data, size_t length, const struct timespec* start){
+    struct pollfd pfd = { .fd = client, .events = POLLOUT };
+    for(size_t sent = 0; sent < length;){
+        int remaining = metrics_remaining_ms(start);
+        if(remaining <= 0 || poll(&pfd, 1, remaining) <= 0) return -1;
+        ssize_t n = send(client, data + sent, length - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if(n <= 0) return -1;
+        sent += n;
+    }
+    return 0;
+}
+
+// the milliseconds left of METRICS_CLIENT_TIMEOUT_MS after 'start'
+static int metrics_remaining_ms(const struct timespec* start){
+    return METRICS_CLIENT_TIMEOUT_MS - (int)(metrics_elapsed_ns(start) / 1000000);
+}
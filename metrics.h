@@ -0,0 +1,127 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdio.h>
+#include "config.h"
+
+// the metrics are served on 127.0.0.1 at this port (http://127.0.0.1:9464/metrics), 0 for no endpoint
+#ifndef METRICS_PORT
+#define METRICS_PORT 9464
+#endif
+
+// a scraper gets this long to send its request, and again to read the answer
+#ifndef METRICS_CLIENT_TIMEOUT_MS
+#define METRICS_CLIENT_TIMEOUT_MS 1000
+#endif
+
+// threads that get their own counters and histograms, further threads share one set with atomic adds
+#ifndef METRICS_MAX_THREADS
+#define METRICS_MAX_THREADS 16
+#endif
+
+// the endpoint thread updates the readings per second this often
+#ifndef METRICS_RATE_MS
+#define METRICS_RATE_MS 1000
+#endif
+
+// histogram buckets per power of two are 2^METRICS_SUB_BUCKET_BITS, 4 bits keeps a value within 6.25%
+#ifndef METRICS_SUB_BUCKET_BITS
+#define METRICS_SUB_BUCKET_BITS 4
+#endif
+
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS)
+
+// counters only go up, the name and help of each one is in metrics.c
+typedef enum {
+    METRIC_CONNECTIONS_ACCEPTED,
+    METRIC_READINGS_RECEIVED,
+    METRIC_READINGS_DUPLICATE,
+    METRIC_READINGS_STORED,
+    METRIC_STORAGE_FAILURES,
+    METRIC_ALERTS_HOT,
+    METRIC_ALERTS_COLD,
+    METRIC_ALERTS_NORMAL,
+    METRIC_ANOMALIES_OUTLIER,
+    METRIC_ANOMALIES_SPIKE,
+    METRIC_ANOMALIES_STUCK,
+    METRIC_COUNTERS
+} metric_counter_t;
+
+// gauges are set or moved by whoever knows the value
+typedef enum {
+    METRIC_CONNECTIONS_OPEN,
+    METRIC_SBUFFER_READINGS,        // readings in the sbuffer, not yet read by both readers
+    METRIC_READINGS_PER_SECOND,     // set by the endpoint thread from METRIC_READINGS_RECEIVED
+    METRIC_GAUGES
+} metric_gauge_t;
+
+// histograms of durations in nanoseconds, exported in seconds
+typedef enum {
+    METRIC_STORAGE_INSERT,          // a batch handed to the storage backend
+    METRIC_STORAGE_FLUSH,           // a flush of the storage backend by the storage thread
+    METRIC_STORAGE_COMMIT,          // a COMMIT of a group commit transaction of the SQLite writer
+    METRIC_SBUFFER_LAG_DATAMGR,     // from sbuffer_insert until the datamgr reads the reading
+    METRIC_SBUFFER_LAG_STORAGE,     // from sbuffer_insert until the storage thread reads the reading
+    METRIC_HISTOGRAMS
+} metric_histogram_t;
+
+/**
+ * Adds to a counter of the calling thread, a plain load and store without lock prefix
+ * \param counter the counter
+ * \param n the amount to add
+ */
+void metrics_count(metric_counter_t counter, uint64_t n);
+
+/**
+ * Sets a gauge
+ * \param gauge the gauge
+ * \param value the new value
+ */
+void metrics_gauge_set(metric_gauge_t gauge, int64_t value);
+
+/**
+ * Moves a gauge up or down
+ * \param gauge the gauge
+ * \param delta the amount to add, negative to subtract
+ */
+void metrics_gauge_add(metric_gauge_t gauge, int64_t delta);
+
+/**
+ * Counts a duration in the histogram of the calling thread, in a bucket found with a count-leading-zeros
+ * \param histogram the histogram
+ * \param ns the duration in nanoseconds
+ */
+void metrics_observe(metric_histogram_t histogram, uint64_t ns);
+
+/**
+ * Returns the nanoseconds since 'start', for metrics_observe
+ * \param start a CLOCK_MONOTONIC time
+ * \return the nanoseconds elapsed
+ */
+uint64_t metrics_elapsed_ns(const struct timespec* start);
+
+/**
+ * Writes every metric in the Prometheus text format, the counters and histograms of all threads summed
+ * Histograms are written as summaries: the 0.5, 0.9, 0.99 and 0.999 quantiles, the sum and the count.
+ * \param out the stream to write to
+ * \return zero for success, -1 if writing failed
+ */
+int metrics_render(FILE* out);
+
+/**
+ * Starts the thread that serves GET /metrics on 127.0.0.1:METRICS_PORT, at idle priority
+ * \return zero for success, -1 if the port can not be bound or the thread can not be created
+ */
+int metrics_start();
+
+/**
+ * Stops the endpoint thread and closes its socket, the metrics themselves stay
+ */
+void metrics_stop();
+
+#endif /* _METRICS_H_ */
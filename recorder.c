@@ -0,0 +1,90 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "recorder.h"
+
+struct recorder {
+    recorder_header_t* header;      // the start of the mapping
+    recorder_reading_t* readings;
+    size_t length;                  // of the mapping
+    uint64_t recorded;              // the writer's copy of header->recorded
+    uint32_t next_slot;
+};
+
+// helper methods
+static bool recorder_compatible(const recorder_header_t* header, uint32_t capacity);
+
+recorder_t* recorder_open(const char* path, uint32_t capacity){
+    if(capacity == 0) return NULL;
+    recorder_t* recorder = calloc(1, sizeof(recorder_t));
+    if(recorder == NULL) return NULL;
+    recorder->length = sizeof(recorder_header_t) + (size_t) capacity * sizeof(recorder_reading_t);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0){
+        if(fd >= 0) close(fd);
+        free(recorder);
+        return NULL;
+    }
+    // a file of another size is started over, ftruncate fills it with zeros
+    bool resize = (st.st_size != (off_t) recorder->length);
+    if((resize && (ftruncate(fd, 0) != 0 || ftruncate(fd, recorder->length) != 0))
+        || (recorder->header = mmap(NULL, recorder->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED){
+        close(fd);
+        free(recorder);
+        return NULL;
+    }
+    close(fd);
+    recorder->readings = (recorder_reading_t*)(recorder->header + 1);
+
+    if(resize || !recorder_compatible(recorder->header, capacity)){
+        memset(recorder->header, 0, recorder->length);
+        memcpy(recorder->header->magic, RECORDER_MAGIC, sizeof(RECORDER_MAGIC));
+        recorder->header->reading_length = sizeof(recorder_reading_t);
+        recorder->header->capacity = capacity;
+    }
+    recorder->recorded = atomic_load(&recorder->header->recorded);
+    recorder->next_slot = recorder->recorded % capacity;
+#ifdef DEBUG
+    printf(PURPLE_CLR "RECORDER: %s HOLDS THE LAST %u READINGS, %lu RECORDED BEFORE.\n" OFF_CLR, path, capacity,
+        (unsigned long) recorder->recorded);
+#endif
+    return recorder;
+}
+
+void recorder_record(recorder_t* recorder, const sensor_data_t* data){
+    recorder_reading_t* slot = &recorder->readings[recorder->next_slot];
+    uint64_t sequence = ++recorder->recorded;
+    // the sequence goes in last, a slot that is cut off half written does not match it
+    slot->sequence = 0;
+    atomic_thread_fence(memory_order_release);
+    slot->ts = data->ts;
+    slot->value = data->value;
+    slot->sensor_id = data->id;
+    atomic_thread_fence(memory_order_release);
+    slot->sequence = sequence;
+    atomic_store_explicit(&recorder->header->recorded, sequence, memory_order_release);
+    if(++recorder->next_slot == recorder->header->capacity) recorder->next_slot = 0;
+}
+
+void recorder_close(recorder_t** recorder){
+    if(recorder == NULL || *recorder == NULL) return;
+    munmap((*recorder)->header, (*recorder)->length);
+    free(*recorder);
+    *recorder = NULL;
+}
+
+static bool recorder_compatible(const recorder_header_t* header, uint32_t capacity){
+    return memcmp(header->magic, RECORDER_MAGIC, sizeof(RECORDER_MAGIC)) == 0
+        && header->reading_length == sizeof(recorder_reading_t) && header->capacity == capacity;
+}
@@ -0,0 +1,64 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+
+#include <stdatomic.h>
+#include "config.h"
+
+// readings the flight recorder holds, the oldest is overwritten by the next one
+#ifndef RECORDER_READINGS
+#define RECORDER_READINGS (64 * 1024)
+#endif
+
+/*
+ * Flight recorder file: a recorder_header_t, then 'capacity' slots of recorder_reading_t, in the byte order of the
+ * machine that wrote it. Reading n (counting from 1) is in slot (n - 1) % capacity and carries n as its sequence.
+ * A slot whose sequence does not match is empty, or was being overwritten when it was read. The file is shared
+ * memory of the gateway: what it recorded is still there after a crash. recorder_dump prints it.
+ */
+#define RECORDER_MAGIC "GWREC1"
+
+typedef struct {
+    char magic[8];                  // RECORDER_MAGIC
+    uint32_t reading_length;        // sizeof(recorder_reading_t)
+    uint32_t capacity;              // slots
+    _Alignas(8) _Atomic uint64_t recorded; // readings recorded since the file was created
+    uint8_t reserved[40];           // pads the header to 64 bytes
+} recorder_header_t;
+
+typedef struct {
+    uint64_t sequence;              // the number of the reading, 0 for a slot never written
+    int64_t ts;
+    double value;
+    sensor_id_t sensor_id;
+    uint16_t reserved[3];
+} recorder_reading_t;
+
+typedef struct recorder recorder_t;
+
+/**
+ * Maps the flight recorder file, a file of an earlier run with the same capacity is continued
+ * \param path the file
+ * \param capacity the number of readings it holds
+ * \return the recorder, or NULL if the file can not be created or mapped
+ */
+recorder_t* recorder_open(const char* path, uint32_t capacity);
+
+/**
+ * Records a reading with plain stores into the mapping, no formatting and no system call
+ * Only one thread may record.
+ * \param recorder a pointer to the recorder
+ * \param data the reading
+ */
+void recorder_record(recorder_t* recorder, const sensor_data_t* data);
+
+/**
+ * Unmaps the file, it is not synced: the kernel writes it back like any other page
+ * \param recorder a double pointer to the recorder, set to NULL
+ */
+void recorder_close(recorder_t** recorder);
+
+#endif /* _RECORDER_H_ */
@@ -0,0 +1,92 @@
+/**
+ * \author Alken Rrokaj
+ *
+ * Prints the readings in a flight recorder file (RECORDER_FILE), oldest first, as the lines of sensor_data_recv or as CSV
+ * usage: recorder_dump [-c] [-n <readings>] [-s <sensor_id>] [<file>]
+ *     -c  CSV: sequence,sensor_id,value,ts
+ *     -n  only the last readings recorded, of any sensor (before -s)
+ *     -s  only the readings of this sensor
+ * The gateway may be running: a reading it overwrote while the file was read is left out.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "recorder.h"
+
+static int print_usage(const char* name){
+    printf("usage: %s [-c] [-n <readings>] [-s <sensor_id>] [<file>]\n", name);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]){
+    bool csv = false;
+    uint64_t last = UINT64_MAX;
+    int sensor_id = -1;
+    int option;
+    while((option = getopt(argc, argv, "cn:s:")) != -1){
+        switch(option){
+        case 'c':
+            csv = true;
+            break;
+        case 'n':
+            last = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            sensor_id = atoi(optarg);
+            break;
+        default:
+            return print_usage(argv[0]);
+        }
+    }
+    const char* path = (optind < argc) ? argv[optind] : RECORDER_FILE;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    const recorder_header_t* header = MAP_FAILED;
+    if(fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(recorder_header_t))
+        header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(fd >= 0) close(fd);
+    if(header == MAP_FAILED || memcmp(header->magic, RECORDER_MAGIC, sizeof(RECORDER_MAGIC)) != 0
+        || header->reading_length != sizeof(recorder_reading_t) || header->capacity == 0
+        || st.st_size < (off_t)(sizeof(recorder_header_t) + (size_t) header->capacity * sizeof(recorder_reading_t))){
+        fprintf(stderr, "%s IS NOT A FLIGHT RECORDER FILE\n", path);
+        return EXIT_FAILURE;
+    }
+    const recorder_reading_t* readings = (const recorder_reading_t*)(header + 1);
+
+    uint64_t recorded = atomic_load_explicit(&header->recorded, memory_order_acquire);
+    uint64_t held = (recorded < header->capacity) ? recorded : header->capacity;
+    if(last < held) held = last;
+    if(csv) printf("sequence,sensor_id,value,ts\n");
+    uint64_t skipped = 0;
+    for(uint64_t sequence = recorded - held + 1; sequence <= recorded; sequence++){
+        // the sequence is read before and after the copy, the gateway sets it to 0 while it writes the slot
+        const recorder_reading_t* slot = &readings[(sequence - 1) % header->capacity];
+        uint64_t before = slot->sequence;
+        atomic_thread_fence(memory_order_acquire);
+        recorder_reading_t reading = *slot;
+        atomic_thread_fence(memory_order_acquire);
+        if(before != sequence || slot->sequence != sequence){
+            skipped++;
+            continue;
+        }
+        if(sensor_id >= 0 && reading.sensor_id != sensor_id) continue;
+        if(csv){
+            printf("%lu,%u,%f,%ld\n", (unsigned long) reading.sequence, reading.sensor_id, reading.value, (long) reading.ts);
+        }else{
+            printf("ID: %u   VAL: %f   TIME: %ld\n", reading.sensor_id, reading.value, (long) reading.ts);
+        }
+    }
+    fprintf(stderr, "%lu READINGS RECORDED, %lu HELD", (unsigned long) recorded, (unsigned long) held);
+    if(skipped > 0) fprintf(stderr, ", %lu LEFT OUT (BEING OVERWRITTEN OR CUT OFF)", (unsigned long) skipped);
+    fprintf(stderr, "\n");
+    munmap((void*) header, st.st_size);
+    return EXIT_SUCCESS;
+}
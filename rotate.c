@@ -0,0 +1,258 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <zlib.h>
+#include "config.h"
+#include "rotate.h"
+
+// bytes read from a segment per gzwrite
+#define ROTATE_COMPRESS_CHUNK (64 * 1024)
+
+struct rotate {
+    char path[PATH_MAX - 32];       // room for the segment suffix
+    void* header;
+    size_t header_length;
+    FILE* fp;
+    char* buffer;                   // ROTATE_BUFFER for 'fp', kept over rotations
+    size_t bytes;                   // bytes in the live file
+    time_t opened;                  // when the live file was started
+    long number;                    // the newest segment
+
+    // segments for the compressor, guarded by 'lock'
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    long queue[ROTATE_QUEUE];
+    int queue_head;
+    int queue_count;
+    bool closing;
+    bool compressor_running;
+    pthread_t compressor;
+};
+
+// helper methods
+static void rotate_segment_path(const rotate_t* rotate, long number, const char* suffix, char* segment);
+static long rotate_scan_segments(rotate_t* rotate);
+static int rotate_start_file(rotate_t* rotate, const char* mode);
+static int rotate_rotate(rotate_t* rotate);
+static bool rotate_enqueue(rotate_t* rotate, long number);
+static void* rotate_compressor(void* arg);
+static int rotate_compress(rotate_t* rotate, long number);
+
+rotate_t* rotate_open(const char* path, const char* mode, const void* header, size_t header_length){
+    rotate_t* rotate = calloc(1, sizeof(rotate_t));
+    if(rotate == NULL) return NULL;
+    snprintf(rotate->path, sizeof(rotate->path), "%s", path);
+    rotate->buffer = malloc(ROTATE_BUFFER);
+    if(rotate->buffer == NULL || (header_length > 0 && (rotate->header = malloc(header_length)) == NULL)){
+        free(rotate->buffer);
+        free(rotate);
+        return NULL;
+    }
+    if(header_length > 0) memcpy(rotate->header, header, header_length);
+    rotate->header_length = header_length;
+    pthread_mutex_init(&rotate->lock, NULL);
+    pthread_cond_init(&rotate->queued, NULL);
+
+    // numbers go on from the segments of an earlier run, the ones it did not get to compress are queued again
+    rotate->number = rotate_scan_segments(rotate);
+    if(rotate_start_file(rotate, mode) != 0){
+        rotate->fp = NULL;
+        rotate_close(&rotate);
+        return NULL;
+    }
+#if ROTATE_COMPRESS
+    rotate->compressor_running = (pthread_create(&rotate->compressor, NULL, &rotate_compressor, rotate) == 0);
+#endif
+    return rotate;
+}
+
+FILE* rotate_stream(rotate_t* rotate){
+    return rotate->fp;
+}
+
+int rotate_account(rotate_t* rotate, size_t bytes){
+    rotate->bytes += bytes;
+    if(rotate->bytes >= ROTATE_MAX_BYTES) return rotate_rotate(rotate);
+    if(ROTATE_INTERVAL_SECONDS > 0 && rotate->bytes > rotate->header_length && time(NULL) - rotate->opened >= ROTATE_INTERVAL_SECONDS)
+        return rotate_rotate(rotate);
+    return 0;
+}
+
+void rotate_close(rotate_t** rotate){
+    if(rotate == NULL || *rotate == NULL) return;
+    if((*rotate)->fp != NULL) fclose((*rotate)->fp);
+    if((*rotate)->compressor_running){
+        pthread_mutex_lock(&(*rotate)->lock);
+        (*rotate)->closing = true;
+        pthread_cond_signal(&(*rotate)->queued);
+        pthread_mutex_unlock(&(*rotate)->lock);
+        pthread_join((*rotate)->compressor, NULL);
+    }
+    pthread_mutex_destroy(&(*rotate)->lock);
+    pthread_cond_destroy(&(*rotate)->queued);
+    free((*rotate)->header);
+    free((*rotate)->buffer);
+    free(*rotate);
+    *rotate = NULL;
+}
+
+static void rotate_segment_path(const rotate_t* rotate, long number, const char* suffix, char* segment){
+    snprintf(segment, PATH_MAX, "%s.%06ld%s", rotate->path, number, suffix);
+}
+
+// returns the highest segment number on disk, segments that are not compressed go in the queue
+static long rotate_scan_segments(rotate_t* rotate){
+    char pattern[PATH_MAX + 8];
+    snprintf(pattern, sizeof(pattern), "%s.[0-9]*", rotate->path);
+    glob_t found;
+    if(glob(pattern, 0, NULL, &found) != 0) return 0;
+    long newest = 0;
+    size_t prefix = strlen(rotate->path) + 1;
+    for(size_t i = 0; i < found.gl_pathc; i++){
+        char* end;
+        long number = strtol(found.gl_pathv[i] + prefix, &end, 10);
+        if(number > newest) newest = number;
+        if(*end == '\0' && ROTATE_COMPRESS) rotate_enqueue(rotate, number);
+        if(strcmp(end, ".gz.tmp") == 0) unlink(found.gl_pathv[i]);
+    }
+    globfree(&found);
+    return newest;
+}
+
+// opens the live file, a new one gets the header
+static int rotate_start_file(rotate_t* rotate, const char* mode){
+    rotate->fp = fopen(rotate->path, mode);
+    if(rotate->fp == NULL) return -1;
+    setvbuf(rotate->fp, rotate->buffer, _IOFBF, ROTATE_BUFFER);
+    fseek(rotate->fp, 0, SEEK_END);
+    long size = ftell(rotate->fp);
+    rotate->bytes = (size > 0) ? size : 0;
+    if(rotate->bytes == 0 && rotate->header_length > 0){
+        fwrite(rotate->header, 1, rotate->header_length, rotate->fp);
+        rotate->bytes = rotate->header_length;
+    }
+    rotate->opened = time(NULL);
+    return 0;
+}
+
+// renames the live file to the next segment and starts a new one; when that fails the old file stays live
+static int rotate_rotate(rotate_t* rotate){
+    char segment[PATH_MAX];
+    long number = rotate->number + 1;
+    rotate_segment_path(rotate, number, "", segment);
+    fclose(rotate->fp);
+    if(rename(rotate->path, segment) != 0 || rotate_start_file(rotate, "w") != 0){
+        rename(segment, rotate->path);
+        if(rotate_start_file(rotate, "a") != 0) ERROR_HANDLER(true, "CANNOT REOPEN A ROTATING FILE");
+        // try again after another interval or another ROTATE_MAX_BYTES, not on every write
+        rotate->bytes = rotate->header_length;
+        return -1;
+    }
+
+    pthread_mutex_lock(&rotate->lock);
+    rotate->number = number;
+    pthread_mutex_unlock(&rotate->lock);
+    if(number > ROTATE_KEEP){
+        char expired[PATH_MAX];
+        rotate_segment_path(rotate, number - ROTATE_KEEP, "", expired);
+        unlink(expired);
+        rotate_segment_path(rotate, number - ROTATE_KEEP, ".gz", expired);
+        unlink(expired);
+    }
+#if ROTATE_COMPRESS
+    rotate_enqueue(rotate, number);
+#endif
+#ifdef DEBUG
+    printf(CYAN_CLR "ROTATE: %s IS NOW %s.\n" OFF_CLR, rotate->path, segment);
+#endif
+    return 0;
+}
+
+// hands a segment to the compressor without waiting, false if the queue is full
+static bool rotate_enqueue(rotate_t* rotate, long number){
+    pthread_mutex_lock(&rotate->lock);
+    bool queued = rotate->queue_count < ROTATE_QUEUE;
+    if(queued){
+        rotate->queue[(rotate->queue_head + rotate->queue_count) % ROTATE_QUEUE] = number;
+        rotate->queue_count++;
+        pthread_cond_signal(&rotate->queued);
+    }
+    pthread_mutex_unlock(&rotate->lock);
+    return queued;
+}
+
+// compresses the queued segments at idle priority until the file is closed; what is still queued then stays
+// uncompressed and is queued again by rotate_scan_segments when the file is next opened
+static void* rotate_compressor(void* arg){
+    rotate_t* rotate = arg;
+    struct sched_param param = { .sched_priority = 0 };
+    if(pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) setpriority(PRIO_PROCESS, gettid(), 19);
+
+    pthread_mutex_lock(&rotate->lock);
+    while(true){
+        while(rotate->queue_count == 0 && !rotate->closing) pthread_cond_wait(&rotate->queued, &rotate->lock);
+        if(rotate->closing) break;
+        long number = rotate->queue[rotate->queue_head];
+        rotate->queue_head = (rotate->queue_head + 1) % ROTATE_QUEUE;
+        rotate->queue_count--;
+        pthread_mutex_unlock(&rotate->lock);
+
+        rotate_compress(rotate, number);
+
+        pthread_mutex_lock(&rotate->lock);
+        // the segment may have expired while it was compressed
+        if(number <= rotate->number - ROTATE_KEEP){
+            char expired[PATH_MAX];
+            rotate_segment_path(rotate, number, ".gz", expired);
+            unlink(expired);
+        }
+    }
+    pthread_mutex_unlock(&rotate->lock);
+    return NULL;
+}
+
+// gzips a segment to a temporary file that is renamed when complete, then removes the segment
+static int rotate_compress(rotate_t* rotate, long number){
+    char segment[PATH_MAX], temporary[PATH_MAX], compressed[PATH_MAX];
+    rotate_segment_path(rotate, number, "", segment);
+    rotate_segment_path(rotate, number, ".gz.tmp", temporary);
+    rotate_segment_path(rotate, number, ".gz", compressed);
+
+    int fd = open(segment, O_RDONLY);
+    if(fd < 0) return -1;
+    gzFile gz = gzopen(temporary, "wb6");
+    if(gz == NULL){
+        close(fd);
+        return -1;
+    }
+    static _Thread_local char chunk[ROTATE_COMPRESS_CHUNK];
+    ssize_t n;
+    bool failed = false;
+    while(!failed && (n = read(fd, chunk, sizeof(chunk))) != 0){
+        if(n < 0 && errno == EINTR) continue;
+        failed = (n < 0 || gzwrite(gz, chunk, n) != n);
+    }
+    close(fd);
+    failed = (gzclose(gz) != Z_OK) || failed;
+    if(failed || rename(temporary, compressed) != 0){
+        unlink(temporary);
+        return -1;
+    }
+    unlink(segment);
+#ifdef DEBUG
+    printf(CYAN_CLR "ROTATE: COMPRESSED %s.\n" OFF_CLR, compressed);
+#endif
+    return 0;
+}
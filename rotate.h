@@ -0,0 +1,81 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _ROTATE_H_
+#define _ROTATE_H_
+
+#include <stdio.h>
+#include "config.h"
+
+// a file is rotated once it holds this many bytes
+#ifndef ROTATE_MAX_BYTES
+#define ROTATE_MAX_BYTES (64L * 1024 * 1024)
+#endif
+
+// or once it has been open this many seconds (and holds more than its header), 0 rotates on size only
+#ifndef ROTATE_INTERVAL_SECONDS
+#define ROTATE_INTERVAL_SECONDS (24 * 3600)
+#endif
+
+// rotated segments kept next to the live file, older ones are removed
+#ifndef ROTATE_KEEP
+#define ROTATE_KEEP 8
+#endif
+
+// set ROTATE_COMPRESS to 0 to keep the rotated segments as they are instead of gzip compressing them
+#ifndef ROTATE_COMPRESS
+#define ROTATE_COMPRESS 1
+#endif
+
+// the live file is written through a buffer of this size
+#ifndef ROTATE_BUFFER
+#define ROTATE_BUFFER (64 * 1024)
+#endif
+
+// rotated segments waiting for the compressor, a segment that does not fit stays uncompressed
+#ifndef ROTATE_QUEUE
+#define ROTATE_QUEUE 16
+#endif
+
+/*
+ * The live file is renamed to <path>.<number> (numbers go up, also across restarts) and a new one is opened in its
+ * place, so a reader never sees a half rotated file. A thread at the lowest priority compresses the segment to
+ * <path>.<number>.gz; the thread that writes only pays for the rename and the new file.
+ */
+typedef struct rotate rotate_t;
+
+/**
+ * Opens a file that rotates, and the thread that compresses its segments
+ * \param path the live file
+ * \param mode "a" to append to an existing file, "w" to start it empty (the older segments stay)
+ * \param header written at the start of every new file, NULL for none
+ * \param header_length the length of 'header'
+ * \return the rotating file, or NULL if it can not be opened
+ */
+rotate_t* rotate_open(const char* path, const char* mode, const void* header, size_t header_length);
+
+/**
+ * Returns the stream to write to, it changes when the file rotates
+ * \param rotate a pointer to the rotating file
+ * \return the stream of the live file
+ */
+FILE* rotate_stream(rotate_t* rotate);
+
+/**
+ * Counts bytes written to the stream and rotates the file when it is due, on size or on time
+ * Call it between complete records, a record is never split over two segments.
+ * \param rotate a pointer to the rotating file
+ * \param bytes the bytes just written, 0 to only check the interval
+ * \return zero for success, -1 if a rotation failed (writing goes on in the same file)
+ */
+int rotate_account(rotate_t* rotate, size_t bytes);
+
+/**
+ * Closes the live file, waits for the compressor to finish the segment it is on and frees the rotating file
+ * Segments still waiting for the compressor stay uncompressed until the file is opened again.
+ * \param rotate a double pointer to the rotating file, set to NULL
+ */
+void rotate_close(rotate_t** rotate);
+
+#endif /* _ROTATE_H_ */
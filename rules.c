@@ -0,0 +1,152 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "rules.h"
+
+#ifndef SET_MAX_TEMP
+#error SET_MAX_TEMP not set
+#endif
+
+#ifndef SET_MIN_TEMP
+#error SET_MIN_TEMP not set
+#endif
+
+#define NO_RULE 0
+#define MAX_RULES UINT16_MAX
+
+// rules[0] is the default rule, the lookup tables hold an index in 'rules' or NO_RULE
+struct rule_table {
+    rule_t* rules;
+    int size;
+    int capacity;
+    uint16_t sensor_rules[SENSOR_ID_RANGE];
+    uint16_t room_rules[SENSOR_ID_RANGE];
+};
+
+// helper methods
+static alert_t rules_target_state(const rule_t* rule, alert_t current, sensor_value_t value);
+static int rules_add(rule_table_t* table, const rule_t* rule);
+
+rule_table_t* rules_load(FILE* fp_rules){
+    rule_table_t* table = calloc(1, sizeof(rule_table_t));
+    if(table == NULL) return NULL;
+
+    rule_t default_rule = {
+        .min_temp = SET_MIN_TEMP,   .max_temp = SET_MAX_TEMP,
+        .hysteresis = 0,            .min_duration = 0,
+        .cooldown = 0
+    };
+    if(rules_add(table, &default_rule) < 0){
+        rules_free(&table);
+        return NULL;
+    }
+    if(fp_rules == NULL) return table;
+
+    char* line = NULL;
+    size_t line_size = 0;
+    while(getline(&line, &line_size, fp_rules) != -1){
+        char scope[16];
+        char id[16];
+        rule_t rule;
+        if(line[0] == '#') continue;
+        if(sscanf(line, "%15s %15s %lf %lf %lf %ld %ld", scope, id, &rule.min_temp, &rule.max_temp,
+            &rule.hysteresis, &rule.min_duration, &rule.cooldown) != 7) continue;
+
+        // reject rules that can never clear
+        if(rule.min_temp > rule.max_temp || rule.hysteresis < 0) continue;
+
+        if(strcmp(scope, "default") == 0){
+            table->rules[0] = rule;
+            continue;
+        }
+
+        char* end;
+        unsigned long target = strtoul(id, &end, 10);
+        if(*end != '\0' || target > UINT16_MAX) continue;
+
+        uint16_t* slot;
+        if(strcmp(scope, "sensor") == 0) slot = &table->sensor_rules[target];
+        else if(strcmp(scope, "room") == 0) slot = &table->room_rules[target];
+        else continue;
+
+        // a later rule for the same sensor or room replaces the earlier one
+        if(*slot != NO_RULE){
+            table->rules[*slot] = rule;
+            continue;
+        }
+        int index = rules_add(table, &rule);
+        if(index > 0) *slot = (uint16_t) index;
+    }
+    free(line);
+
+#ifdef DEBUG
+    printf(GREEN_CLR "RULES: LOADED %d RULES.\n" OFF_CLR, table->size);
+#endif
+    return table;
+}
+
+void rules_free(rule_table_t** table){
+    if(table == NULL || *table == NULL) return;
+    free((*table)->rules);
+    free(*table);
+    *table = NULL;
+}
+
+const rule_t* rules_lookup(const rule_table_t* table, sensor_id_t sensor_id, room_id_t room_id){
+    if(table->sensor_rules[sensor_id] != NO_RULE) return &table->rules[table->sensor_rules[sensor_id]];
+    if(table->room_rules[room_id] != NO_RULE) return &table->rules[table->room_rules[room_id]];
+    return &table->rules[0];
+}
+
+bool rules_evaluate(const rule_t* rule, alert_state_t* alert, sensor_value_t value, sensor_ts_t ts){
+    alert_t target = rules_target_state(rule, alert->state, value);
+
+    // nothing to report, forget a state change that did not last
+    if(target == alert->state){
+        alert->pending = alert->state;
+        return false;
+    }
+
+    // debounce: the new state has to hold for min_duration seconds
+    if(target != alert->pending){
+        alert->pending = target;
+        alert->pending_since = ts;
+    }
+    if(ts - alert->pending_since < rule->min_duration) return false;
+
+    // a new alert waits until the cooldown of the previous one is over
+    if(target != ALERT_NORMAL && alert->last_alert != 0 && ts - alert->last_alert < rule->cooldown) return false;
+
+    if(target != ALERT_NORMAL) alert->last_alert = ts;
+    alert->state = target;
+    return true;
+}
+
+// the state a value belongs in, an active alert only clears once the value is 'hysteresis' back in range
+static alert_t rules_target_state(const rule_t* rule, alert_t current, sensor_value_t value){
+    if(value > rule->max_temp) return ALERT_HOT;
+    if(value < rule->min_temp) return ALERT_COLD;
+    if(current == ALERT_HOT && value > rule->max_temp - rule->hysteresis) return ALERT_HOT;
+    if(current == ALERT_COLD && value < rule->min_temp + rule->hysteresis) return ALERT_COLD;
+    return ALERT_NORMAL;
+}
+
+// appends a rule and returns its index, or -1 if there is no room left
+static int rules_add(rule_table_t* table, const rule_t* rule){
+    if(table->size == MAX_RULES) return -1;
+    if(table->size == table->capacity){
+        int capacity = (table->capacity == 0) ? 16 : table->capacity * 2;
+        rule_t* rules = realloc(table->rules, capacity * sizeof(rule_t));
+        if(rules == NULL) return -1;
+        table->rules = rules;
+        table->capacity = capacity;
+    }
+    table->rules[table->size] = *rule;
+    return table->size++;
+}
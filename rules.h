@@ -0,0 +1,62 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _RULES_H_
+#define _RULES_H_
+
+#include <stdio.h>
+#include "config.h"
+
+/*
+ * A rules file has one rule per line, lines starting with '#' are ignored:
+ *   <scope> <id> <min_temp> <max_temp> <hysteresis> <min_duration> <cooldown>
+ * 'scope' is "sensor", "room" or "default" (the id of a default rule is ignored).
+ * A sensor rule wins over a room rule, a room rule wins over the default rule.
+ * Without a default rule SET_MIN_TEMP and SET_MAX_TEMP are used.
+ */
+
+// structure to hold one rule
+typedef struct {
+    sensor_value_t min_temp;    // below this the sensor is too cold
+    sensor_value_t max_temp;    // above this the sensor is too hot
+    sensor_value_t hysteresis;  // how far back in range a value has to be before an alert is cleared
+    sensor_ts_t min_duration;   // seconds a new state has to hold before it is reported
+    sensor_ts_t cooldown;       // seconds between two reported alerts of the same sensor
+} rule_t;
+
+typedef struct rule_table rule_table_t;
+
+/**
+ * Parses a rules file into a new rule table
+ * \param fp_rules file pointer to the rules file, if NULL only the default rule is used
+ * \return a newly allocated rule table, or NULL if memory allocation failed
+ */
+rule_table_t* rules_load(FILE* fp_rules);
+
+/**
+ * Frees the rule table and sets '*table' to NULL
+ * \param table a double pointer to the rule table
+ */
+void rules_free(rule_table_t** table);
+
+/**
+ * Finds the rule that applies to a sensor in O(1)
+ * \param table a pointer to the rule table
+ * \param sensor_id the sensor to look for
+ * \param room_id the room of the sensor
+ * \return the sensor rule, else the room rule, else the default rule
+ */
+const rule_t* rules_lookup(const rule_table_t* table, sensor_id_t sensor_id, room_id_t room_id);
+
+/**
+ * Feeds a new running average into the alert state of a sensor in O(1)
+ * \param rule the rule of the sensor
+ * \param alert the alert state of the sensor, updated in place
+ * \param value the new running average
+ * \param ts the timestamp of the reading
+ * \return true if the reported state changed (the new state is in 'alert->state'), false otherwise
+ */
+bool rules_evaluate(const rule_t* rule, alert_state_t* alert, sensor_value_t value, sensor_ts_t ts);
+
+#endif /* _RULES_H_ */
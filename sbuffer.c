@@ -8,6 +8,7 @@
 #include <pthread.h>
 #include "sbuffer.h"
 #include "config.h"
+#include "metrics.h"
 
 #define READ true
 #define UNREAD false
@@ -16,6 +17,7 @@ typedef struct sbuffer_node {
     struct sbuffer_node* next;      // a pointer to the next node
     sensor_data_t data;             // a structure containing the data
     bool reader_threads[THREAD_NR]; // check which threads have read the data
+    struct timespec inserted;       // CLOCK_MONOTONIC, for the lag of the readers
 } sbuffer_node_t;
 
 // a structure to keep track of the buffer
@@ -55,6 +57,7 @@ int sbuffer_free(sbuffer_t** buffer){
         dummy = (*buffer)->head;
         (*buffer)->head = (*buffer)->head->next;
         free(dummy);
+        metrics_gauge_add(METRIC_SBUFFER_READINGS, -1);
     }
     rwlock = (*buffer)->rwlock;
     free(*buffer);
@@ -63,26 +66,30 @@ int sbuffer_free(sbuffer_t** buffer){
     // unlock the buffer and destroy the lock
     pthread_rwlock_unlock(rwlock);
     pthread_rwlock_destroy(rwlock);
+    free(rwlock);
 
     return SBUFFER_SUCCESS;
 }
 
 int sbuffer_remove(sbuffer_t* buffer, sensor_data_t* data, READ_TH_ENUM thread){
     if(buffer == NULL) return SBUFFER_FAILURE;
-    if(buffer->head == NULL) return SBUFFER_NO_DATA;
 
-    pthread_rwlock_rdlock(buffer->rwlock);
-    sbuffer_read(buffer->head, data, thread);
-    pthread_rwlock_unlock(buffer->rwlock);
+    // lock to write: the read flags change and the head may be removed,
+    // so both reader threads can never decide to free the same head
+    pthread_rwlock_wrlock(buffer->rwlock);
+    int result = sbuffer_read(buffer->head, data, thread);
+    if(result != SBUFFER_SUCCESS){
+        pthread_rwlock_unlock(buffer->rwlock);
+        return result;
+    }
 
-    
     // if all reader threads have not read it do not go further
-    for(int i = 0; i < THREAD_NR; i++)
-        if((buffer->head)->reader_threads[i] == UNREAD)
+    for(int i = 0; i < THREAD_NR; i++){
+        if((buffer->head)->reader_threads[i] == UNREAD){
+            pthread_rwlock_unlock(buffer->rwlock);
             return SBUFFER_SUCCESS;
-
-    // lock to write/remove
-    pthread_rwlock_wrlock(buffer->rwlock);
+        }
+    }
 
     // if both read it, remove the file
     sbuffer_node_t* dummy = buffer->head;
@@ -93,6 +100,7 @@ int sbuffer_remove(sbuffer_t* buffer, sensor_data_t* data, READ_TH_ENUM thread){
     else
         buffer->head = buffer->head->next;
     free(dummy);
+    metrics_gauge_add(METRIC_SBUFFER_READINGS, -1);
 
     // unlock sbuffer
     pthread_rwlock_unlock(buffer->rwlock);
@@ -112,6 +120,8 @@ int sbuffer_read(sbuffer_node_t* buffer_node, sensor_data_t* data,READ_TH_ENUM t
     
     *data = buffer_node->data;
     buffer_node->reader_threads[thread] = READ;
+    metrics_observe((thread == DATAMGR_THREAD) ? METRIC_SBUFFER_LAG_DATAMGR : METRIC_SBUFFER_LAG_STORAGE,
+        metrics_elapsed_ns(&buffer_node->inserted));
     return SBUFFER_SUCCESS;
 }
 
@@ -125,6 +135,7 @@ int sbuffer_insert(sbuffer_t* buffer, sensor_data_t* data){
     dummy->next = NULL;
     dummy->reader_threads[0] = UNREAD;
     dummy->reader_threads[1] = UNREAD;
+    clock_gettime(CLOCK_MONOTONIC, &dummy->inserted);
 
     // lock the buffer
     pthread_rwlock_wrlock(buffer->rwlock);
@@ -140,6 +151,7 @@ int sbuffer_insert(sbuffer_t* buffer, sensor_data_t* data){
 
     // after inserting the data, unlock the buffer
     pthread_rwlock_unlock(buffer->rwlock);
+    metrics_gauge_add(METRIC_SBUFFER_READINGS, 1);
 
 #ifdef DEBUG
     printf(YELLOW_CLR "INSERTED IN BUFFER\n" OFF_CLR);
@@ -36,11 +36,11 @@ int sbuffer_init(sbuffer_t** buffer);
 int sbuffer_free(sbuffer_t** buffer);
 
 /**
- * Removes the first sensor data in 'buffer' (at the 'head') and returns this sensor data as '*data'
- * If 'buffer' is empty, the function doesn't block until new sensor data becomes available but returns SBUFFER_NO_DATA
+ * Returns the oldest sensor data in 'buffer' that 'check' has not read yet as '*data', the node is removed once every reader thread read it
+ * If there is no such data, the function doesn't block until new sensor data becomes available but returns SBUFFER_NO_DATA
  * \param buffer a pointer to the buffer that is used
  * \param data a pointer to pre-allocated sensor_data_t space, the data will be copied into this structure. No new memory is allocated for 'data' in this function.
- * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occurred
+ * \return SBUFFER_SUCCESS on success, SBUFFER_NO_DATA if there is nothing to read and SBUFFER_FAILURE if an error occurred
  */
 int sbuffer_remove(sbuffer_t* buffer, sensor_data_t* data, READ_TH_ENUM check);
 
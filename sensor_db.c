@@ -4,9 +4,19 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <time.h>
 #include "config.h"
 #include <sqlite3.h>
 #include "sensor_db.h"
+#include "archive.h"
+#include "storage.h"
+#include "logger.h"
+#include "metrics.h"
 
  // Stringify the DB_NAME
  // Source: https://stackoverflow.com/a/3419392
@@ -15,9 +25,99 @@
 #define DB_NAME_STRING EXPAND_AND_QUOTE(DB_NAME)
 #define TABLE_NAME_STRING EXPAND_AND_QUOTE(TABLE_NAME)
 
-void log_event(char* log_event);
+// the INSERT prepared on one time partition
+typedef struct {
+    sensor_ts_t start;
+    sqlite3_stmt* stmt;
+} partition_stmt_t;
+
+// a connection with its prepared statements
+struct dbconn {
+    sqlite3* db;
+    sqlite3_stmt* insert_stmt;
+
+    // group commit: rows inserted since BEGIN and when the transaction has to be committed
+    int pending_rows;
+    struct timespec commit_deadline;    // CLOCK_REALTIME, for pthread_cond_timedwait
+    sensor_db_stats_t stats;
+
+    // every reading that is not committed yet, replayed after a failed transaction;
+    // DB_RETRY_QUEUE_LENGTH readings allocated for the writer only, the pooled readers never insert
+    sensor_data_t* retry_queue;
+    int queue_head;
+    int queue_count;
+    struct timespec retry_deadline;     // next recovery attempt while the writer is down
+    long retry_backoff_ms;
+
+    // time partitions sorted on their start, and the INSERT of the partitions written last
+    sensor_ts_t* partitions;
+    int partition_count;
+    int partition_capacity;
+    partition_stmt_t partition_stmts[DB_PARTITION_STMTS];
+
+    // background checkpointer, only running when the profile asks for it
+    const sensor_db_profile_t* profile;
+    pthread_t checkpointer;
+    bool checkpointer_running;
+    pthread_mutex_t checkpoint_lock;
+    pthread_cond_t checkpoint_cond;     // signalled to stop the checkpointer
+    bool checkpoint_stop;
+};
+
+// a prepared SELECT, stepped by sensor_db_cursor_next
+struct db_cursor {
+    sqlite3_stmt* stmt;
+    bool done;
+};
+
+// a fixed set of read-only connections handed out one thread at a time
+struct db_pool {
+    DBCONN** connections;
+    int size;
+    int available;                      // connections[0 .. available - 1] are free
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+};
+
+static const sensor_db_profile_t db_profiles[DB_PROFILE_COUNT] = {
+    [DB_PROFILE_LEGACY]   = {"legacy",   "DELETE", "FULL",   -2000,             0,            false},
+    [DB_PROFILE_DURABLE]  = {"durable",  "WAL",    "FULL",   DB_CACHE_SIZE_KIB, DB_MMAP_SIZE, true},
+    [DB_PROFILE_BALANCED] = {"balanced", "WAL",    "NORMAL", DB_CACHE_SIZE_KIB, DB_MMAP_SIZE, true},
+    [DB_PROFILE_FAST]     = {"fast",     "WAL",    "OFF",    DB_CACHE_SIZE_KIB, DB_MMAP_SIZE, true}
+};
+static db_profile_t db_profile = DB_PROFILE;
+
 int sql_query(DBCONN* conn, callback_t f, char* sql);
-void sensor_close_threads();
+static void sensor_db_deadline(struct timespec* deadline, long ms);
+static bool sensor_db_deadline_passed(const struct timespec* deadline);
+static int sensor_db_apply_profile(DBCONN* conn);
+static void* sensor_db_checkpointer(void* arg);
+static DBCONN* sensor_db_open_reader();
+static int sensor_db_open_writer(DBCONN* conn, char clear_up_flag);
+static int sensor_db_busy_handler(void* arg, int count);
+static void sensor_db_recover(DBCONN* conn);
+static int sensor_db_replay(DBCONN* conn);
+static void sensor_db_close_writer(DBCONN* conn);
+static int sensor_db_create_table(DBCONN* conn, const char* table);
+static sqlite3_stmt* sensor_db_prepare_insert(DBCONN* conn, const char* table);
+static int sensor_db_index_table(DBCONN* conn, const char* table, bool create);
+static sensor_ts_t sensor_db_partition_start(sensor_ts_t ts);
+static int sensor_db_load_partitions(DBCONN* conn);
+static int sensor_db_split_table(DBCONN* conn);
+static int sensor_db_update_view(DBCONN* conn);
+static sqlite3_stmt* sensor_db_partition_stmt(DBCONN* conn, sensor_ts_t ts, bool* expired);
+static int sensor_db_add_partition(DBCONN* conn, sensor_ts_t start);
+static void sensor_db_apply_retention(DBCONN* conn);
+static int sensor_db_drop_partition(DBCONN* conn, int index);
+static long sensor_db_archive_partition(DBCONN* conn, sensor_ts_t start);
+static void sensor_db_append_range(sqlite3_str* sql, const db_range_t* range);
+static sqlite3_stmt* sensor_db_prepare_range(DBCONN* conn, sqlite3_str* sql, const db_range_t* range);
+static int sensor_db_compare_aggregate(const void* a, const void* b);
+static int sensor_db_aggregate_indexed(DBCONN* conn, const db_range_t* range, long bucket_seconds, db_aggregate_t** rows, long* count, long* capacity);
+static int sensor_db_aggregate_grouped(DBCONN* conn, const db_range_t* range, long bucket_seconds, db_aggregate_t** rows, long* count, long* capacity);
+static int sensor_db_add_aggregate(db_aggregate_t** rows, long* count, long* capacity, const db_aggregate_t* row);
+static bool sensor_db_step_min(sqlite3_stmt* stmt, sqlite3_int64* value);
+static int sensor_db_find_value(DBCONN* conn, const char* comparison, sensor_value_t value, callback_t f);
 
 // global variables
 static pthread_cond_t* data_cond;
@@ -31,9 +131,6 @@ static int* data_sensor_db;
 static pthread_rwlock_t* connmgr_lock;
 static bool* connmgr_working;
 
-static pthread_mutex_t* fifo_mutex;
-static int* fifo_fd;
-
 void sensor_db_init(config_thread_t* config_thread){
     data_cond = config_thread->data_cond;
     datamgr_lock = config_thread->datamgr_lock;
@@ -45,116 +142,342 @@ void sensor_db_init(config_thread_t* config_thread){
 
     connmgr_lock = config_thread->connmgr_lock;
     connmgr_working = config_thread->connmgr_working;
+}
 
-    fifo_fd = config_thread->fifo_fd;
-    fifo_mutex = config_thread->fifo_mutex;
+int sensor_db_set_profile(db_profile_t profile){
+    if(profile < 0 || profile >= DB_PROFILE_COUNT) return -1;
+    db_profile = profile;
+    return 0;
 }
 
+const sensor_db_profile_t* sensor_db_get_profile(db_profile_t profile){
+    if(profile < 0 || profile >= DB_PROFILE_COUNT) return NULL;
+    return &db_profiles[profile];
+}
 
 DBCONN* init_connection(char clear_up_flag){
 #ifdef DEBUG
     printf(BLUE_CLR "DB: INITIATING SQL SERVER CONNECTION.\n"OFF_CLR);
 #endif
-    DBCONN* db;
-    if(sqlite3_open(DB_NAME_STRING, &db) != SQLITE_OK){ //if database can't open
-        fprintf(stderr, "CANNOT OPEN DATABASE: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
-        log_event("UNABLE TO CONNECT TO SQL SERVER.");
+    DBCONN* db = calloc(1, sizeof(DBCONN));
+    if(db == NULL) return NULL;
+    db->retry_queue = malloc(DB_RETRY_QUEUE_LENGTH * sizeof(sensor_data_t));
+    if(db->retry_queue == NULL){
+        free(db);
+        return NULL;
+    }
+    db->retry_backoff_ms = DB_RETRY_MIN_MS;
+    int rc = sensor_db_open_writer(db, clear_up_flag);
+    if(rc == SQLITE_CANTOPEN){ //if database can't open
+        disconnect(db);
+        log_event(LOG_DB_CONNECT_FAILED, 0, 0);
 #ifdef DEBUG
         printf(BLUE_CLR "DB: CANNOT OPEN DATABASE.\n DB: UNABLE TO CONNECT TO SQL SERVER.\n" OFF_CLR);
 #endif
         sensor_close_threads();
         return NULL;
     }
+    if(rc != SQLITE_OK){
+        disconnect(db);
+        return NULL;
+    }
 
-    if(clear_up_flag){
-        char* sql = sqlite3_mprintf("DROP TABLE IF EXISTS %s", TABLE_NAME_STRING);
-        if(sql_query(db, 0, sql) == -1)
+    // checkpoints run next to the inserts instead of inside whichever COMMIT crosses the WAL limit
+    if(db->profile->background_checkpoint){
+        pthread_mutex_init(&(db->checkpoint_lock), NULL);
+        pthread_cond_init(&(db->checkpoint_cond), NULL);
+        if(pthread_create(&(db->checkpointer), NULL, &sensor_db_checkpointer, db) != 0){
+            pthread_mutex_destroy(&(db->checkpoint_lock));
+            pthread_cond_destroy(&(db->checkpoint_cond));
+            disconnect(db);
             return NULL;
+        }
+        db->checkpointer_running = true;
     }
 
-    char* sql = sqlite3_mprintf("CREATE TABLE IF NOT EXISTS `%s` ("
-        "`id` INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "`sensor_id` INTEGER NULL,"
-        "`sensor_value` DECIMAL(4,2) NULL,"
-        "`timestamp` TIMESTAMP NULL)", TABLE_NAME_STRING);
-
-    if(sql_query(db, 0, sql) == -1)
-        return NULL;
-
-    log_event("ESTABLISHED SQL SERVER CONNECTION.");
-    sql = sqlite3_mprintf("NEW TABLE %s CREATED.", DB_NAME_STRING);
-    log_event(sql);
+    log_event(LOG_DB_CONNECTED, 0, 0);
+    log_event(LOG_DB_TABLE_CREATED, 0, 0);
 
 #ifdef DEBUG
-    printf(BLUE_CLR "DB: ESTABLISHED SQL SERVER CONNECTION.\n%s\n"OFF_CLR, sql);
+    printf(BLUE_CLR "DB: ESTABLISHED SQL SERVER CONNECTION.\nNEW TABLE %s CREATED.\n"OFF_CLR, DB_NAME_STRING);
 #endif
-    sqlite3_free(sql);
     return db;
 }
 
 
 void disconnect(DBCONN* conn){
-    sqlite3_close(conn);
+    if(conn == NULL) return;
+    if(conn->checkpointer_running){
+        pthread_mutex_lock(&(conn->checkpoint_lock));
+        conn->checkpoint_stop = true;
+        pthread_cond_signal(&(conn->checkpoint_cond));
+        pthread_mutex_unlock(&(conn->checkpoint_lock));
+        pthread_join(conn->checkpointer, NULL);
+        pthread_mutex_destroy(&(conn->checkpoint_lock));
+        pthread_cond_destroy(&(conn->checkpoint_cond));
+
+        // leave an empty WAL behind
+        if(conn->db != NULL) sqlite3_wal_checkpoint_v2(conn->db, NULL, SQLITE_CHECKPOINT_TRUNCATE, NULL, NULL);
+    }
+    sensor_db_close_writer(conn);
+    free(conn->partitions);
+    free(conn->retry_queue);
+    free(conn);
 #ifdef DEBUG
     printf(BLUE_CLR"DB: DISCONNECTED FROM DATABASE\n" OFF_CLR);
 #endif
 }
 
-int sensor_db_listen(DBCONN* conn, sbuffer_t** buffer){
-    while(*connmgr_working == true){
-        pthread_mutex_lock(db_lock);
-        while((*data_sensor_db) == 0){
-            pthread_cond_wait(db_cond, db_lock);
-        #ifdef DEBUG
-            printf(BLUE_CLR "DB: WAITING FOR DATA.\n" OFF_CLR);
-        #endif
-        }
-        if(*connmgr_working == false){
-            pthread_mutex_unlock(db_lock);
-            break;
+int sensor_db_insert_batched(DBCONN* conn, const sensor_data_t* data){
+    // the queue only overflows while the writer is down, then the oldest reading is dropped
+    if(conn->queue_count == DB_RETRY_QUEUE_LENGTH){
+        conn->queue_head = (conn->queue_head + 1) % DB_RETRY_QUEUE_LENGTH;
+        conn->queue_count--;
+        conn->stats.dropped_rows++;
+    }
+    conn->retry_queue[(conn->queue_head + conn->queue_count) % DB_RETRY_QUEUE_LENGTH] = *data;
+    conn->queue_count++;
+    if(conn->queue_count > conn->stats.queue_depth_max) conn->stats.queue_depth_max = conn->queue_count;
+
+    // rows from before a failure are not in a transaction, they go in with the next recovery
+    if(conn->db == NULL || conn->queue_count - 1 != conn->pending_rows){
+        if(sensor_db_deadline_passed(&(conn->retry_deadline))) sensor_db_recover(conn);
+        return (conn->queue_count == 0) ? 0 : -1;
+    }
+
+    // the first row opens the transaction and starts the DB_COMMIT_MS timer
+    if(conn->pending_rows == 0){
+        if(sql_query(conn, 0, sqlite3_mprintf("BEGIN")) != 0){
+            sensor_db_recover(conn);
+            return (conn->queue_count == 0) ? 0 : -1;
         }
-        pthread_mutex_unlock(db_lock);
+        sensor_db_deadline(&(conn->commit_deadline), DB_COMMIT_MS);
+    }
 
-        // copy the data
-        sensor_data_t new_data;
-        if(sbuffer_remove(*buffer, &new_data, DB_THREAD) != SBUFFER_SUCCESS) break;
+    if(insert_sensor(conn, data->id, data->value, data->ts) != 0){
+        sensor_db_recover(conn);
+        return (conn->queue_count == 0) ? 0 : -1;
+    }
+    conn->pending_rows++;
 
-        // insert the sensor in the database
-        if(insert_sensor(conn, new_data.id, new_data.value, new_data.ts) != 0)
-            return -1;
+    // commit every DB_COMMIT_ROWS rows or every DB_COMMIT_MS, whichever comes first
+    if(conn->pending_rows >= DB_COMMIT_ROWS || sensor_db_deadline_passed(&(conn->commit_deadline)))
+        return sensor_db_commit(conn);
+    return 0;
+}
 
-#ifdef DEBUG
-            printf(BLUE_CLR "DB: GOT DATA. %ld\n" OFF_CLR, time(NULL));
-#endif
-        pthread_mutex_lock(db_lock);
-        (*data_sensor_db)--;
-        pthread_mutex_unlock(db_lock);
+int sensor_db_commit(DBCONN* conn){
+    if(conn->queue_count == 0) return 0;
 
+    // queued rows outside of a transaction wait for the next recovery attempt
+    if(conn->db == NULL || conn->pending_rows < conn->queue_count){
+        if(sensor_db_deadline_passed(&(conn->retry_deadline))) sensor_db_recover(conn);
+        return (conn->queue_count == 0) ? 0 : -1;
     }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(sql_query(conn, 0, sqlite3_mprintf("COMMIT")) != 0){
+        sensor_db_recover(conn);
+        return (conn->queue_count == 0) ? 0 : -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // update the metrics
+    metrics_observe(METRIC_STORAGE_COMMIT, (end.tv_sec - start.tv_sec) * 1000000000UL + end.tv_nsec - start.tv_nsec);
+    long latency_us = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+    sensor_db_stats_t* stats = &(conn->stats);
+    stats->commits++;
+    stats->rows_committed += conn->pending_rows;
+    stats->commit_latency_total_us += latency_us;
+    if(latency_us > stats->commit_latency_max_us) stats->commit_latency_max_us = latency_us;
+    if(conn->pending_rows > stats->rows_per_commit_max) stats->rows_per_commit_max = conn->pending_rows;
+#ifdef DEBUG
+    printf(BLUE_CLR "DB: COMMITTED %d ROWS IN %ld US.\n" OFF_CLR, conn->pending_rows, latency_us);
+#endif
+    conn->pending_rows = 0;
+    conn->queue_head = 0;
+    conn->queue_count = 0;
+    if(DB_PARTITIONED) sensor_db_apply_retention(conn);
     return 0;
 }
 
+void sensor_db_get_stats(DBCONN* conn, sensor_db_stats_t* stats){
+    // the checkpoint counters are written by the checkpointer
+    if(conn->checkpointer_running) pthread_mutex_lock(&(conn->checkpoint_lock));
+    *stats = conn->stats;
+    stats->queue_depth = conn->queue_count;
+    if(conn->checkpointer_running) pthread_mutex_unlock(&(conn->checkpoint_lock));
+}
+
 int insert_sensor(DBCONN* conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts){
-    char* sql = sqlite3_mprintf("INSERT INTO `%s` (`sensor_id`, `sensor_value`, `timestamp`)"
-        "VALUES ('%d', '%f', '%ld');", TABLE_NAME_STRING, id, value, ts);
-    return sql_query(conn, 0, sql);
+    if(conn->db == NULL) return -1;
+
+    // route the reading to the partition of its timestamp
+    sqlite3_stmt* stmt = conn->insert_stmt;
+    if(DB_PARTITIONED){
+        bool expired = false;
+        stmt = sensor_db_partition_stmt(conn, ts, &expired);
+        if(expired){
+            conn->stats.expired_rows++;
+            return 0;
+        }
+        if(stmt == NULL) return -1;
+    }
+
+    // bind the values as numbers, the value keeps its full double precision
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_double(stmt, 2, value);
+    sqlite3_bind_int64(stmt, 3, ts);
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+
+    if(rc != SQLITE_DONE){
+        fprintf(stderr, "Failed: %s\n", sqlite3_errmsg(conn->db));
+        return -1;
+    }
+#ifdef DEBUG
+    printf(BLUE_CLR "DB: INSERTED ID: %u   VAL: %f   TIME: %ld\n" OFF_CLR, id, value, ts);
+#endif
+    return 0;
 }
 
 int insert_sensor_from_file(DBCONN* conn, FILE* sensor_data){
-    while(!feof(sensor_data)){
-        sensor_id_t buffer_id[1];   
-        sensor_value_t buffer_val[1];
-        sensor_ts_t buffer_ts[1];
+    if(sensor_db_bulk_load_begin(conn) != 0) return -1;
+
+    // map the whole file and decode it in chunks, a pipe or socket falls back to reading the chunks
+    struct stat st;
+    int fd = fileno(sensor_data);
+    uint8_t* records = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+        records = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(records != MAP_FAILED) madvise(records, st.st_size, MADV_SEQUENTIAL);
+    }
+
+    int result = 0;
+    if(records != MAP_FAILED){
+        size_t count = st.st_size / DB_RECORD_LENGTH;
+        for(size_t first = 0; first < count && result == 0; first += DB_LOAD_CHUNK){
+            size_t chunk = (count - first < DB_LOAD_CHUNK) ? count - first : DB_LOAD_CHUNK;
+            result = sensor_db_insert_records(conn, records + first * DB_RECORD_LENGTH, chunk);
+        }
+        munmap(records, st.st_size);
+    } else {
+        uint8_t* buffer = malloc(DB_LOAD_CHUNK * DB_RECORD_LENGTH);
+        size_t chunk;
+        if(buffer == NULL) result = -1;
+        while(result == 0 && (chunk = fread(buffer, DB_RECORD_LENGTH, DB_LOAD_CHUNK, sensor_data)) > 0)
+            result = sensor_db_insert_records(conn, buffer, chunk);
+        free(buffer);
+    }
+    if(result != 0 || sensor_db_bulk_load_end(conn) != 0){
+        sensor_db_bulk_load_abort(conn);
+        return -1;
+    }
+    return 0;
+}
+
+int sensor_db_insert_records(DBCONN* conn, const uint8_t* records, size_t count){
+    // decode the packed records of a chunk first, then insert them in one tight loop
+    sensor_data_t chunk[DB_LOAD_CHUNK];
+    while(count > 0){
+        size_t n = (count < DB_LOAD_CHUNK) ? count : DB_LOAD_CHUNK;
+        for(size_t i = 0; i < n; i++){
+            const uint8_t* record = records + i * DB_RECORD_LENGTH;
+            memcpy(&(chunk[i].id), record, sizeof(sensor_id_t));
+            memcpy(&(chunk[i].value), record + sizeof(sensor_id_t), sizeof(sensor_value_t));
+            memcpy(&(chunk[i].ts), record + sizeof(sensor_id_t) + sizeof(sensor_value_t), sizeof(sensor_ts_t));
+        }
+        for(size_t i = 0; i < n; i++)
+            if(sensor_db_insert_batched(conn, &chunk[i]) != 0) return -1;
+        records += n * DB_RECORD_LENGTH;
+        count -= n;
+    }
+    return 0;
+}
+
+int sensor_db_create_indexes(DBCONN* conn){
+    if(!DB_PARTITIONED) return sensor_db_index_table(conn, TABLE_NAME_STRING, true);
+    for(int i = 0; i < conn->partition_count; i++){
+        char* table = sqlite3_mprintf("%s_%ld", TABLE_NAME_STRING, conn->partitions[i]);
+        int result = sensor_db_index_table(conn, table, true);
+        sqlite3_free(table);
+        if(result != 0) return -1;
+    }
+    return 0;
+}
+
+int sensor_db_drop_indexes(DBCONN* conn){
+    if(!DB_PARTITIONED) return sensor_db_index_table(conn, TABLE_NAME_STRING, false);
+    for(int i = 0; i < conn->partition_count; i++){
+        char* table = sqlite3_mprintf("%s_%ld", TABLE_NAME_STRING, conn->partitions[i]);
+        int result = sensor_db_index_table(conn, table, false);
+        sqlite3_free(table);
+        if(result != 0) return -1;
+    }
+    return 0;
+}
+
+int sensor_db_drop_partitions_before(DBCONN* conn, sensor_ts_t ts){
+    if(!DB_PARTITIONED || conn->db == NULL) return 0;
+    if(sensor_db_commit(conn) != 0) return -1;
+    int dropped = 0;
+    while(conn->partition_count > 0 && conn->partitions[0] + DB_PARTITION_SECONDS <= ts){
+        if(sensor_db_drop_partition(conn, 0) != 0) return -1;
+        dropped++;
+    }
+    return dropped;
+}
 
-        if(fread(buffer_id, sizeof(buffer_id), 1, sensor_data) == 0) return 0;
-        fread(buffer_val, sizeof(buffer_val), 1, sensor_data);
-        fread(buffer_ts, sizeof(buffer_ts), 1, sensor_data);
-        if(insert_sensor(conn, buffer_id[0], buffer_val[0], buffer_ts[0]) != 0) return -1;
+int sensor_db_archive_partitions_before(DBCONN* conn, sensor_ts_t ts){
+    if(!DB_PARTITIONED || conn->db == NULL) return 0;
+    if(sensor_db_commit(conn) != 0) return -1;
+    int archived = 0;
+    while(conn->partition_count > 0 && conn->partitions[0] + DB_PARTITION_SECONDS <= ts){
+        // the partition is only dropped once its archive is safely on disk
+        long rows = sensor_db_archive_partition(conn, conn->partitions[0]);
+        if(rows < 0 || sensor_db_drop_partition(conn, 0) != 0) return -1;
+        conn->stats.archived_rows += rows;
+        archived++;
+    }
+    return archived;
+}
+
+int sensor_db_partition_count(DBCONN* conn){
+    return conn->partition_count;
+}
+
+int sensor_db_bulk_load_begin(DBCONN* conn){
+    // the open group commit is finished first, the indexes can only be dropped outside of it
+    if(sensor_db_commit(conn) != 0) return -1;
+    if(sensor_db_drop_indexes(conn) != 0){
+        sensor_db_create_indexes(conn);
+        return -1;
     }
     return 0;
 }
 
+int sensor_db_bulk_load_end(DBCONN* conn){
+    // one sorted index build is far cheaper than updating the b-trees row by row
+    if(sensor_db_commit(conn) != 0) return -1;
+    return sensor_db_create_indexes(conn);
+}
+
+int sensor_db_bulk_load_abort(DBCONN* conn){
+    // the rows that are not committed yet are dropped instead of going in with a later commit or disconnect
+    if(conn->db != NULL && !sqlite3_get_autocommit(conn->db)) sqlite3_exec(conn->db, "ROLLBACK", 0, 0, 0);
+    conn->stats.dropped_rows += conn->queue_count;
+    conn->pending_rows = 0;
+    conn->queue_head = 0;
+    conn->queue_count = 0;
+
+    // the rollback may have taken partitions created in the transaction with it,
+    // a writer that is down builds its indexes again when it is reopened
+    if(conn->db == NULL) return -1;
+    if(DB_PARTITIONED && sensor_db_load_partitions(conn) != 0) return -1;
+    return sensor_db_create_indexes(conn);
+}
+
 int find_sensor_all(DBCONN* conn, callback_t f){
     char* sql = sqlite3_mprintf("SELECT * FROM %s", TABLE_NAME_STRING);
     return sql_query(conn, f, sql);
@@ -162,14 +485,12 @@ int find_sensor_all(DBCONN* conn, callback_t f){
 
 
 int find_sensor_by_value(DBCONN* conn, sensor_value_t value, callback_t f){
-    char* sql = sqlite3_mprintf("SELECT * FROM `%s` WHERE sensor_value = %f;", TABLE_NAME_STRING, value);
-    return sql_query(conn, f, sql);
+    return sensor_db_find_value(conn, "=", value, f);
 }
 
 
 int find_sensor_exceed_value(DBCONN* conn, sensor_value_t value, callback_t f){
-    char* sql = sqlite3_mprintf("SELECT * FROM `%s` WHERE sensor_value > %f;", TABLE_NAME_STRING, value);
-    return sql_query(conn, f, sql);
+    return sensor_db_find_value(conn, ">", value, f);
 }
 
 
@@ -183,25 +504,241 @@ int find_sensor_after_timestamp(DBCONN* conn, sensor_ts_t ts, callback_t f){
     return sql_query(conn, f, sql);
 }
 
+int find_sensor_by_id_in_range(DBCONN* conn, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, callback_t f){
+    char* sql = sqlite3_mprintf("SELECT `id`, `sensor_id`, `sensor_value`, `timestamp` FROM `%s` "
+        "WHERE sensor_id = %u AND timestamp BETWEEN %ld AND %ld ORDER BY timestamp;", TABLE_NAME_STRING, id, from, to);
+    return sql_query(conn, f, sql);
+}
 
-// helper methods 
-void log_event(char* log_event){
-    FILE* fp_log = fopen("gateway.log", "a");
-    fprintf(fp_log, "\nSEQ_NR: 1   TIME: %ld\n%s\n", time(NULL), log_event);
-    fclose(fp_log);
+int find_sensor_by_id_after_timestamp(DBCONN* conn, sensor_id_t id, sensor_ts_t ts, callback_t f){
+    char* sql = sqlite3_mprintf("SELECT `id`, `sensor_id`, `sensor_value`, `timestamp` FROM `%s` "
+        "WHERE sensor_id = %u AND timestamp > %ld ORDER BY timestamp;", TABLE_NAME_STRING, id, ts);
+    return sql_query(conn, f, sql);
+}
+
+db_cursor_t* sensor_db_cursor_open(DBCONN* conn, const db_range_t* range){
+    if(conn == NULL || conn->db == NULL || range == NULL) return NULL;
+
+    sqlite3_str* sql = sqlite3_str_new(conn->db);
+    sqlite3_str_appendf(sql, "SELECT `sensor_id`, `sensor_value`, `timestamp` FROM `%s`", TABLE_NAME_STRING);
+    sensor_db_append_range(sql, range);
+    if(range->sensor_id != DB_ANY_SENSOR) sqlite3_str_appendall(sql, " ORDER BY timestamp");
+    if(range->limit > 0) sqlite3_str_appendall(sql, " LIMIT :limit");
+
+    sqlite3_stmt* stmt = sensor_db_prepare_range(conn, sql, range);
+    if(stmt == NULL) return NULL;
+    sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":limit"), range->limit);
+
+    db_cursor_t* cursor = calloc(1, sizeof(db_cursor_t));
+    if(cursor == NULL){
+        sqlite3_finalize(stmt);
+        return NULL;
+    }
+    cursor->stmt = stmt;
+    return cursor;
+}
+
+int sensor_db_cursor_next(db_cursor_t* cursor, sensor_data_t* batch, int capacity){
+    int count = 0;
+    while(!cursor->done && count < capacity){
+        int rc = sqlite3_step(cursor->stmt);
+        if(rc == SQLITE_DONE){
+            cursor->done = true;
+        } else if(rc == SQLITE_ROW){
+            batch[count].id = (sensor_id_t) sqlite3_column_int(cursor->stmt, 0);
+            batch[count].value = sqlite3_column_double(cursor->stmt, 1);
+            batch[count].ts = (sensor_ts_t) sqlite3_column_int64(cursor->stmt, 2);
+            count++;
+        } else {
+            fprintf(stderr, "CURSOR FAILED: %s\n", sqlite3_errmsg(sqlite3_db_handle(cursor->stmt)));
+            cursor->done = true;
+            return -1;
+        }
+    }
+    return count;
+}
+
+void sensor_db_cursor_close(db_cursor_t** cursor){
+    if(cursor == NULL || *cursor == NULL) return;
+    sqlite3_finalize((*cursor)->stmt);
+    free(*cursor);
+    *cursor = NULL;
+}
+
+long sensor_db_scan(DBCONN* conn, const db_range_t* range, batch_callback_t f, void* arg){
+    db_cursor_t* cursor = sensor_db_cursor_open(conn, range);
+    if(cursor == NULL) return -1;
+    sensor_data_t batch[DB_CURSOR_BATCH];
+    long total = 0;
+    int count;
+    while((count = sensor_db_cursor_next(cursor, batch, DB_CURSOR_BATCH)) > 0){
+        total += count;
+        if(f(arg, batch, count) != 0) break;
+    }
+    sensor_db_cursor_close(&cursor);
+    return (count < 0) ? -1 : total;
 }
 
+long sensor_db_aggregate(DBCONN* conn, const db_range_t* range, long bucket_seconds, const sensor_map_t* rooms, db_aggregate_t** results){
+    if(conn == NULL || conn->db == NULL || range == NULL || results == NULL) return -1;
+    *results = NULL;
+
+    // the sum goes in 'avg' until the rows of a room are merged
+    db_aggregate_t* rows = NULL;
+    long count = 0, capacity = 0;
+    int rc = (bucket_seconds > 0 && !DB_PARTITIONED)
+        ? sensor_db_aggregate_indexed(conn, range, bucket_seconds, &rows, &count, &capacity)
+        : sensor_db_aggregate_grouped(conn, range, bucket_seconds, &rows, &count, &capacity);
+    if(rc != 0){
+        fprintf(stderr, "AGGREGATE FAILED: %s\n", sqlite3_errmsg(conn->db));
+        free(rows);
+        return -1;
+    }
+
+    // the sensors of a room come back separately, merge their rows per bucket
+    if(rooms != NULL){
+        long mapped = 0;
+        for(long i = 0; i < count; i++){
+            room_id_t room_id;
+            if(!sensor_map_lookup(rooms, rows[i].key, &room_id)) continue;
+            rows[mapped] = rows[i];
+            rows[mapped++].key = room_id;
+        }
+        count = mapped;
+        qsort(rows, count, sizeof(db_aggregate_t), sensor_db_compare_aggregate);
+        long merged = 0;
+        for(long i = 1; i < count; i++){
+            db_aggregate_t* last = &rows[merged];
+            if(rows[i].key == last->key && (bucket_seconds <= 0 || rows[i].bucket == last->bucket)){
+                if(rows[i].bucket < last->bucket) last->bucket = rows[i].bucket;
+                if(rows[i].min < last->min) last->min = rows[i].min;
+                if(rows[i].max > last->max) last->max = rows[i].max;
+                last->count += rows[i].count;
+                last->avg += rows[i].avg;
+            } else {
+                rows[++merged] = rows[i];
+            }
+        }
+        if(count > 0) count = merged + 1;
+    }
+    for(long i = 0; i < count; i++) rows[i].avg /= rows[i].count;
+    *results = rows;
+    return count;
+}
+
+db_pool_t* sensor_db_pool_create(int size){
+    if(size <= 0) return NULL;
+    db_pool_t* pool = calloc(1, sizeof(db_pool_t));
+    if(pool == NULL) return NULL;
+    pool->connections = calloc(size, sizeof(DBCONN*));
+    if(pool->connections == NULL){
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->released), NULL);
+
+    for(int i = 0; i < size; i++){
+        DBCONN* conn = sensor_db_open_reader();
+        if(conn == NULL){
+            sensor_db_pool_free(&pool);
+            return NULL;
+        }
+        pool->connections[pool->size++] = conn;
+        pool->available++;
+    }
+#ifdef DEBUG
+    printf(BLUE_CLR "DB: OPENED %d READER CONNECTIONS.\n" OFF_CLR, size);
+#endif
+    return pool;
+}
+
+void sensor_db_pool_free(db_pool_t** pool){
+    if(pool == NULL || *pool == NULL) return;
+    // every connection has to be released before the pool goes away
+    for(int i = 0; i < (*pool)->size; i++) disconnect((*pool)->connections[i]);
+    pthread_mutex_destroy(&((*pool)->lock));
+    pthread_cond_destroy(&((*pool)->released));
+    free((*pool)->connections);
+    free(*pool);
+    *pool = NULL;
+}
+
+DBCONN* sensor_db_pool_acquire(db_pool_t* pool){
+    pthread_mutex_lock(&(pool->lock));
+    while(pool->available == 0) pthread_cond_wait(&(pool->released), &(pool->lock));
+    DBCONN* conn = pool->connections[--pool->available];
+    pthread_mutex_unlock(&(pool->lock));
+    return conn;
+}
+
+void sensor_db_pool_release(db_pool_t* pool, DBCONN* conn){
+    pthread_mutex_lock(&(pool->lock));
+    pool->connections[pool->available++] = conn;
+    pthread_mutex_unlock(&(pool->lock));
+    pthread_cond_signal(&(pool->released));
+}
+
+int sensor_db_pool_query(db_pool_t* pool, const char* sql, callback_t f, void* arg){
+    DBCONN* conn = sensor_db_pool_acquire(pool);
+    char* err_msg = 0;
+    int result = 0;
+    if(sqlite3_exec(conn->db, sql, f, arg, &err_msg) != SQLITE_OK){
+        fprintf(stderr, "Failed: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        result = -1;
+    }
+    sensor_db_pool_release(pool, conn);
+    return result;
+}
+
+
+// the storage backend on top of a writer connection
+static void* sensor_db_backend_open(char clear_up_flag){
+    return init_connection(clear_up_flag);
+}
+
+static int sensor_db_backend_insert_batch(void* handle, const sensor_data_t* batch, int count){
+    int result = 0;
+    for(int i = 0; i < count; i++)
+        if(sensor_db_insert_batched(handle, &batch[i]) != 0) result = -1;
+    return result;
+}
+
+static int sensor_db_backend_flush(void* handle){
+    return sensor_db_commit(handle);
+}
+
+static long sensor_db_backend_query_range(void* handle, const db_range_t* range, batch_callback_t f, void* arg){
+    return sensor_db_scan(handle, range, f, arg);
+}
+
+static void sensor_db_backend_close(void* handle){
+    DBCONN* conn = handle;
+    // one last recovery attempt for readings that are still queued
+    if(conn->queue_count > 0 && conn->pending_rows == 0) sensor_db_deadline(&(conn->retry_deadline), 0);
+    if(sensor_db_commit(conn) != 0){
+        log_event(LOG_DB_READINGS_LOST, 0, conn->queue_count);
+    }
+    disconnect(conn);
+}
+
+const storage_backend_t storage_sqlite = {
+    "sqlite", sensor_db_backend_open, sensor_db_backend_insert_batch, sensor_db_backend_flush,
+    sensor_db_backend_query_range, sensor_db_backend_close
+};
+
+// helper methods 
 int sql_query(DBCONN* conn, callback_t f, char* sql){
     char* err_msg = 0;
-    if(sqlite3_exec(conn, sql, f, 0, &err_msg) != SQLITE_OK){
+    if(conn->db == NULL){
+        sqlite3_free(sql);
+        return -1;
+    }
+    if(sqlite3_exec(conn->db, sql, f, 0, &err_msg) != SQLITE_OK){
         fprintf(stderr, "Failed: %s\n", err_msg);
         sqlite3_free(err_msg);
         sqlite3_free(sql);
-        sqlite3_close(conn);
-        log_event("CONNECTION TO SQL SERVER LOST.");
-#ifdef DEBUG
-        printf(BLUE_CLR "DB: CONNECTION TO SQL SERVER LOST.\n" OFF_CLR);
-#endif
         return -1;
     }
 #ifdef DEBUG
@@ -232,4 +769,694 @@ void sensor_close_threads(){
 	// notify the threads
 	pthread_cond_broadcast(db_cond);
 	pthread_cond_broadcast(data_cond);
-}
\ No newline at end of file
+}
+
+// sets 'deadline' to 'ms' milliseconds from now
+static void sensor_db_deadline(struct timespec* deadline, long ms){
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (ms % 1000) * 1000000L;
+    if(deadline->tv_nsec >= 1000000000L){
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static bool sensor_db_deadline_passed(const struct timespec* deadline){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+// applies the pragmas of the selected profile to a new connection
+static int sensor_db_apply_profile(DBCONN* conn){
+    const sensor_db_profile_t* profile = &db_profiles[db_profile];
+    conn->profile = profile;
+    if(sql_query(conn, 0, sqlite3_mprintf("PRAGMA journal_mode=%s", profile->journal_mode)) != 0) return -1;
+    if(sql_query(conn, 0, sqlite3_mprintf("PRAGMA synchronous=%s", profile->synchronous)) != 0) return -1;
+    if(sql_query(conn, 0, sqlite3_mprintf("PRAGMA cache_size=%d", -profile->cache_size_kib)) != 0) return -1;
+    if(sql_query(conn, 0, sqlite3_mprintf("PRAGMA mmap_size=%ld", profile->mmap_size)) != 0) return -1;
+    if(profile->background_checkpoint && sql_query(conn, 0, sqlite3_mprintf("PRAGMA wal_autocheckpoint=0")) != 0) return -1;
+    return 0;
+}
+
+// copies the WAL back into the database every DB_CHECKPOINT_MS through its own connection
+// a PASSIVE checkpoint never waits for the writer, so the inserts are not held up
+static void* sensor_db_checkpointer(void* arg){
+    DBCONN* conn = arg;
+    sqlite3* db;
+    if(sqlite3_open_v2(DB_NAME_STRING, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK){
+        fprintf(stderr, "CANNOT OPEN CHECKPOINT CONNECTION: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&(conn->checkpoint_lock));
+    while(!conn->checkpoint_stop){
+        struct timespec deadline;
+        sensor_db_deadline(&deadline, DB_CHECKPOINT_MS);
+        if(pthread_cond_timedwait(&(conn->checkpoint_cond), &(conn->checkpoint_lock), &deadline) != ETIMEDOUT) continue;
+        pthread_mutex_unlock(&(conn->checkpoint_lock));
+
+        int wal_frames, checkpointed;
+        int rc = sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_PASSIVE, &wal_frames, &checkpointed);
+
+        pthread_mutex_lock(&(conn->checkpoint_lock));
+        if(rc == SQLITE_OK){
+            conn->stats.checkpoints++;
+            if(checkpointed > 0) conn->stats.checkpointed_frames += checkpointed;
+        }
+    }
+    pthread_mutex_unlock(&(conn->checkpoint_lock));
+    sqlite3_close(db);
+    return NULL;
+}
+
+// opens a read-only connection for the pool, in WAL mode it reads a snapshot and never blocks the writer
+static DBCONN* sensor_db_open_reader(){
+    DBCONN* conn = calloc(1, sizeof(DBCONN));
+    if(conn == NULL) return NULL;
+    if(sqlite3_open_v2(DB_NAME_STRING, &(conn->db), SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK){
+        fprintf(stderr, "CANNOT OPEN READER CONNECTION: %s\n", sqlite3_errmsg(conn->db));
+        disconnect(conn);
+        return NULL;
+    }
+
+    const sensor_db_profile_t* profile = &db_profiles[db_profile];
+    sqlite3_busy_timeout(conn->db, DB_READER_BUSY_MS);
+    if(sql_query(conn, 0, sqlite3_mprintf("PRAGMA cache_size=%d", -profile->cache_size_kib)) != 0
+        || sql_query(conn, 0, sqlite3_mprintf("PRAGMA mmap_size=%ld", profile->mmap_size)) != 0){
+        disconnect(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+// opens the database handle of the writer, applies the profile, creates the schema and prepares the INSERT
+// returns SQLITE_CANTOPEN if the file can not be opened at all
+static int sensor_db_open_writer(DBCONN* conn, char clear_up_flag){
+    if(sqlite3_open(DB_NAME_STRING, &(conn->db)) != SQLITE_OK){
+        fprintf(stderr, "CANNOT OPEN DATABASE: %s\n", sqlite3_errmsg(conn->db));
+        return SQLITE_CANTOPEN;
+    }
+    sqlite3_busy_handler(conn->db, sensor_db_busy_handler, conn);
+
+    if(sensor_db_apply_profile(conn) != 0) return SQLITE_ERROR;
+
+    // with partitions TABLE_NAME is a view over the partition tables, they are created as readings arrive;
+    // indexes a failed bulk load left out are built again like CREATE TABLE does for a single table
+    if(DB_PARTITIONED){
+        if(sensor_db_load_partitions(conn) != 0 || sensor_db_create_indexes(conn) != 0) return SQLITE_ERROR;
+        if(clear_up_flag){
+            while(conn->partition_count > 0)
+                if(sensor_db_drop_partition(conn, conn->partition_count - 1) != 0) return SQLITE_ERROR;
+        }
+        return SQLITE_OK;
+    }
+
+    if(clear_up_flag){
+        char* sql = sqlite3_mprintf("DROP TABLE IF EXISTS %s", TABLE_NAME_STRING);
+        if(sql_query(conn, 0, sql) == -1) return SQLITE_ERROR;
+    }
+    if(sensor_db_create_table(conn, TABLE_NAME_STRING) != 0) return SQLITE_ERROR;
+
+    // the INSERT is parsed once per connection, every reading only binds its values
+    conn->insert_stmt = sensor_db_prepare_insert(conn, TABLE_NAME_STRING);
+    return (conn->insert_stmt == NULL) ? SQLITE_ERROR : SQLITE_OK;
+}
+
+// called by sqlite while another connection holds the lock, sleeps with an exponential backoff
+// returning 0 gives up and the statement fails with SQLITE_BUSY
+static int sensor_db_busy_handler(void* arg, int count){
+    DBCONN* conn = arg;
+    if(count >= DB_BUSY_RETRIES) return 0;
+    long sleep_us = DB_BUSY_MIN_US << count;
+    if(sleep_us > DB_BUSY_MAX_US) sleep_us = DB_BUSY_MAX_US;
+    struct timespec pause = { sleep_us / 1000000, (sleep_us % 1000000) * 1000 };
+    nanosleep(&pause, NULL);
+    conn->stats.busy_retries++;
+    return 1;
+}
+
+// a transaction failed: the queued readings are replayed on the same handle when the database was only busy,
+// any other error reopens the connection first; on failure the next attempt waits twice as long
+static void sensor_db_recover(DBCONN* conn){
+    int error = (conn->db == NULL) ? SQLITE_CANTOPEN : sqlite3_errcode(conn->db);
+    bool busy = (error == SQLITE_BUSY || error == SQLITE_LOCKED);
+    if(conn->db != NULL && !sqlite3_get_autocommit(conn->db)) sqlite3_exec(conn->db, "ROLLBACK", 0, 0, 0);
+    conn->pending_rows = 0;
+
+    if(busy){
+        // the rollback may have taken partitions created in the transaction with it
+        conn->stats.busy_failures++;
+        if(DB_PARTITIONED && sensor_db_load_partitions(conn) != 0) busy = false;
+    }
+    if(!busy){
+        if(conn->db != NULL){
+            log_event(LOG_DB_CONNECTION_LOST, 0, 0);
+#ifdef DEBUG
+            printf(BLUE_CLR "DB: CONNECTION TO SQL SERVER LOST.\n" OFF_CLR);
+#endif
+        }
+        sensor_db_close_writer(conn);
+
+        conn->stats.reconnects++;
+        if(sensor_db_open_writer(conn, 0) != SQLITE_OK) sensor_db_close_writer(conn);
+    }
+
+    if(conn->db != NULL && sensor_db_replay(conn) == 0){
+        if(!busy) log_event(LOG_DB_RECONNECTED, 0, 0);
+        conn->retry_backoff_ms = DB_RETRY_MIN_MS;
+        return;
+    }
+
+    conn->stats.recovery_failures++;
+    if(conn->db != NULL && !sqlite3_get_autocommit(conn->db)){
+        sqlite3_exec(conn->db, "ROLLBACK", 0, 0, 0);
+        if(DB_PARTITIONED && sensor_db_load_partitions(conn) != 0) sensor_db_close_writer(conn);
+    }
+    conn->pending_rows = 0;
+    sensor_db_deadline(&(conn->retry_deadline), conn->retry_backoff_ms);
+    conn->retry_backoff_ms *= 2;
+    if(conn->retry_backoff_ms > DB_RETRY_MAX_MS) conn->retry_backoff_ms = DB_RETRY_MAX_MS;
+}
+
+// stores every queued reading in one transaction
+static int sensor_db_replay(DBCONN* conn){
+    if(sqlite3_exec(conn->db, "BEGIN", 0, 0, 0) != SQLITE_OK) return -1;
+    for(int i = 0; i < conn->queue_count; i++){
+        sensor_data_t* data = &(conn->retry_queue[(conn->queue_head + i) % DB_RETRY_QUEUE_LENGTH]);
+        if(insert_sensor(conn, data->id, data->value, data->ts) != 0) return -1;
+    }
+    if(sqlite3_exec(conn->db, "COMMIT", 0, 0, 0) != SQLITE_OK) return -1;
+
+    conn->stats.commits++;
+    conn->stats.rows_committed += conn->queue_count;
+    conn->stats.replayed_rows += conn->queue_count;
+    conn->queue_head = 0;
+    conn->queue_count = 0;
+    if(DB_PARTITIONED) sensor_db_apply_retention(conn);
+    return 0;
+}
+
+// finalizes every statement of the writer and closes its handle
+static void sensor_db_close_writer(DBCONN* conn){
+    sqlite3_finalize(conn->insert_stmt);
+    conn->insert_stmt = NULL;
+    for(int i = 0; i < DB_PARTITION_STMTS; i++){
+        sqlite3_finalize(conn->partition_stmts[i].stmt);
+        conn->partition_stmts[i].stmt = NULL;
+    }
+    sqlite3_close(conn->db);
+    conn->db = NULL;
+}
+
+static int sensor_db_create_table(DBCONN* conn, const char* table){
+    char* sql = sqlite3_mprintf("CREATE TABLE IF NOT EXISTS `%s` ("
+        "`id` INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "`sensor_id` INTEGER NULL,"
+        "`sensor_value` DECIMAL(4,2) NULL,"
+        "`timestamp` TIMESTAMP NULL)", table);
+    if(sql_query(conn, 0, sql) == -1) return -1;
+    return sensor_db_index_table(conn, table, true);
+}
+
+// creates or drops the (sensor_id, timestamp, sensor_value) and (timestamp) indexes of one table
+static int sensor_db_index_table(DBCONN* conn, const char* table, bool create){
+    // sensor_value is part of the per sensor index so a time range of one sensor never touches the table
+    char* sql;
+    if(create)
+        sql = sqlite3_mprintf("CREATE INDEX IF NOT EXISTS `%s_sensor_ts` ON `%s` (`sensor_id`, `timestamp`, `sensor_value`);"
+            "CREATE INDEX IF NOT EXISTS `%s_ts` ON `%s` (`timestamp`);", table, table, table, table);
+    else
+        sql = sqlite3_mprintf("DROP INDEX IF EXISTS `%s_sensor_ts`; DROP INDEX IF EXISTS `%s_ts`;", table, table);
+    return sql_query(conn, 0, sql);
+}
+
+static sqlite3_stmt* sensor_db_prepare_insert(DBCONN* conn, const char* table){
+    sqlite3_stmt* stmt = NULL;
+    char* sql = sqlite3_mprintf("INSERT INTO `%s` (`sensor_id`, `sensor_value`, `timestamp`) VALUES (?, ?, ?);", table);
+    int rc = sqlite3_prepare_v3(conn->db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+    sqlite3_free(sql);
+    if(rc != SQLITE_OK){
+        fprintf(stderr, "CANNOT PREPARE INSERT: %s\n", sqlite3_errmsg(conn->db));
+        return NULL;
+    }
+    return stmt;
+}
+
+// start of the partition a timestamp belongs to, readings from before the epoch go to the first one
+static sensor_ts_t sensor_db_partition_start(sensor_ts_t ts){
+#if DB_PARTITIONED
+    if(ts < 0) return 0;
+    return ts - ts % DB_PARTITION_SECONDS;
+#else
+    return 0;
+#endif
+}
+
+// reads the partition tables back from the schema, a table from before partitioning is split into partitions first
+static int sensor_db_load_partitions(DBCONN* conn){
+    for(int i = 0; i < DB_PARTITION_STMTS; i++){
+        sqlite3_finalize(conn->partition_stmts[i].stmt);
+        conn->partition_stmts[i].stmt = NULL;
+    }
+    conn->partition_count = 0;
+
+    sqlite3_stmt* stmt;
+    char* sql = sqlite3_mprintf("SELECT `name` FROM sqlite_master WHERE type = 'table' AND (name = '%q' OR name GLOB '%q_[0-9]*');",
+        TABLE_NAME_STRING, TABLE_NAME_STRING);
+    int rc = sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
+    sqlite3_free(sql);
+    if(rc != SQLITE_OK) return -1;
+
+    bool unpartitioned = false;
+    size_t prefix = strlen(TABLE_NAME_STRING) + 1;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW){
+        const char* name = (const char*) sqlite3_column_text(stmt, 0);
+        if(strcmp(name, TABLE_NAME_STRING) == 0){
+            unpartitioned = true;
+            continue;
+        }
+        char* end;
+        long start = strtol(name + prefix, &end, 10);
+        if(*end != '\0') continue;
+        if(conn->partition_count == conn->partition_capacity){
+            int capacity = (conn->partition_capacity == 0) ? 16 : conn->partition_capacity * 2;
+            sensor_ts_t* partitions = realloc(conn->partitions, capacity * sizeof(sensor_ts_t));
+            if(partitions == NULL) break;
+            conn->partitions = partitions;
+            conn->partition_capacity = capacity;
+        }
+        conn->partitions[conn->partition_count++] = start;
+    }
+    sqlite3_finalize(stmt);
+    if(rc != SQLITE_DONE) return -1;
+
+    // insertion sort, the schema lists the partitions roughly in creation order
+    for(int i = 1; i < conn->partition_count; i++){
+        sensor_ts_t start = conn->partitions[i];
+        int j = i;
+        for(; j > 0 && conn->partitions[j - 1] > start; j--) conn->partitions[j] = conn->partitions[j - 1];
+        conn->partitions[j] = start;
+    }
+
+    if(unpartitioned){
+        // the table is gone afterwards, the partitions it became are read back
+        if(sensor_db_split_table(conn) != 0) return -1;
+        return sensor_db_load_partitions(conn);
+    }
+    return sensor_db_update_view(conn);
+}
+
+// moves the rows of the table from before partitioning into the partitions of their timestamps, in one transaction;
+// rows without a timestamp go to the first partition like readings from before the epoch
+static int sensor_db_split_table(DBCONN* conn){
+    // every partition start is read first, the tables are created once the SELECT is finished
+    sqlite3_stmt* stmt;
+    char* sql = sqlite3_mprintf("SELECT DISTINCT CASE WHEN `timestamp` IS NULL OR `timestamp` < 0 THEN 0 "
+        "ELSE `timestamp` - `timestamp` %% %ld END AS `start` FROM `%s` ORDER BY `start`;", (long) DB_PARTITION_SECONDS, TABLE_NAME_STRING);
+    int rc = sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
+    sqlite3_free(sql);
+    if(rc != SQLITE_OK) return -1;
+    sensor_ts_t* starts = NULL;
+    int count = 0, capacity = 0;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW){
+        if(count == capacity){
+            capacity = (capacity == 0) ? 16 : capacity * 2;
+            sensor_ts_t* grown = realloc(starts, capacity * sizeof(sensor_ts_t));
+            if(grown == NULL) break;
+            starts = grown;
+        }
+        starts[count++] = (sensor_ts_t) sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    if(rc != SQLITE_DONE){
+        free(starts);
+        return -1;
+    }
+
+    int result = sql_query(conn, 0, sqlite3_mprintf("BEGIN"));
+    for(int i = 0; i < count && result == 0; i++){
+        char* table = sqlite3_mprintf("%s_%ld", TABLE_NAME_STRING, starts[i]);
+        result = sensor_db_create_table(conn, table);
+        if(result == 0){
+            sql = sqlite3_mprintf("INSERT INTO `%s` (`sensor_id`, `sensor_value`, `timestamp`) SELECT `sensor_id`, `sensor_value`, `timestamp` "
+                "FROM `%s` WHERE `timestamp` >= %ld AND `timestamp` < %ld%s ORDER BY `id`;", table, TABLE_NAME_STRING, starts[i],
+                starts[i] + (sensor_ts_t) DB_PARTITION_SECONDS, (starts[i] == 0) ? " OR `timestamp` < 0 OR `timestamp` IS NULL" : "");
+            result = sql_query(conn, 0, sql);
+        }
+        sqlite3_free(table);
+    }
+    if(result == 0) result = sql_query(conn, 0, sqlite3_mprintf("DROP TABLE `%s`", TABLE_NAME_STRING));
+    if(result == 0) result = sql_query(conn, 0, sqlite3_mprintf("COMMIT"));
+    if(result != 0 && !sqlite3_get_autocommit(conn->db)) sqlite3_exec(conn->db, "ROLLBACK", 0, 0, 0);
+#ifdef DEBUG
+    if(result == 0) printf(BLUE_CLR "DB: SPLIT %s INTO %d PARTITIONS.\n" OFF_CLR, TABLE_NAME_STRING, count);
+#endif
+    free(starts);
+    return result;
+}
+
+// TABLE_NAME becomes a UNION ALL over the partitions, sqlite pushes the WHERE of a query down into every partition
+static int sensor_db_update_view(DBCONN* conn){
+    sqlite3_str* sql = sqlite3_str_new(conn->db);
+    sqlite3_str_appendf(sql, "DROP VIEW IF EXISTS `%s`; CREATE VIEW `%s` AS ", TABLE_NAME_STRING, TABLE_NAME_STRING);
+    if(conn->partition_count == 0)
+        sqlite3_str_appendf(sql, "SELECT 0 AS `id`, 0 AS `sensor_id`, 0.0 AS `sensor_value`, 0 AS `timestamp` WHERE 0");
+    for(int i = 0; i < conn->partition_count; i++)
+        sqlite3_str_appendf(sql, "%sSELECT * FROM `%s_%ld`", (i == 0) ? "" : " UNION ALL ", TABLE_NAME_STRING, conn->partitions[i]);
+    return sql_query(conn, 0, sqlite3_str_finish(sql));
+}
+
+// the INSERT for the partition of 'ts', the partition is created on its first reading
+// 'expired' is set for a reading older than every partition that retention still keeps
+static sqlite3_stmt* sensor_db_partition_stmt(DBCONN* conn, sensor_ts_t ts, bool* expired){
+    sensor_ts_t start = sensor_db_partition_start(ts);
+    partition_stmt_t* slot = &(conn->partition_stmts[0]);
+    for(int i = 0; i < DB_PARTITION_STMTS; i++){
+        partition_stmt_t* cached = &(conn->partition_stmts[i]);
+        if(cached->stmt != NULL && cached->start == start) return cached->stmt;
+        // reuse an empty slot, or else the one of the oldest partition
+        if(slot->stmt != NULL && (cached->stmt == NULL || cached->start < slot->start)) slot = cached;
+    }
+
+    int index = 0;
+    while(index < conn->partition_count && conn->partitions[index] < start) index++;
+    if(index == conn->partition_count || conn->partitions[index] != start){
+        if(DB_RETENTION_PARTITIONS > 0 && index == 0 && conn->partition_count >= DB_RETENTION_PARTITIONS){
+            *expired = true;
+            return NULL;
+        }
+        if(sensor_db_add_partition(conn, start) != 0) return NULL;
+    }
+
+    char* table = sqlite3_mprintf("%s_%ld", TABLE_NAME_STRING, start);
+    sqlite3_stmt* stmt = sensor_db_prepare_insert(conn, table);
+    sqlite3_free(table);
+    if(stmt == NULL) return NULL;
+    sqlite3_finalize(slot->stmt);
+    slot->start = start;
+    slot->stmt = stmt;
+    return stmt;
+}
+
+// creates the table of a new partition, retention drops the oldest ones once the transaction is committed
+static int sensor_db_add_partition(DBCONN* conn, sensor_ts_t start){
+    if(conn->partition_count == conn->partition_capacity){
+        int capacity = (conn->partition_capacity == 0) ? 16 : conn->partition_capacity * 2;
+        sensor_ts_t* partitions = realloc(conn->partitions, capacity * sizeof(sensor_ts_t));
+        if(partitions == NULL) return -1;
+        conn->partitions = partitions;
+        conn->partition_capacity = capacity;
+    }
+    char* table = sqlite3_mprintf("%s_%ld", TABLE_NAME_STRING, start);
+    int result = sensor_db_create_table(conn, table);
+    sqlite3_free(table);
+    if(result != 0) return -1;
+
+    int index = conn->partition_count;
+    while(index > 0 && conn->partitions[index - 1] > start){
+        conn->partitions[index] = conn->partitions[index - 1];
+        index--;
+    }
+    conn->partitions[index] = start;
+    conn->partition_count++;
+    conn->stats.partitions_created++;
+    return sensor_db_update_view(conn);
+}
+
+// drops (or with DB_ARCHIVE_PARTITIONS archives) the oldest partitions beyond DB_RETENTION_PARTITIONS, after a commit
+// so neither the insert that created a new partition nor its transaction waits for the DROP TABLE
+static void sensor_db_apply_retention(DBCONN* conn){
+    while(DB_RETENTION_PARTITIONS > 0 && conn->db != NULL && conn->partition_count > DB_RETENTION_PARTITIONS){
+        // the partition is only dropped once its archive is safely on disk
+        long rows = DB_ARCHIVE_PARTITIONS ? sensor_db_archive_partition(conn, conn->partitions[0]) : 0;
+        if(rows < 0) break;
+        if(sensor_db_drop_partition(conn, 0) != 0){
+            fprintf(stderr, "RETENTION FAILED: %s\n", sqlite3_errmsg(conn->db));
+            break;
+        }
+        conn->stats.archived_rows += rows;
+    }
+}
+
+// retention: a whole partition goes with one DROP TABLE instead of a DELETE over its rows
+static int sensor_db_drop_partition(DBCONN* conn, int index){
+    sensor_ts_t start = conn->partitions[index];
+    for(int i = 0; i < DB_PARTITION_STMTS; i++){
+        if(conn->partition_stmts[i].stmt == NULL || conn->partition_stmts[i].start != start) continue;
+        sqlite3_finalize(conn->partition_stmts[i].stmt);
+        conn->partition_stmts[i].stmt = NULL;
+    }
+    for(int i = index; i < conn->partition_count - 1; i++) conn->partitions[i] = conn->partitions[i + 1];
+    conn->partition_count--;
+
+    // the view may not refer to the table any more when it is dropped
+    if(sensor_db_update_view(conn) != 0) return -1;
+    if(sql_query(conn, 0, sqlite3_mprintf("DROP TABLE IF EXISTS `%s_%ld`", TABLE_NAME_STRING, start)) != 0) return -1;
+    conn->stats.partitions_dropped++;
+#ifdef DEBUG
+    printf(BLUE_CLR "DB: DROPPED PARTITION %s_%ld.\n" OFF_CLR, TABLE_NAME_STRING, start);
+#endif
+    return 0;
+}
+
+// writes the rows of a partition to ARCHIVE_DIR/<TABLE_NAME>_<start>.sga, in sensor and timestamp order so the
+// blocks compress well; returns the number of archived rows or -1
+static long sensor_db_archive_partition(DBCONN* conn, sensor_ts_t start){
+    char* path = sqlite3_mprintf("%s/%s_%ld.sga", ARCHIVE_DIR, TABLE_NAME_STRING, start);
+    archive_writer_t* writer = archive_writer_open(path);
+    if(writer == NULL){
+        fprintf(stderr, "CANNOT CREATE ARCHIVE %s\n", path);
+        sqlite3_free(path);
+        return -1;
+    }
+
+    sqlite3_stmt* stmt;
+    char* sql = sqlite3_mprintf("SELECT `sensor_id`, `sensor_value`, `timestamp` FROM `%s_%ld` ORDER BY `sensor_id`, `timestamp`;",
+        TABLE_NAME_STRING, start);
+    int rc = sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
+    sqlite3_free(sql);
+    long rows = 0;
+    while(rc == SQLITE_OK && (rc = sqlite3_step(stmt)) == SQLITE_ROW){
+        sensor_data_t data = {
+            .id = (sensor_id_t) sqlite3_column_int(stmt, 0),
+            .value = sqlite3_column_double(stmt, 1),
+            .ts = (sensor_ts_t) sqlite3_column_int64(stmt, 2)
+        };
+        if(archive_writer_add(writer, &data) != 0) break;
+        rows++;
+        rc = SQLITE_OK;
+    }
+    sqlite3_finalize(stmt);
+
+    long size = archive_writer_close(&writer);
+    if(rc != SQLITE_DONE || size < 0){
+        fprintf(stderr, "CANNOT ARCHIVE PARTITION %s_%ld\n", TABLE_NAME_STRING, start);
+        unlink(path);
+        sqlite3_free(path);
+        return -1;
+    }
+#ifdef DEBUG
+    printf(BLUE_CLR "DB: ARCHIVED %ld ROWS IN %ld BYTES TO %s.\n" OFF_CLR, rows, size, path);
+#endif
+    sqlite3_free(path);
+    return rows;
+}
+
+// appends the WHERE clause of a range, only the predicates that narrow it so a full export stays a plain table scan
+static void sensor_db_append_range(sqlite3_str* sql, const db_range_t* range){
+    const db_range_t all = DB_RANGE_ALL;
+    const char* glue = " WHERE ";
+    if(range->sensor_id != DB_ANY_SENSOR){ sqlite3_str_appendf(sql, "%ssensor_id = :id", glue); glue = " AND "; }
+    if(range->from != all.from){ sqlite3_str_appendf(sql, "%stimestamp >= :from", glue); glue = " AND "; }
+    if(range->to != all.to){ sqlite3_str_appendf(sql, "%stimestamp <= :to", glue); glue = " AND "; }
+    if(range->min_value != all.min_value){ sqlite3_str_appendf(sql, "%ssensor_value >= :min", glue); glue = " AND "; }
+    if(range->max_value != all.max_value){ sqlite3_str_appendf(sql, "%ssensor_value <= :max", glue); glue = " AND "; }
+}
+
+// finishes and prepares the query, then binds the bounds of the range
+static sqlite3_stmt* sensor_db_prepare_range(DBCONN* conn, sqlite3_str* sql, const db_range_t* range){
+    char* text = sqlite3_str_finish(sql);
+    if(text == NULL) return NULL;
+    sqlite3_stmt* stmt = NULL;
+    int rc = sqlite3_prepare_v2(conn->db, text, -1, &stmt, NULL);
+    sqlite3_free(text);
+    if(rc != SQLITE_OK){
+        fprintf(stderr, "CANNOT PREPARE QUERY: %s\n", sqlite3_errmsg(conn->db));
+        return NULL;
+    }
+
+    // a parameter that is not in the query has index 0, binding it is a no-op
+    sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":id"), range->sensor_id);
+    sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":from"), range->from);
+    sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":to"), range->to);
+    sqlite3_bind_double(stmt, sqlite3_bind_parameter_index(stmt, ":min"), range->min_value);
+    sqlite3_bind_double(stmt, sqlite3_bind_parameter_index(stmt, ":max"), range->max_value);
+    return stmt;
+}
+
+static int sensor_db_compare_aggregate(const void* a, const void* b){
+    const db_aggregate_t* x = a;
+    const db_aggregate_t* y = b;
+    if(x->key != y->key) return (x->key > y->key) - (x->key < y->key);
+    return (x->bucket > y->bucket) - (x->bucket < y->bucket);
+}
+
+// start of the bucket 'ts' is in, also for timestamps before the epoch
+#define BUCKET_START(ts, seconds) ((ts) - (((ts) % (seconds)) + (seconds)) % (seconds))
+
+// every bucket of a sensor is one range scan of the (sensor_id, timestamp, sensor_value) index, so nothing is sorted;
+// an empty bucket is followed by a seek to the next reading of the sensor and the next sensor is found with a seek too
+// (a MIN() over the partition view would scan, partitioned tables use sensor_db_aggregate_grouped)
+static int sensor_db_aggregate_indexed(DBCONN* conn, const db_range_t* range, long bucket_seconds, db_aggregate_t** rows, long* count, long* capacity){
+    const db_range_t all = DB_RANGE_ALL;
+    db_range_t seek_range = all;
+    seek_range.sensor_id = 0;
+    seek_range.from = 0;
+    db_range_t bucket_range = *range;
+    bucket_range.sensor_id = 0;
+    bucket_range.from = 0;
+    bucket_range.to = 0;
+
+    sqlite3_str* sql = sqlite3_str_new(conn->db);
+    sqlite3_str_appendf(sql, "SELECT MIN(`sensor_id`) FROM `%s` WHERE sensor_id > :after", TABLE_NAME_STRING);
+    sqlite3_stmt* next_sensor = sensor_db_prepare_range(conn, sql, &all);
+    sql = sqlite3_str_new(conn->db);
+    sqlite3_str_appendf(sql, "SELECT MIN(`timestamp`) FROM `%s`", TABLE_NAME_STRING);
+    sensor_db_append_range(sql, &seek_range);
+    sqlite3_stmt* next_ts = sensor_db_prepare_range(conn, sql, &seek_range);
+    sql = sqlite3_str_new(conn->db);
+    sqlite3_str_appendf(sql, "SELECT COUNT(*), MIN(`sensor_value`), MAX(`sensor_value`), SUM(`sensor_value`) FROM `%s`", TABLE_NAME_STRING);
+    sensor_db_append_range(sql, &bucket_range);
+    sqlite3_stmt* bucket = sensor_db_prepare_range(conn, sql, &bucket_range);
+
+    // the parameters are numbered in the order they appear: :after; :id, :from; :id, :from, :to
+    int result = (next_sensor != NULL && next_ts != NULL && bucket != NULL) ? 0 : -1;
+    sqlite3_int64 sensor = range->sensor_id;
+    if(range->sensor_id == DB_ANY_SENSOR){
+        sqlite3_bind_int64(next_sensor, 1, -1);
+        if(result != 0 || !sensor_db_step_min(next_sensor, &sensor)) sensor = -1;
+    }
+    while(result == 0 && sensor >= 0){
+        sqlite3_int64 ts;
+        sqlite3_bind_int64(next_ts, 1, sensor);
+        sqlite3_bind_int64(next_ts, 2, range->from);
+        bool found = sensor_db_step_min(next_ts, &ts);
+        while(found && ts <= range->to){
+            sensor_ts_t start = BUCKET_START(ts, bucket_seconds);
+            sensor_ts_t end = start + bucket_seconds - 1;
+            sqlite3_bind_int64(bucket, 1, sensor);
+            sqlite3_bind_int64(bucket, 2, (start > range->from) ? start : range->from);
+            sqlite3_bind_int64(bucket, 3, (end < range->to) ? end : range->to);
+            if(sqlite3_step(bucket) != SQLITE_ROW){
+                result = -1;
+                break;
+            }
+            db_aggregate_t row = {
+                .key = (uint16_t) sensor,
+                .bucket = start,
+                .count = (long) sqlite3_column_int64(bucket, 0),
+                .min = sqlite3_column_double(bucket, 1),
+                .max = sqlite3_column_double(bucket, 2),
+                .avg = sqlite3_column_double(bucket, 3)
+            };
+            sqlite3_reset(bucket);
+            if(row.count > 0 && sensor_db_add_aggregate(rows, count, capacity, &row) != 0){
+                result = -1;
+                break;
+            }
+            if(end >= range->to) break;
+            if(row.count > 0){
+                ts = end + 1;
+            } else {
+                // nothing (or nothing within the value bounds) in this bucket, jump to the next reading
+                sqlite3_bind_int64(next_ts, 2, end + 1);
+                found = sensor_db_step_min(next_ts, &ts);
+            }
+        }
+        if(result != 0 || range->sensor_id != DB_ANY_SENSOR) break;
+        sqlite3_bind_int64(next_sensor, 1, sensor);
+        if(!sensor_db_step_min(next_sensor, &sensor)) sensor = -1;
+    }
+    sqlite3_finalize(next_sensor);
+    sqlite3_finalize(next_ts);
+    sqlite3_finalize(bucket);
+    return result;
+}
+
+// one GROUP BY query, for a single bucket per sensor (in index order) and on the partition view
+static int sensor_db_aggregate_grouped(DBCONN* conn, const db_range_t* range, long bucket_seconds, db_aggregate_t** rows, long* count, long* capacity){
+    sqlite3_str* sql = sqlite3_str_new(conn->db);
+    sqlite3_str_appendf(sql, "SELECT `sensor_id`, %s, COUNT(*), MIN(`sensor_value`), MAX(`sensor_value`), SUM(`sensor_value`) FROM `%s`",
+        (bucket_seconds > 0) ? "`timestamp` - ((`timestamp` % :bucket) + :bucket) % :bucket AS bucket" : "MIN(`timestamp`)",
+        TABLE_NAME_STRING);
+    sensor_db_append_range(sql, range);
+    sqlite3_str_appendall(sql, (bucket_seconds > 0) ? " GROUP BY sensor_id, bucket ORDER BY sensor_id, bucket" : " GROUP BY sensor_id ORDER BY sensor_id");
+    sqlite3_stmt* stmt = sensor_db_prepare_range(conn, sql, range);
+    if(stmt == NULL) return -1;
+    sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":bucket"), bucket_seconds);
+
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW){
+        db_aggregate_t row = {
+            .key = (uint16_t) sqlite3_column_int(stmt, 0),
+            .bucket = (sensor_ts_t) sqlite3_column_int64(stmt, 1),
+            .count = (long) sqlite3_column_int64(stmt, 2),
+            .min = sqlite3_column_double(stmt, 3),
+            .max = sqlite3_column_double(stmt, 4),
+            .avg = sqlite3_column_double(stmt, 5)
+        };
+        if(sensor_db_add_aggregate(rows, count, capacity, &row) != 0) break;
+    }
+    sqlite3_finalize(stmt);
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+static int sensor_db_add_aggregate(db_aggregate_t** rows, long* count, long* capacity, const db_aggregate_t* row){
+    if(*count == *capacity){
+        long grown_capacity = (*capacity == 0) ? 256 : *capacity * 2;
+        db_aggregate_t* grown = realloc(*rows, grown_capacity * sizeof(db_aggregate_t));
+        if(grown == NULL) return -1;
+        *rows = grown;
+        *capacity = grown_capacity;
+    }
+    (*rows)[(*count)++] = *row;
+    return 0;
+}
+
+// runs a single MIN() query, false when it finds nothing
+static bool sensor_db_step_min(sqlite3_stmt* stmt, sqlite3_int64* value){
+    bool found = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL;
+    if(found) *value = sqlite3_column_int64(stmt, 0);
+    sqlite3_reset(stmt);
+    return found;
+}
+
+// a SELECT on sensor_value with the value bound as a double, printed into the SQL it would lose its precision;
+// every row goes to 'f' as text, the way sqlite3_exec hands them over
+static int sensor_db_find_value(DBCONN* conn, const char* comparison, sensor_value_t value, callback_t f){
+    if(conn->db == NULL) return -1;
+    sqlite3_stmt* stmt = NULL;
+    char* sql = sqlite3_mprintf("SELECT * FROM `%s` WHERE sensor_value %s ?;", TABLE_NAME_STRING, comparison);
+    int rc = sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
+    sqlite3_free(sql);
+    if(rc != SQLITE_OK){
+        fprintf(stderr, "CANNOT PREPARE QUERY: %s\n", sqlite3_errmsg(conn->db));
+        return -1;
+    }
+    sqlite3_bind_double(stmt, 1, value);
+
+    int columns = sqlite3_column_count(stmt);
+    char* names[columns];
+    char* values[columns];
+    for(int i = 0; i < columns; i++) names[i] = (char*) sqlite3_column_name(stmt, i);
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW){
+        for(int i = 0; i < columns; i++) values[i] = (char*) sqlite3_column_text(stmt, i);
+        if(f != NULL && f(0, columns, values, names) != 0) break;
+    }
+    if(rc != SQLITE_DONE) fprintf(stderr, "Failed: %s\n", (rc == SQLITE_ROW) ? "query aborted" : sqlite3_errmsg(conn->db));
+    sqlite3_finalize(stmt);
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
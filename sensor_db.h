@@ -6,8 +6,11 @@
 #define _SENSOR_DB_H_
 
 #include <sqlite3.h>
+#include <limits.h>
+#include <float.h>
 #include "config.h"
 #include "sbuffer.h"
+#include "sensor_map.h"
 
 #ifndef DB_NAME
 #define DB_NAME Sensor.db
@@ -17,10 +20,196 @@
 #define TABLE_NAME SensorData
 #endif
 
-#define DBCONN sqlite3
+// the writer commits its transaction every DB_COMMIT_ROWS rows or every DB_COMMIT_MS milliseconds, whichever comes first
+#ifndef DB_COMMIT_ROWS
+#define DB_COMMIT_ROWS 1000
+#endif
+
+#ifndef DB_COMMIT_MS
+#define DB_COMMIT_MS 250
+#endif
+
+// readings that are not committed yet are kept in a queue of DB_RETRY_QUEUE_LENGTH and stored again after a failure,
+// the writer retries every DB_RETRY_MIN_MS, doubling up to DB_RETRY_MAX_MS while the database stays unavailable
+#ifndef DB_RETRY_QUEUE_LENGTH
+#define DB_RETRY_QUEUE_LENGTH 65536
+#endif
+
+#if DB_RETRY_QUEUE_LENGTH < DB_COMMIT_ROWS
+#error DB_RETRY_QUEUE_LENGTH must hold at least DB_COMMIT_ROWS readings
+#endif
+
+#ifndef DB_RETRY_MIN_MS
+#define DB_RETRY_MIN_MS 100
+#endif
+
+#ifndef DB_RETRY_MAX_MS
+#define DB_RETRY_MAX_MS 10000
+#endif
+
+// the busy handler sleeps DB_BUSY_MIN_US, doubling up to DB_BUSY_MAX_US, for at most DB_BUSY_RETRIES times
+#ifndef DB_BUSY_RETRIES
+#define DB_BUSY_RETRIES 20
+#endif
+
+#ifndef DB_BUSY_MIN_US
+#define DB_BUSY_MIN_US 100
+#endif
+
+#ifndef DB_BUSY_MAX_US
+#define DB_BUSY_MAX_US 100000
+#endif
+
+// set DB_PARTITION_SECONDS to split the table in one table per hour (3600) or day (86400) of reading timestamps,
+// TABLE_NAME becomes a view over the partitions; 0 keeps a single table
+#ifndef DB_PARTITION_SECONDS
+#define DB_PARTITION_SECONDS 0
+#endif
+
+#define DB_PARTITIONED (DB_PARTITION_SECONDS > 0)
+
+// partitions kept by retention, the oldest is dropped after the commit of the transaction that created a new one;
+// 0 keeps all of them. The view can union at most 500 tables (SQLITE_MAX_COMPOUND_SELECT), one more than
+// DB_RETENTION_PARTITIONS until that commit.
+#ifndef DB_RETENTION_PARTITIONS
+#define DB_RETENTION_PARTITIONS 0
+#endif
+
+#if DB_RETENTION_PARTITIONS > 499
+#error DB_RETENTION_PARTITIONS can not be more than 499
+#endif
+
+// set DB_ARCHIVE_PARTITIONS to 1 to have retention move the oldest partitions to archive files (archive.h) instead of
+// dropping their rows; a partition that can not be archived is kept and tried again after the next commit
+#ifndef DB_ARCHIVE_PARTITIONS
+#define DB_ARCHIVE_PARTITIONS 0
+#endif
+
+// partitions with a prepared INSERT, late readings for an older partition prepare it again
+#ifndef DB_PARTITION_STMTS
+#define DB_PARTITION_STMTS 4
+#endif
+
+// storage profiles, the pragmas init_connection applies to every new connection
+typedef enum {
+    DB_PROFILE_LEGACY,      // rollback journal, synchronous=FULL, no mmap: the sqlite defaults
+    DB_PROFILE_DURABLE,     // WAL, synchronous=FULL: every commit survives a power loss
+    DB_PROFILE_BALANCED,    // WAL, synchronous=NORMAL: a power loss can drop the last commits, never corrupts
+    DB_PROFILE_FAST,        // WAL, synchronous=OFF: the OS decides when data hits the disk
+    DB_PROFILE_COUNT
+} db_profile_t;
+
+#ifndef DB_PROFILE
+#define DB_PROFILE DB_PROFILE_BALANCED
+#endif
+
+// page cache of a connection in KiB and the part of the file that is memory mapped in bytes
+#ifndef DB_CACHE_SIZE_KIB
+#define DB_CACHE_SIZE_KIB 16384
+#endif
+
+#ifndef DB_MMAP_SIZE
+#define DB_MMAP_SIZE (256 * 1024 * 1024)
+#endif
+
+// in WAL mode automatic checkpoints are off, a background thread runs one every DB_CHECKPOINT_MS milliseconds
+#ifndef DB_CHECKPOINT_MS
+#define DB_CHECKPOINT_MS 1000
+#endif
+
+// connections in the reader pool and how long a reader waits on a locked database (rollback journal only)
+#ifndef DB_READERS
+#define DB_READERS 4
+#endif
+
+#ifndef DB_READER_BUSY_MS
+#define DB_READER_BUSY_MS 1000
+#endif
+
+typedef struct {
+    const char* name;
+    const char* journal_mode;
+    const char* synchronous;
+    int cache_size_kib;
+    long mmap_size;
+    bool background_checkpoint;     // set wal_autocheckpoint=0 and checkpoint on a separate thread
+} sensor_db_profile_t;
+
+// a record in a binary sensor_data file: uint16 id, double value and time_t timestamp, packed
+#define DB_RECORD_LENGTH (sizeof(sensor_id_t) + sizeof(sensor_value_t) + sizeof(sensor_ts_t))
+
+// records decoded at once by the bulk loader
+#ifndef DB_LOAD_CHUNK
+#define DB_LOAD_CHUNK 4096
+#endif
+
+// a connection holds the sqlite3 handle and the statements prepared on it
+typedef struct dbconn DBCONN;
+
+// a pool of read-only connections for queries from other threads than the ingest writer
+typedef struct db_pool db_pool_t;
+
+// group commit metrics of a connection
+typedef struct {
+    unsigned long commits;                  // transactions committed
+    unsigned long rows_committed;           // rows in those transactions, rows_committed / commits is the average batch
+    unsigned long rows_per_commit_max;      // largest batch
+    unsigned long commit_latency_total_us;  // time spent in COMMIT, commit_latency_total_us / commits is the average
+    unsigned long commit_latency_max_us;    // slowest COMMIT
+    unsigned long checkpoints;              // checkpoints run by the background thread
+    unsigned long checkpointed_frames;      // WAL frames copied back into the database by those checkpoints
+    unsigned long busy_retries;             // sleeps in the busy handler while another connection held the lock
+    unsigned long busy_failures;            // transactions that stayed busy after all retries
+    unsigned long reconnects;               // times the connection was reopened after an error
+    unsigned long recovery_failures;        // recovery attempts that did not store the queued readings
+    unsigned long replayed_rows;            // readings stored again after a failed transaction
+    unsigned long dropped_rows;             // readings lost because the retry queue was full or a bulk load failed
+    unsigned long queue_depth;              // readings that are not committed yet
+    unsigned long queue_depth_max;          // deepest the queue has been
+    unsigned long partitions_created;       // partition tables created for new readings
+    unsigned long partitions_dropped;       // partition tables dropped by retention, counted once the DROP TABLE is committed
+    unsigned long expired_rows;             // readings older than the oldest partition retention keeps
+    unsigned long archived_rows;            // rows moved from closed partitions to archive files
+} sensor_db_stats_t;
 
 typedef int (*callback_t)(void*, int, char**, char**);
 
+// one time bucket of one sensor or room, as computed by sensor_db_aggregate
+typedef struct {
+    uint16_t key;               // the sensor_id, or the room_id when grouped per room
+    sensor_ts_t bucket;         // start of the time bucket
+    long count;                 // readings in the bucket
+    sensor_value_t min;
+    sensor_value_t max;
+    sensor_value_t avg;
+} db_aggregate_t;
+
+// readings handed out by sensor_db_scan per callback
+#ifndef DB_CURSOR_BATCH
+#define DB_CURSOR_BATCH 1024
+#endif
+
+// sensor filter of db_range_t that accepts every sensor
+#define DB_ANY_SENSOR -1
+
+// the predicates of a cursor, start from DB_RANGE_ALL and narrow it down, only the fields that differ end up in the query
+typedef struct {
+    int sensor_id;              // a single sensor, or DB_ANY_SENSOR
+    sensor_ts_t from;           // first timestamp (inclusive)
+    sensor_ts_t to;             // last timestamp (inclusive)
+    sensor_value_t min_value;   // lowest value (inclusive)
+    sensor_value_t max_value;   // highest value (inclusive)
+    long limit;                 // stop after this many rows, 0 for no limit
+} db_range_t;
+
+#define DB_RANGE_ALL ((db_range_t){ DB_ANY_SENSOR, LONG_MIN, LONG_MAX, -DBL_MAX, DBL_MAX, 0 })
+
+// a SELECT on the table stepped through a batch of readings at a time
+typedef struct db_cursor db_cursor_t;
+
+// called by sensor_db_scan for every batch, return non-zero to stop the scan
+typedef int (*batch_callback_t)(void* arg, const sensor_data_t* batch, int count);
+
 
 /**
  * Initialize and synchronize sensor_db with other threads
@@ -28,8 +217,29 @@ typedef int (*callback_t)(void*, int, char**, char**);
  */
 void sensor_db_init(config_thread_t* config_thread);
 
+/**
+ * Stop the connmgr and wake the datamgr and storage threads so they finish, when the database can not be used
+ * Needs sensor_db_init first.
+ */
+void sensor_close_threads();
+
+/**
+ * Select the storage profile of the connections opened after this call, DB_PROFILE by default
+ * \param profile one of the db_profile_t values
+ * \return zero for success, -1 if 'profile' does not exist
+ */
+int sensor_db_set_profile(db_profile_t profile);
+
+/**
+ * Returns the settings of a storage profile
+ * \param profile one of the db_profile_t values
+ * \return a pointer to the profile, NULL if 'profile' does not exist
+ */
+const sensor_db_profile_t* sensor_db_get_profile(db_profile_t profile);
+
 /**
  * Make a connection to the database server
+ * The pragmas of the selected profile are applied and, in WAL mode, the checkpoint thread is started
  * Create (open) a database with name DB_NAME having 1 table named TABLE_NAME
  * \param clear_up_flag if the table existed, clear up the existing data when clear_up_flag is set to 1
  * \return the connection for success, NULL if an error occurs
@@ -43,7 +253,7 @@ DBCONN* init_connection(char clear_up_flag);
 void disconnect(DBCONN* conn);
 
 /**
- * Write an INSERT query to insert a single sensor measurement
+ * Insert a single sensor measurement through the INSERT statement prepared on the connection
  * \param conn pointer to the current connection
  * \param id the sensor id
  * \param value the measurement value
@@ -54,6 +264,10 @@ int insert_sensor(DBCONN* conn, sensor_id_t id, sensor_value_t value, sensor_ts_
 
 /**
  * Write an INSERT query to insert all sensor measurements available in the file 'sensor_data'
+ * The file is memory mapped and decoded in chunks of DB_LOAD_CHUNK records, the rows go through the prepared INSERT
+ * in group commits and the indexes are rebuilt at the end. A trailing partial record is ignored.
+ * On failure the load ends with sensor_db_bulk_load_abort: the rows of the open transaction are dropped, the ones
+ * committed before stay, and the indexes are built again.
  * \param conn pointer to the current connection
  * \param sensor_data a file pointer to binary file containing sensor data
  * \return zero for success, and non-zero if an error occurs
@@ -61,12 +275,101 @@ int insert_sensor(DBCONN* conn, sensor_id_t id, sensor_value_t value, sensor_ts_
 int insert_sensor_from_file(DBCONN* conn, FILE* sensor_data);
 
 /**
- * Write an INSERT query to insert all sensor measurements available in the file 'sensor_data'
+ * Insert packed sensor_data records, DB_RECORD_LENGTH bytes each, as part of the current group commit
+ * \param conn pointer to the current connection
+ * \param records the first record
+ * \param count the number of records
+ * \return zero for success, and non-zero if an error occurs
+ */
+int sensor_db_insert_records(DBCONN* conn, const uint8_t* records, size_t count);
+
+/**
+ * Create the (sensor_id, timestamp, sensor_value) and (timestamp) indexes if they do not exist yet
+ * \param conn pointer to the current connection
+ * \return zero for success, and non-zero if an error occurs
+ */
+int sensor_db_create_indexes(DBCONN* conn);
+
+/**
+ * Drop the indexes created by sensor_db_create_indexes
+ * \param conn pointer to the current connection
+ * \return zero for success, and non-zero if an error occurs
+ */
+int sensor_db_drop_indexes(DBCONN* conn);
+
+/**
+ * Drop every partition that only holds readings from before 'ts', each one with a single DROP TABLE
+ * The pending rows are committed first. Does nothing without DB_PARTITION_SECONDS.
+ * \param conn pointer to the current connection
+ * \param ts the oldest timestamp to keep
+ * \return the number of dropped partitions, -1 if an error occurs
+ */
+int sensor_db_drop_partitions_before(DBCONN* conn, sensor_ts_t ts);
+
+/**
+ * Move every partition that only holds readings from before 'ts' to a compressed archive file, see archive.h
+ * Each partition becomes ARCHIVE_DIR/<TABLE_NAME>_<start>.sga and is dropped once the file is synced to disk.
+ * Does nothing without DB_PARTITION_SECONDS.
+ * \param conn pointer to the current connection
+ * \param ts the oldest timestamp to keep in the database
+ * \return the number of archived partitions, -1 if an error occurs
+ */
+int sensor_db_archive_partitions_before(DBCONN* conn, sensor_ts_t ts);
+
+/**
+ * Returns the number of time partitions, 0 without DB_PARTITION_SECONDS
+ * \param conn pointer to the current connection
+ * \return the number of partitions
+ */
+int sensor_db_partition_count(DBCONN* conn);
+
+/**
+ * Start a bulk load: the pending rows are committed and the indexes dropped until sensor_db_bulk_load_end
+ * \param conn pointer to the current connection
+ * \return zero for success, and non-zero if an error occurs
+ */
+int sensor_db_bulk_load_begin(DBCONN* conn);
+
+/**
+ * End a bulk load: the loaded rows are committed and the indexes built again
  * \param conn pointer to the current connection
- * \param buffer a sbuffer pointer to a pointer to sbuffer
  * \return zero for success, and non-zero if an error occurs
  */
-int sensor_db_listen(DBCONN* conn, sbuffer_t** buffer);
+int sensor_db_bulk_load_end(DBCONN* conn);
+
+/**
+ * End a bulk load that failed: the open transaction is rolled back, the rows that are not committed yet are dropped
+ * (counted in dropped_rows) and the indexes built again. Transactions committed before the failure stay.
+ * \param conn pointer to the current connection
+ * \return zero for success, and non-zero if the indexes could not be built (they are when the writer is reopened)
+ */
+int sensor_db_bulk_load_abort(DBCONN* conn);
+
+/**
+ * Insert a single sensor measurement as part of the current group commit
+ * A transaction is opened on the first row and committed once it has DB_COMMIT_ROWS rows or is DB_COMMIT_MS milliseconds old.
+ * The measurement stays in the retry queue until it is committed. When the transaction fails the database is
+ * retried (SQLITE_BUSY, SQLITE_LOCKED) or reopened (any other error) and the queue is stored again.
+ * \param conn pointer to the current connection
+ * \param data the measurement to insert
+ * \return zero for success, and non-zero if the measurement is queued until the database recovers
+ */
+int sensor_db_insert_batched(DBCONN* conn, const sensor_data_t* data);
+
+/**
+ * Commit the rows inserted by sensor_db_insert_batched, does nothing if there are none
+ * While the writer is down this is a recovery attempt, once the backoff allows it.
+ * \param conn pointer to the current connection
+ * \return zero for success, and non-zero if readings are still queued
+ */
+int sensor_db_commit(DBCONN* conn);
+
+/**
+ * Copy the group commit metrics of the connection
+ * \param conn pointer to the current connection
+ * \param stats filled out with the metrics
+ */
+void sensor_db_get_stats(DBCONN* conn, sensor_db_stats_t* stats);
 
 /**
   * Write a SELECT query to select all sensor measurements in the table
@@ -117,6 +420,118 @@ int find_sensor_by_timestamp(DBCONN* conn, sensor_ts_t ts, callback_t f);
  */
 int find_sensor_after_timestamp(DBCONN* conn, sensor_ts_t ts, callback_t f);
 
+/**
+ * Write a SELECT query to return the measurements of sensor 'id' with a timestamp between 'from' and 'to' (inclusive)
+ * The rows come in timestamp order and are read from the (sensor_id, timestamp) index alone
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param id the sensor to be queried
+ * \param from the first timestamp of the range
+ * \param to the last timestamp of the range
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_by_id_in_range(DBCONN* conn, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, callback_t f);
+
+/**
+ * Write a SELECT query to return the measurements of sensor 'id' recorded after timestamp 'ts'
+ * The rows come in timestamp order and are read from the (sensor_id, timestamp) index alone
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param id the sensor to be queried
+ * \param ts the timestamp to be queried
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_by_id_after_timestamp(DBCONN* conn, sensor_id_t id, sensor_ts_t ts, callback_t f);
+
+/**
+ * Open a typed cursor on the readings that match 'range'
+ * The bounds are bound as parameters and the columns are read as numbers, no text is formatted or parsed.
+ * The readings of a single sensor come in timestamp order, otherwise in the order of the index or table that is scanned.
+ * \param conn pointer to the current connection, it has to stay open (and acquired, for a pool) until the cursor is closed
+ * \param range the predicates of the query
+ * \return the cursor, or NULL if the query can not be prepared
+ */
+db_cursor_t* sensor_db_cursor_open(DBCONN* conn, const db_range_t* range);
+
+/**
+ * Fill 'batch' with the next readings of the cursor
+ * \param cursor a pointer to the cursor
+ * \param batch filled out with up to 'capacity' readings
+ * \param capacity the length of 'batch'
+ * \return the number of readings, 0 once the cursor is exhausted and -1 if an error occurs
+ */
+int sensor_db_cursor_next(db_cursor_t* cursor, sensor_data_t* batch, int capacity);
+
+/**
+ * Close the cursor, also before it is exhausted to stop a query early
+ * \param cursor a double pointer to the cursor, set to NULL
+ */
+void sensor_db_cursor_close(db_cursor_t** cursor);
+
+/**
+ * Stream the readings that match 'range' to a callback, DB_CURSOR_BATCH readings at a time
+ * \param conn pointer to the current connection
+ * \param range the predicates of the query
+ * \param f called for every batch, a non-zero return value ends the scan early
+ * \param arg passed as the first argument of every callback
+ * \return the number of readings handed to the callback, -1 if an error occurs
+ */
+long sensor_db_scan(DBCONN* conn, const db_range_t* range, batch_callback_t f, void* arg);
+
+/**
+ * Compute count, min, max and avg of the readings that match 'range' per sensor or per room and time bucket
+ * SQLite does the scan and the grouping on the (sensor_id, timestamp, sensor_value) index, only one row per sensor
+ * and bucket comes back; the rows of the sensors in a room are merged afterwards.
+ * \param conn pointer to the current connection
+ * \param range the predicates of the query, the limit is ignored
+ * \param bucket_seconds the length of a bucket, buckets start at multiples of it; 0 for one bucket over the whole range,
+ *        which then starts at the first timestamp found
+ * \param rooms NULL to group per sensor, or a sensor map to group per room (unmapped sensors are left out)
+ * \param results set to a newly allocated array sorted on key and bucket, to be freed by the caller
+ * \return the number of results, -1 if an error occurs
+ */
+long sensor_db_aggregate(DBCONN* conn, const db_range_t* range, long bucket_seconds, const sensor_map_t* rooms, db_aggregate_t** results);
+
+/**
+ * Open a pool of read-only connections on the database, which has to exist already
+ * In WAL mode the readers see the last committed data and run concurrently with the writer.
+ * \param size the number of connections, DB_READERS is a good default
+ * \return the pool for success, NULL if an error occurs
+ */
+db_pool_t* sensor_db_pool_create(int size);
+
+/**
+ * Close every connection of the pool and free it, all connections have to be released first
+ * \param pool a double pointer to the pool, set to NULL
+ */
+void sensor_db_pool_free(db_pool_t** pool);
+
+/**
+ * Take a connection out of the pool for the find_sensor_* functions, blocks until one is free
+ * \param pool a pointer to the pool
+ * \return a read-only connection, owned by the calling thread until sensor_db_pool_release
+ */
+DBCONN* sensor_db_pool_acquire(db_pool_t* pool);
+
+/**
+ * Give a connection back to the pool
+ * \param pool a pointer to the pool
+ * \param conn the connection returned by sensor_db_pool_acquire
+ */
+void sensor_db_pool_release(db_pool_t* pool, DBCONN* conn);
+
+/**
+ * Run a read query on a pooled connection, safe to call from any thread
+ * \param pool a pointer to the pool
+ * \param sql the sql query to be executed, owned by the caller
+ * \param f function pointer to the callback method that will handle the result set, can be NULL
+ * \param arg passed as the first argument of every callback
+ * \return zero for success, and non-zero if an error occurs
+ */
+int sensor_db_pool_query(db_pool_t* pool, const char* sql, callback_t f, void* arg);
+
 /**
  * Write a query to be executed on the database
  * The callback function is applied to every row in the result
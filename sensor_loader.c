@@ -0,0 +1,86 @@
+/**
+ * \author Alken Rrokaj
+ *
+ * Bulk loads binary sensor_data files (as written by file_creator) into the sensor database
+ * usage: sensor_loader [-c] <sensor_data> [<sensor_data> ...]
+ *     -c  clear the table before loading
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "sensor_db.h"
+
+// the sensor_db module expects the synchronisation variables of the gateway
+static pthread_cond_t data_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t datamgr_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t db_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t connmgr_lock = PTHREAD_RWLOCK_INITIALIZER;
+static int data_mgr, data_sensor_db;
+static bool connmgr_working = true;
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end){
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char* argv[]){
+    int first_file = 1;
+    char clear_up_flag = 0;
+    if(argc > 1 && strcmp(argv[1], "-c") == 0){
+        clear_up_flag = 1;
+        first_file = 2;
+    }
+    if(first_file >= argc){
+        printf("usage: %s [-c] <sensor_data> [<sensor_data> ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    config_thread_t config_thread = {
+        .data_cond = &data_cond,        .datamgr_lock = &datamgr_lock,  .data_mgr = &data_mgr,
+        .db_cond = &db_cond,            .db_lock = &db_lock,            .data_sensor_db = &data_sensor_db,
+        .connmgr_lock = &connmgr_lock,  .connmgr_working = &connmgr_working
+    };
+    sensor_db_init(&config_thread);
+    DBCONN* conn = init_connection(clear_up_flag);
+    ERROR_HANDLER(conn == NULL, "CANNOT OPEN THE DATABASE");
+
+    long total_rows = 0;
+    double total_seconds = 0;
+    for(int i = first_file; i < argc; i++){
+        FILE* fp = fopen(argv[i], "r");
+        struct stat st;
+        if(fp == NULL || fstat(fileno(fp), &st) != 0){
+            fprintf(stderr, "CANNOT OPEN %s\n", argv[i]);
+            if(fp != NULL) fclose(fp);
+            continue;
+        }
+        long rows = st.st_size / DB_RECORD_LENGTH;
+        if(st.st_size % DB_RECORD_LENGTH != 0)
+            fprintf(stderr, "%s: ignoring a partial record of %ld bytes at the end\n", argv[i], (long)(st.st_size % DB_RECORD_LENGTH));
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int result = insert_sensor_from_file(conn, fp);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fclose(fp);
+
+        double seconds = elapsed_seconds(&start, &end);
+        if(result != 0){
+            fprintf(stderr, "LOADING %s FAILED, THE ROWS COMMITTED BEFORE THE ERROR ARE KEPT\n", argv[i]);
+            continue;
+        }
+        printf("%s: %ld rows in %.2f s (%.0f rows/s)\n", argv[i], rows, seconds, rows / seconds);
+        total_rows += rows;
+        total_seconds += seconds;
+    }
+
+    disconnect(conn);
+    if(argc - first_file > 1 && total_seconds > 0)
+        printf("total: %ld rows in %.2f s (%.0f rows/s)\n", total_rows, total_seconds, total_rows / total_seconds);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "sensor_map.h"
+
+#define READ_CHUNK 65536
+
+// a flat table indexed by the sensor_id, lookups never walk a list
+struct sensor_map {
+    uint64_t mapped[SENSOR_ID_RANGE / 64];  // bit set if the sensor_id is in the map
+    room_id_t rooms[SENSOR_ID_RANGE];       // room of every mapped sensor_id
+    int size;                               // number of unique sensors
+};
+
+// helper methods
+static char* sensor_map_read_file(FILE* fp, size_t* length);
+static bool sensor_map_parse_number(const char** cursor, const char* end, uint16_t* number);
+
+sensor_map_t* sensor_map_load(FILE* fp_sensor_map){
+    if(fp_sensor_map == NULL) return NULL;
+
+    size_t length;
+    char* text = sensor_map_read_file(fp_sensor_map, &length);
+    if(text == NULL) return NULL;
+
+    sensor_map_t* map = calloc(1, sizeof(sensor_map_t));
+    if(map == NULL){
+        free(text);
+        return NULL;
+    }
+
+    // parse "<room_id> <sensor_id>" line by line without going through stdio
+    const char* cursor = text;
+    const char* end = text + length;
+    while(cursor < end){
+        room_id_t r_id;
+        sensor_id_t s_id;
+        bool valid = sensor_map_parse_number(&cursor, end, &r_id)
+                  && sensor_map_parse_number(&cursor, end, &s_id);
+
+        // skip the rest of the line
+        const char* newline = memchr(cursor, '\n', end - cursor);
+        cursor = (newline == NULL) ? end : newline + 1;
+        if(!valid) continue;
+
+        uint64_t bit = (uint64_t) 1 << (s_id % 64);
+        if((map->mapped[s_id / 64] & bit) == 0) map->size++;
+        map->mapped[s_id / 64] |= bit;
+        map->rooms[s_id] = r_id;
+    }
+
+    free(text);
+    return map;
+}
+
+void sensor_map_free(sensor_map_t** map){
+    if(map == NULL) return;
+    free(*map);
+    *map = NULL;
+}
+
+bool sensor_map_lookup(const sensor_map_t* map, sensor_id_t sensor_id, room_id_t* room_id){
+    if(map == NULL) return false;
+    if((map->mapped[sensor_id / 64] & ((uint64_t) 1 << (sensor_id % 64))) == 0) return false;
+    if(room_id != NULL) *room_id = map->rooms[sensor_id];
+    return true;
+}
+
+int sensor_map_size(const sensor_map_t* map){
+    return (map == NULL) ? 0 : map->size;
+}
+
+// reads the whole file into one buffer, the size of a regular file is used as a first guess
+static char* sensor_map_read_file(FILE* fp, size_t* length){
+    struct stat st;
+    size_t capacity = READ_CHUNK;
+    if(fstat(fileno(fp), &st) == 0 && st.st_size > 0) capacity = (size_t) st.st_size + 1;
+
+    char* text = malloc(capacity);
+    if(text == NULL) return NULL;
+
+    *length = 0;
+    while(true){
+        if(*length == capacity){
+            char* bigger = realloc(text, capacity * 2);
+            if(bigger == NULL){
+                free(text);
+                return NULL;
+            }
+            text = bigger;
+            capacity *= 2;
+        }
+        size_t n = fread(text + *length, 1, capacity - *length, fp);
+        if(n == 0) break;
+        *length += n;
+    }
+
+    if(ferror(fp)){
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+// parses one unsigned 16 bit number, leading blanks are skipped but a number never continues on the next line
+static bool sensor_map_parse_number(const char** cursor, const char* end, uint16_t* number){
+    const char* c = *cursor;
+    while(c < end && (*c == ' ' || *c == '\t' || *c == '\r')) c++;
+
+    uint32_t value = 0;
+    const char* start = c;
+    while(c < end && *c >= '0' && *c <= '9' && value <= UINT16_MAX){
+        value = value * 10 + (uint32_t)(*c - '0');
+        c++;
+    }
+    *cursor = c;
+    if(c == start || value > UINT16_MAX) return false;
+
+    *number = (uint16_t) value;
+    return true;
+}
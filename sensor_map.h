@@ -0,0 +1,43 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _SENSOR_MAP_H_
+#define _SENSOR_MAP_H_
+
+#include <stdio.h>
+#include "config.h"
+
+typedef struct sensor_map sensor_map_t;
+
+/**
+ * Parses a room_sensor.map file ("<room_id> <sensor_id>" per line) into a new lookup table
+ * The whole file is read in one go, malformed lines are skipped and a later line overrides an earlier one for the same sensor
+ * \param fp_sensor_map file pointer to the map file
+ * \return a newly allocated map, or NULL if the file could not be read
+ */
+sensor_map_t* sensor_map_load(FILE* fp_sensor_map);
+
+/**
+ * Frees the map and sets '*map' to NULL
+ * \param map a double pointer to the map
+ */
+void sensor_map_free(sensor_map_t** map);
+
+/**
+ * Looks up the room of a sensor in O(1)
+ * \param map a pointer to the map
+ * \param sensor_id the sensor id to look for
+ * \param room_id filled out with the room of the sensor, can be NULL
+ * \return true if the sensor is mapped, false otherwise
+ */
+bool sensor_map_lookup(const sensor_map_t* map, sensor_id_t sensor_id, room_id_t* room_id);
+
+/**
+ * Returns the number of unique sensors in the map
+ * \param map a pointer to the map
+ * \return the number of sensors, 0 if 'map' is NULL
+ */
+int sensor_map_size(const sensor_map_t* map);
+
+#endif /* _SENSOR_MAP_H_ */
@@ -0,0 +1,476 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include "config.h"
+#include "storage.h"
+#include "tsdb.h"
+#include "metrics.h"
+
+struct storage {
+    const storage_backend_t* backend;
+    void* handle;
+    cache_t* cache;                 // NULL when CACHE_SECONDS is 0
+    storage_stats_t stats;
+};
+
+// the readings of the memory backend
+typedef struct {
+    sensor_data_t* readings;
+    long count;
+    long capacity;
+} storage_memory_t;
+
+// the file backend packs records into 'buffer' and writes it out when it is full or flushed
+typedef struct {
+    int fd;
+    uint8_t* buffer;
+    size_t length;
+} storage_file_t;
+
+// a backend query of one room, the readings of other sensors are filtered out before they reach 'f'
+typedef struct {
+    const sensor_map_t* rooms;
+    room_id_t room_id;
+    long limit;
+    batch_callback_t f;
+    void* arg;
+    sensor_data_t batch[DB_CURSOR_BATCH];
+    int count;
+    long total;
+} storage_room_filter_t;
+
+// helper methods
+static void storage_deadline(struct timespec* deadline, long ms);
+static bool storage_deadline_passed(const struct timespec* deadline);
+static unsigned long storage_elapsed_ns(const struct timespec* start);
+static bool storage_in_range(const db_range_t* range, const sensor_data_t* data);
+static int storage_room_batch(void* filter, const sensor_data_t* batch, int count);
+static int storage_room_flush(storage_room_filter_t* filter);
+static int storage_latest_batch(void* latest, const sensor_data_t* batch, int count);
+static void* storage_memory_open(char clear_up_flag);
+static int storage_memory_insert_batch(void* handle, const sensor_data_t* batch, int count);
+static int storage_memory_flush(void* handle);
+static long storage_memory_query_range(void* handle, const db_range_t* range, batch_callback_t f, void* arg);
+static void storage_memory_close(void* handle);
+static void* storage_file_open(char clear_up_flag);
+static int storage_file_insert_batch(void* handle, const sensor_data_t* batch, int count);
+static int storage_file_flush(void* handle);
+static long storage_file_query_range(void* handle, const db_range_t* range, batch_callback_t f, void* arg);
+static void storage_file_close(void* handle);
+
+const storage_backend_t storage_memory = {
+    "memory", storage_memory_open, storage_memory_insert_batch, storage_memory_flush, storage_memory_query_range, storage_memory_close
+};
+
+const storage_backend_t storage_file = {
+    "file", storage_file_open, storage_file_insert_batch, storage_file_flush, storage_file_query_range, storage_file_close
+};
+
+static const storage_backend_t* storage_backends[] = { &storage_sqlite, &storage_memory, &storage_file, &storage_tsdb };
+
+// config thread variables
+static pthread_cond_t* db_cond;
+static pthread_mutex_t* db_lock;
+static int* data_sensor_db;
+
+static bool* connmgr_working;
+
+void storage_init(config_thread_t* config_thread){
+    db_cond = config_thread->db_cond;
+    db_lock = config_thread->db_lock;
+    data_sensor_db = config_thread->data_sensor_db;
+    connmgr_working = config_thread->connmgr_working;
+}
+
+const storage_backend_t* storage_find_backend(const char* name){
+    for(int i = 0; i < sizeof(storage_backends) / sizeof(storage_backends[0]); i++)
+        if(strcmp(storage_backends[i]->name, name) == 0) return storage_backends[i];
+    return NULL;
+}
+
+storage_t* storage_open(const storage_backend_t* backend, char clear_up_flag){
+    if(backend == NULL) return NULL;
+    storage_t* storage = calloc(1, sizeof(storage_t));
+    if(storage == NULL) return NULL;
+    storage->backend = backend;
+    storage->handle = backend->open(clear_up_flag);
+    if(storage->handle == NULL){
+        free(storage);
+        return NULL;
+    }
+#if CACHE_SECONDS > 0
+    // a cleared backend has nothing the cache does not see, otherwise only readings from now on are complete
+    storage->cache = cache_create(clear_up_flag ? LONG_MIN : time(NULL));
+#ifdef DEBUG
+    if(storage->cache == NULL) printf(BLUE_CLR "STORAGE: RUNNING WITHOUT THE RECENT READINGS CACHE.\n" OFF_CLR);
+#endif
+#endif
+#ifdef DEBUG
+    printf(BLUE_CLR "STORAGE: OPENED THE %s BACKEND.\n" OFF_CLR, backend->name);
+#endif
+    return storage;
+}
+
+int storage_insert_batch(storage_t* storage, const sensor_data_t* batch, int count){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = storage->backend->insert_batch(storage->handle, batch, count);
+    unsigned long elapsed_ns = storage_elapsed_ns(&start);
+    storage->stats.backend_ns += elapsed_ns;
+    storage->stats.readings += count;
+    storage->stats.batches++;
+    if(result != 0) storage->stats.failures++;
+    metrics_observe(METRIC_STORAGE_INSERT, elapsed_ns);
+    if(result == 0) metrics_count(METRIC_READINGS_STORED, count);
+    else metrics_count(METRIC_STORAGE_FAILURES, 1);
+    if(storage->cache != NULL) cache_insert_batch(storage->cache, batch, count);
+    return result;
+}
+
+int storage_flush(storage_t* storage){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = storage->backend->flush(storage->handle);
+    unsigned long elapsed_ns = storage_elapsed_ns(&start);
+    storage->stats.backend_ns += elapsed_ns;
+    storage->stats.flushes++;
+    if(result != 0) storage->stats.failures++;
+    metrics_observe(METRIC_STORAGE_FLUSH, elapsed_ns);
+    if(result != 0) metrics_count(METRIC_STORAGE_FAILURES, 1);
+    return result;
+}
+
+long storage_query_range(storage_t* storage, const db_range_t* range, batch_callback_t f, void* arg){
+    if(storage->cache != NULL){
+        long found = cache_query_range(storage->cache, range, f, arg);
+        if(found != CACHE_MISS) return found;
+    }
+    return storage->backend->query_range(storage->handle, range, f, arg);
+}
+
+long storage_query_room(storage_t* storage, const sensor_map_t* rooms, room_id_t room_id, const db_range_t* range, batch_callback_t f, void* arg){
+    if(storage->cache != NULL){
+        long found = cache_query_room(storage->cache, rooms, room_id, range, f, arg);
+        if(found != CACHE_MISS) return found;
+    }
+    // the backend scans every sensor, the limit counts the readings of the room only
+    storage_room_filter_t* filter = malloc(sizeof(storage_room_filter_t));
+    if(filter == NULL) return -1;
+    filter->rooms = rooms;
+    filter->room_id = room_id;
+    filter->limit = range->limit;
+    filter->f = f;
+    filter->arg = arg;
+    filter->count = 0;
+    filter->total = 0;
+    db_range_t all_sensors = *range;
+    all_sensors.sensor_id = DB_ANY_SENSOR;
+    all_sensors.limit = 0;
+    long found = storage->backend->query_range(storage->handle, &all_sensors, storage_room_batch, filter);
+    if(found >= 0){
+        storage_room_flush(filter);
+        found = filter->total;
+    }
+    free(filter);
+    return found;
+}
+
+int storage_latest(storage_t* storage, sensor_id_t sensor_id, sensor_data_t* latest){
+    if(storage->cache != NULL && cache_latest(storage->cache, sensor_id, latest) == 0) return 0;
+    db_range_t range = DB_RANGE_ALL;
+    range.sensor_id = sensor_id;
+    latest->ts = LONG_MIN;
+    if(storage->backend->query_range(storage->handle, &range, storage_latest_batch, latest) <= 0) return -1;
+    return 0;
+}
+
+void storage_get_stats(storage_t* storage, storage_stats_t* stats){
+    *stats = storage->stats;
+    if(storage->cache != NULL) cache_get_stats(storage->cache, &stats->cache);
+    else memset(&stats->cache, 0, sizeof(cache_stats_t));
+}
+
+void storage_close(storage_t** storage){
+    if(storage == NULL || *storage == NULL) return;
+    (*storage)->backend->close((*storage)->handle);
+#ifdef DEBUG
+    printf(BLUE_CLR "STORAGE: CLOSED THE %s BACKEND AFTER %lu READINGS, %.3f S IN THE BACKEND.\n" OFF_CLR,
+        (*storage)->backend->name, (*storage)->stats.readings, (*storage)->stats.backend_ns / 1e9);
+    if((*storage)->cache != NULL){
+        cache_stats_t cache_stats;
+        cache_get_stats((*storage)->cache, &cache_stats);
+        printf(BLUE_CLR "STORAGE: CACHE SERVED %lu OF %lu RANGE QUERIES AND %lu OF %lu LATEST VALUES.\n" OFF_CLR,
+            cache_stats.hits, cache_stats.hits + cache_stats.misses,
+            cache_stats.latest_hits, cache_stats.latest_hits + cache_stats.latest_misses);
+    }
+#endif
+    cache_free(&(*storage)->cache);
+    free(*storage);
+    *storage = NULL;
+}
+
+int storage_listen(storage_t* storage, sbuffer_t** buffer){
+    sensor_data_t batch[STORAGE_BATCH];
+    bool unflushed = false;
+    struct timespec flush_deadline;     // CLOCK_REALTIME, for pthread_cond_timedwait
+
+    while(*connmgr_working == true){
+        pthread_mutex_lock(db_lock);
+        bool flush_due = false;
+        while((*data_sensor_db) == 0 && !flush_due){
+            if(!unflushed)
+                pthread_cond_wait(db_cond, db_lock);
+            else
+                flush_due = pthread_cond_timedwait(db_cond, db_lock, &flush_deadline) == ETIMEDOUT;
+        #ifdef DEBUG
+            printf(BLUE_CLR "STORAGE: WAITING FOR DATA.\n" OFF_CLR);
+        #endif
+        }
+        if(*connmgr_working == false){
+            pthread_mutex_unlock(db_lock);
+            break;
+        }
+        int available = *data_sensor_db;
+        pthread_mutex_unlock(db_lock);
+
+        if(!flush_due){
+            // take what is in the buffer, up to a batch, and hand it over in one call
+            int count = 0;
+            while(count < available && count < STORAGE_BATCH && sbuffer_remove(*buffer, &batch[count], DB_THREAD) == SBUFFER_SUCCESS)
+                count++;
+            if(count == 0) break;
+            storage_insert_batch(storage, batch, count);
+            if(!unflushed){
+                unflushed = true;
+                storage_deadline(&flush_deadline, STORAGE_FLUSH_MS);
+            }
+
+#ifdef DEBUG
+            printf(BLUE_CLR "STORAGE: GOT %d READINGS. %ld\n" OFF_CLR, count, time(NULL));
+#endif
+            pthread_mutex_lock(db_lock);
+            (*data_sensor_db) -= count;
+            pthread_mutex_unlock(db_lock);
+        }
+
+        // under steady input the wait never times out, so the deadline is checked after every batch as well
+        if(unflushed && storage_deadline_passed(&flush_deadline)){
+            // a backend that could not flush (the SQLite writer is down) is tried again after the next interval
+            if(storage_flush(storage) == 0) unflushed = false;
+            else storage_deadline(&flush_deadline, STORAGE_FLUSH_MS);
+        }
+    }
+
+    // drain what is left in the buffer and flush everything
+    int count = 0;
+    while(sbuffer_remove(*buffer, &batch[count], DB_THREAD) == SBUFFER_SUCCESS){
+        if(++count < STORAGE_BATCH) continue;
+        storage_insert_batch(storage, batch, count);
+        count = 0;
+    }
+    if(count > 0) storage_insert_batch(storage, batch, count);
+    return storage_flush(storage);
+}
+
+// sets 'deadline' to 'ms' milliseconds from now
+static void storage_deadline(struct timespec* deadline, long ms){
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (ms % 1000) * 1000000L;
+    if(deadline->tv_nsec >= 1000000000L){
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static bool storage_deadline_passed(const struct timespec* deadline){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+static unsigned long storage_elapsed_ns(const struct timespec* start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000UL + now.tv_nsec - start->tv_nsec;
+}
+
+// the predicates of a db_range_t on one reading, the limit is up to the caller
+static bool storage_in_range(const db_range_t* range, const sensor_data_t* data){
+    return (range->sensor_id == DB_ANY_SENSOR || data->id == range->sensor_id)
+        && data->ts >= range->from && data->ts <= range->to
+        && data->value >= range->min_value && data->value <= range->max_value;
+}
+
+// collects the readings of the room and hands them on in full batches, stops the backend once the limit is reached
+static int storage_room_batch(void* arg, const sensor_data_t* batch, int count){
+    storage_room_filter_t* filter = arg;
+    room_id_t room;
+    for(int i = 0; i < count; i++){
+        if(!sensor_map_lookup(filter->rooms, batch[i].id, &room) || room != filter->room_id) continue;
+        filter->batch[filter->count++] = batch[i];
+        bool full = (filter->limit > 0 && filter->total + filter->count >= filter->limit);
+        if((filter->count == DB_CURSOR_BATCH || full) && storage_room_flush(filter) != 0) return 1;
+        if(full) return 1;
+    }
+    return 0;
+}
+
+static int storage_room_flush(storage_room_filter_t* filter){
+    if(filter->count == 0) return 0;
+    int count = filter->count;
+    filter->total += count;
+    filter->count = 0;
+    return filter->f(filter->arg, filter->batch, count);
+}
+
+// keeps the reading with the newest timestamp
+static int storage_latest_batch(void* arg, const sensor_data_t* batch, int count){
+    sensor_data_t* latest = arg;
+    for(int i = 0; i < count; i++)
+        if(batch[i].ts >= latest->ts) *latest = batch[i];
+    return 0;
+}
+
+static void* storage_memory_open(char clear_up_flag){
+    return calloc(1, sizeof(storage_memory_t));
+}
+
+static int storage_memory_insert_batch(void* handle, const sensor_data_t* batch, int count){
+    storage_memory_t* memory = handle;
+    if(memory->count + count > memory->capacity){
+        long capacity = (memory->capacity == 0) ? 65536 : memory->capacity * 2;
+        while(capacity < memory->count + count) capacity *= 2;
+        sensor_data_t* grown = realloc(memory->readings, capacity * sizeof(sensor_data_t));
+        if(grown == NULL) return -1;
+        memory->readings = grown;
+        memory->capacity = capacity;
+    }
+    memcpy(memory->readings + memory->count, batch, count * sizeof(sensor_data_t));
+    memory->count += count;
+    return 0;
+}
+
+static int storage_memory_flush(void* handle){
+    return 0;
+}
+
+// readings come in the order they were inserted
+static long storage_memory_query_range(void* handle, const db_range_t* range, batch_callback_t f, void* arg){
+    storage_memory_t* memory = handle;
+    sensor_data_t batch[DB_CURSOR_BATCH];
+    long total = 0;
+    int count = 0;
+    for(long i = 0; i < memory->count && (range->limit <= 0 || total + count < range->limit); i++){
+        if(!storage_in_range(range, &memory->readings[i])) continue;
+        batch[count++] = memory->readings[i];
+        if(count < DB_CURSOR_BATCH) continue;
+        total += count;
+        count = 0;
+        if(f(arg, batch, DB_CURSOR_BATCH) != 0) return total;
+    }
+    if(count > 0){
+        total += count;
+        f(arg, batch, count);
+    }
+    return total;
+}
+
+static void storage_memory_close(void* handle){
+    storage_memory_t* memory = handle;
+    free(memory->readings);
+    free(memory);
+}
+
+static void* storage_file_open(char clear_up_flag){
+    storage_file_t* file = calloc(1, sizeof(storage_file_t));
+    if(file == NULL) return NULL;
+    file->buffer = malloc(STORAGE_FILE_BUFFER);
+    file->fd = open(STORAGE_FILE, O_WRONLY | O_CREAT | O_APPEND | (clear_up_flag ? O_TRUNC : 0), 0644);
+    if(file->buffer == NULL || file->fd < 0){
+        fprintf(stderr, "CANNOT OPEN %s\n", STORAGE_FILE);
+        if(file->fd >= 0) close(file->fd);
+        free(file->buffer);
+        free(file);
+        return NULL;
+    }
+    return file;
+}
+
+static int storage_file_insert_batch(void* handle, const sensor_data_t* batch, int count){
+    storage_file_t* file = handle;
+    for(int i = 0; i < count; i++){
+        if(file->length + DB_RECORD_LENGTH > STORAGE_FILE_BUFFER && storage_file_flush(file) != 0) return -1;
+        uint8_t* record = file->buffer + file->length;
+        memcpy(record, &(batch[i].id), sizeof(sensor_id_t));
+        memcpy(record + sizeof(sensor_id_t), &(batch[i].value), sizeof(sensor_value_t));
+        memcpy(record + sizeof(sensor_id_t) + sizeof(sensor_value_t), &(batch[i].ts), sizeof(sensor_ts_t));
+        file->length += DB_RECORD_LENGTH;
+    }
+    return 0;
+}
+
+// hands the buffer to the kernel, no fsync: a crash of the process loses nothing, a crash of the machine might
+static int storage_file_flush(void* handle){
+    storage_file_t* file = handle;
+    size_t written = 0;
+    while(written < file->length){
+        ssize_t n = write(file->fd, file->buffer + written, file->length - written);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0){
+            // keep what was not written for the next attempt
+            memmove(file->buffer, file->buffer + written, file->length - written);
+            file->length -= written;
+            return -1;
+        }
+        written += n;
+    }
+    file->length = 0;
+    return 0;
+}
+
+// readings come in the order they were captured
+static long storage_file_query_range(void* handle, const db_range_t* range, batch_callback_t f, void* arg){
+    if(storage_file_flush(handle) != 0) return -1;
+    FILE* fp = fopen(STORAGE_FILE, "r");
+    if(fp == NULL) return -1;
+
+    uint8_t records[DB_CURSOR_BATCH * DB_RECORD_LENGTH];
+    sensor_data_t batch[DB_CURSOR_BATCH];
+    long total = 0;
+    size_t read;
+    bool stop = false;
+    while(!stop && (read = fread(records, DB_RECORD_LENGTH, DB_CURSOR_BATCH, fp)) > 0){
+        int count = 0;
+        for(size_t i = 0; i < read && (range->limit <= 0 || total + count < range->limit); i++){
+            const uint8_t* record = records + i * DB_RECORD_LENGTH;
+            sensor_data_t data;
+            memcpy(&(data.id), record, sizeof(sensor_id_t));
+            memcpy(&(data.value), record + sizeof(sensor_id_t), sizeof(sensor_value_t));
+            memcpy(&(data.ts), record + sizeof(sensor_id_t) + sizeof(sensor_value_t), sizeof(sensor_ts_t));
+            if(storage_in_range(range, &data)) batch[count++] = data;
+        }
+        total += count;
+        stop = (range->limit > 0 && total >= range->limit);
+        if(count > 0 && f(arg, batch, count) != 0) stop = true;
+    }
+    fclose(fp);
+    return total;
+}
+
+static void storage_file_close(void* handle){
+    storage_file_t* file = handle;
+    if(storage_file_flush(file) != 0) fprintf(stderr, "LOST %zu BYTES THAT WERE NOT WRITTEN TO %s\n", file->length, STORAGE_FILE);
+    close(file->fd);
+    free(file->buffer);
+    free(file);
+}
@@ -0,0 +1,157 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include "config.h"
+#include "sbuffer.h"
+#include "sensor_db.h"
+#include "sensor_map.h"
+#include "cache.h"
+
+// readings the listener takes from the buffer and hands to the backend in one call
+#ifndef STORAGE_BATCH
+#define STORAGE_BATCH 256
+#endif
+
+// a backend is flushed at the latest this many milliseconds after its first unflushed reading
+#ifndef STORAGE_FLUSH_MS
+#define STORAGE_FLUSH_MS DB_COMMIT_MS
+#endif
+
+// the raw file backend appends packed records in the sensor_data format, sensor_loader can load them later
+#ifndef STORAGE_FILE
+#define STORAGE_FILE "sensor_data_capture"
+#endif
+
+#ifndef STORAGE_FILE_BUFFER
+#define STORAGE_FILE_BUFFER (1024 * 1024)
+#endif
+
+// the operations of a storage backend, 'handle' is whatever its open returned
+typedef struct {
+    const char* name;
+    void* (*open)(char clear_up_flag);
+    int (*insert_batch)(void* handle, const sensor_data_t* batch, int count);
+    int (*flush)(void* handle);
+    long (*query_range)(void* handle, const db_range_t* range, batch_callback_t f, void* arg);
+    void (*close)(void* handle);
+} storage_backend_t;
+
+// the SQLite database of sensor_db, the default
+extern const storage_backend_t storage_sqlite;
+// a growing array in memory, nothing survives the process; measures the pipeline without storage cost
+extern const storage_backend_t storage_memory;
+// packed records appended to STORAGE_FILE through a large buffer, for capture at the highest rate
+extern const storage_backend_t storage_file;
+// (storage_tsdb, the native time-series engine, is declared in tsdb.h)
+
+// an open backend
+typedef struct storage storage_t;
+
+// what went through a storage, backend_ns is the time spent inside the backend
+typedef struct {
+    unsigned long readings;
+    unsigned long batches;
+    unsigned long flushes;
+    unsigned long failures;         // insert_batch or flush calls that did not store everything
+    unsigned long backend_ns;
+    cache_stats_t cache;            // the recent readings cache in front of the backend, zero without one
+} storage_stats_t;
+
+/**
+ * Initialize and synchronize the storage listener with other threads
+ * \param config_thread takes a thread
+ */
+void storage_init(config_thread_t* config_thread);
+
+/**
+ * Looks up a backend by its name
+ * \param name "sqlite", "memory", "file" or "tsdb"
+ * \return the backend, or NULL if there is none with that name
+ */
+const storage_backend_t* storage_find_backend(const char* name);
+
+/**
+ * Opens a backend
+ * \param backend the backend to open
+ * \param clear_up_flag if the table (or file) should be cleared
+ * \return the open storage, or NULL if the backend could not be opened
+ */
+storage_t* storage_open(const storage_backend_t* backend, char clear_up_flag);
+
+/**
+ * Hands a batch of readings to the backend
+ * \param storage a pointer to the storage
+ * \param batch the readings
+ * \param count the number of readings in 'batch'
+ * \return zero for success, non-zero if not every reading is stored (the SQLite backend keeps them queued)
+ */
+int storage_insert_batch(storage_t* storage, const sensor_data_t* batch, int count);
+
+/**
+ * Makes everything inserted so far durable as far as the backend goes (commit, write)
+ * \param storage a pointer to the storage
+ * \return zero for success, non-zero if readings are still waiting
+ */
+int storage_flush(storage_t* storage);
+
+/**
+ * Streams the stored readings that match 'range' to a callback, a batch at a time
+ * A range that starts within CACHE_SECONDS of the newest readings is answered from the cache, older ones by the backend.
+ * The queries share the handle of the writer (an open SQLite transaction, the tsdb engine) and the cache without a
+ * lock: only the thread that inserts into 'storage' may query it. Other threads read SQLite through sensor_db_pool_query.
+ * \param storage a pointer to the storage
+ * \param range the predicates of the query
+ * \param f called for every batch, a non-zero return value ends the query early
+ * \param arg passed as the first argument of every callback
+ * \return the number of readings handed to the callback, -1 if an error occurs
+ */
+long storage_query_range(storage_t* storage, const db_range_t* range, batch_callback_t f, void* arg);
+
+/**
+ * Like storage_query_range, for the sensors of one room (range->sensor_id is ignored)
+ * \param storage a pointer to the storage
+ * \param rooms the sensor map that puts sensors in rooms
+ * \param room_id the room
+ * \param range the predicates of the query
+ * \param f called for every batch, a non-zero return value ends the query early
+ * \param arg passed as the first argument of every callback
+ * \return the number of readings handed to the callback, -1 if an error occurs
+ */
+long storage_query_room(storage_t* storage, const sensor_map_t* rooms, room_id_t room_id, const db_range_t* range, batch_callback_t f, void* arg);
+
+/**
+ * Looks up the reading with the newest timestamp of a sensor, from the cache or else by a scan of the backend
+ * \param storage a pointer to the storage
+ * \param sensor_id the sensor
+ * \param latest filled out with the reading
+ * \return zero if the sensor has a reading, -1 otherwise
+ */
+int storage_latest(storage_t* storage, sensor_id_t sensor_id, sensor_data_t* latest);
+
+/**
+ * Copies the counters of the storage
+ * \param storage a pointer to the storage
+ * \param stats filled out with the counters
+ */
+void storage_get_stats(storage_t* storage, storage_stats_t* stats);
+
+/**
+ * Flushes and closes the backend and frees the storage
+ * \param storage a double pointer to the storage, set to NULL
+ */
+void storage_close(storage_t** storage);
+
+/**
+ * Stores the readings of the shared buffer until the connection manager stops, then drains the buffer and flushes
+ * Readings are handed over up to STORAGE_BATCH at a time and flushed at most STORAGE_FLUSH_MS after they came in.
+ * \param storage a pointer to the storage
+ * \param buffer a double pointer to the shared buffer
+ * \return zero for success, non-zero if readings were not stored
+ */
+int storage_listen(storage_t* storage, sbuffer_t** buffer);
+
+#endif /* _STORAGE_H_ */
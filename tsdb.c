@@ -0,0 +1,423 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "storage.h"
+#include "tsdb.h"
+
+#define TSDB_MAGIC "TSD1"
+#define TSDB_MAGIC_LENGTH 4
+
+// the header in front of the columns of a chunk, on disk and in memory
+typedef struct {
+    uint16_t sensor_id;
+    uint16_t reserved;
+    uint32_t count;
+    int64_t min_ts;
+    int64_t max_ts;
+    double min_value;
+    double max_value;
+} tsdb_chunk_header_t;
+
+// bytes of a chunk of 'count' readings in a segment, the columns stay 8 byte aligned after the header
+#define TSDB_CHUNK_BYTES(count) (sizeof(tsdb_chunk_header_t) + (size_t)(count) * (sizeof(int64_t) + sizeof(double)))
+
+#if TSDB_CHUNK_READINGS <= 0 || (TSDB_CHUNK_READINGS * 16 + 40) > TSDB_WRITE_BUFFER
+#error a full chunk has to fit in TSDB_WRITE_BUFFER
+#endif
+
+// where a sealed chunk is, with its header for pruning
+typedef struct {
+    tsdb_chunk_header_t header;
+    int segment;
+    off_t offset;
+} tsdb_index_entry_t;
+
+// the open chunk of a sensor, the header keeps count, min and max up to date as readings arrive
+typedef struct {
+    tsdb_chunk_header_t header;
+    struct timespec opened;             // CLOCK_MONOTONIC time of its first reading
+    int64_t ts[TSDB_CHUNK_READINGS];
+    double value[TSDB_CHUNK_READINGS];
+} tsdb_chunk_t;
+
+struct tsdb {
+    char* dir;
+    tsdb_chunk_t* chunks[SENSOR_ID_RANGE];  // allocated on the first reading of a sensor and reused after sealing
+    sensor_id_t* active;                    // sensors that have a chunk, in order of their first reading
+    int active_count;
+
+    int* segment_fds;                       // every segment stays open for queries, the last one is appended to
+    int segment_count;
+    int segment_capacity;
+    off_t segment_size;                     // size of the last segment including what is still in the buffer
+
+    uint8_t* buffer;                        // sealed chunks that are not written yet
+    size_t buffered;
+
+    tsdb_index_entry_t* index;
+    long index_count;
+    long index_capacity;
+
+    tsdb_stats_t stats;
+};
+
+// helper methods
+static void tsdb_segment_path(const tsdb_t* db, int number, char* path, size_t length);
+static int tsdb_add_segment(tsdb_t* db, int fd);
+static int tsdb_new_segment(tsdb_t* db);
+static int tsdb_load_segment(tsdb_t* db, int fd);
+static int tsdb_add_index(tsdb_t* db, const tsdb_chunk_header_t* header, int segment, off_t offset);
+static int tsdb_seal(tsdb_t* db, tsdb_chunk_t* chunk);
+static int tsdb_write_buffer(tsdb_t* db);
+static bool tsdb_prune(const db_range_t* range, const tsdb_chunk_header_t* header);
+static bool tsdb_scan_columns(const db_range_t* range, sensor_id_t id, const int64_t* ts, const double* value, uint32_t count,
+    sensor_data_t* batch, int* batched, long* total, batch_callback_t f, void* arg);
+
+tsdb_t* tsdb_open(const char* dir, char clear_up_flag){
+    tsdb_t* db = calloc(1, sizeof(tsdb_t));
+    if(db == NULL) return NULL;
+    db->dir = strdup(dir);
+    db->active = malloc(SENSOR_ID_RANGE * sizeof(sensor_id_t));
+    db->buffer = malloc(TSDB_WRITE_BUFFER);
+    if(db->dir == NULL || db->active == NULL || db->buffer == NULL){
+        tsdb_close(&db);
+        return NULL;
+    }
+
+    // segments are numbered from 0 without gaps
+    char path[PATH_MAX];
+    if(clear_up_flag){
+        for(int number = 0; ; number++){
+            tsdb_segment_path(db, number, path, sizeof(path));
+            if(unlink(path) != 0) break;
+        }
+    }
+    for(int number = 0; ; number++){
+        tsdb_segment_path(db, number, path, sizeof(path));
+        int fd = open(path, O_RDWR | O_APPEND);
+        if(fd < 0) break;
+        if(tsdb_add_segment(db, fd) != 0 || tsdb_load_segment(db, fd) != 0){
+            fprintf(stderr, "TSDB: CANNOT LOAD %s\n", path);
+            tsdb_close(&db);
+            return NULL;
+        }
+    }
+    if(db->segment_count == 0 && tsdb_new_segment(db) != 0){
+        tsdb_close(&db);
+        return NULL;
+    }
+#ifdef DEBUG
+    printf(BLUE_CLR "TSDB: OPENED %d SEGMENTS WITH %ld CHUNKS.\n" OFF_CLR, db->segment_count, db->index_count);
+#endif
+    return db;
+}
+
+int tsdb_insert_batch(tsdb_t* db, const sensor_data_t* batch, int count){
+    for(int i = 0; i < count; i++){
+        const sensor_data_t* data = &batch[i];
+        tsdb_chunk_t* chunk = db->chunks[data->id];
+        if(chunk == NULL){
+            chunk = malloc(sizeof(tsdb_chunk_t));
+            if(chunk == NULL) return -1;
+            memset(&(chunk->header), 0, sizeof(tsdb_chunk_header_t));
+            chunk->header.sensor_id = data->id;
+            db->chunks[data->id] = chunk;
+            db->active[db->active_count++] = data->id;
+        }
+
+        // a chunk is sealed when the next reading does not fit, one that could not be sealed stays full and is tried again
+        tsdb_chunk_header_t* header = &(chunk->header);
+        if(header->count == TSDB_CHUNK_READINGS && tsdb_seal(db, chunk) != 0) return -1;
+        if(header->count == 0){
+            header->min_ts = header->max_ts = data->ts;
+            header->min_value = header->max_value = data->value;
+            clock_gettime(CLOCK_MONOTONIC, &(chunk->opened));
+        } else {
+            if(data->ts < header->min_ts) header->min_ts = data->ts;
+            if(data->ts > header->max_ts) header->max_ts = data->ts;
+            if(data->value < header->min_value) header->min_value = data->value;
+            if(data->value > header->max_value) header->max_value = data->value;
+        }
+        chunk->ts[header->count] = data->ts;
+        chunk->value[header->count] = data->value;
+        header->count++;
+        db->stats.readings++;
+    }
+    return 0;
+}
+
+int tsdb_flush(tsdb_t* db){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for(int i = 0; i < db->active_count; i++){
+        tsdb_chunk_t* chunk = db->chunks[db->active[i]];
+        long open_ms = (now.tv_sec - chunk->opened.tv_sec) * 1000 + (now.tv_nsec - chunk->opened.tv_nsec) / 1000000;
+        bool due = (chunk->header.count == TSDB_CHUNK_READINGS || (chunk->header.count > 0 && open_ms >= TSDB_MAX_OPEN_MS));
+        if(due && tsdb_seal(db, chunk) != 0) return -1;
+    }
+    return tsdb_write_buffer(db);
+}
+
+long tsdb_query(tsdb_t* db, const db_range_t* range, batch_callback_t f, void* arg){
+    // the sealed chunks are read back from the segments, so everything has to be written first
+    if(tsdb_write_buffer(db) != 0) return -1;
+
+    sensor_data_t batch[DB_CURSOR_BATCH];
+    int batched = 0;
+    long total = 0;
+    bool stop = false;
+    uint8_t* scratch = malloc(TSDB_CHUNK_BYTES(TSDB_CHUNK_READINGS));
+    size_t scratch_length = TSDB_CHUNK_BYTES(TSDB_CHUNK_READINGS);
+    if(scratch == NULL) return -1;
+
+    for(long i = 0; i < db->index_count && !stop; i++){
+        const tsdb_index_entry_t* entry = &(db->index[i]);
+        if(tsdb_prune(range, &(entry->header))){
+            db->stats.chunks_pruned++;
+            continue;
+        }
+        size_t length = TSDB_CHUNK_BYTES(entry->header.count);
+        if(length > scratch_length){
+            uint8_t* grown = realloc(scratch, length);
+            if(grown == NULL){
+                total = -1;
+                break;
+            }
+            scratch = grown;
+            scratch_length = length;
+        }
+        if(pread(db->segment_fds[entry->segment], scratch, length, entry->offset) != (ssize_t) length){
+            total = -1;
+            break;
+        }
+        db->stats.chunks_scanned++;
+        const int64_t* ts = (const int64_t*)(scratch + sizeof(tsdb_chunk_header_t));
+        const double* value = (const double*)(ts + entry->header.count);
+        stop = tsdb_scan_columns(range, entry->header.sensor_id, ts, value, entry->header.count, batch, &batched, &total, f, arg);
+    }
+    free(scratch);
+
+    // the readings that are still in memory
+    for(int i = 0; i < db->active_count && !stop && total >= 0; i++){
+        const tsdb_chunk_t* chunk = db->chunks[db->active[i]];
+        if(chunk->header.count == 0 || tsdb_prune(range, &(chunk->header))) continue;
+        stop = tsdb_scan_columns(range, chunk->header.sensor_id, chunk->ts, chunk->value, chunk->header.count, batch, &batched, &total, f, arg);
+    }
+    if(!stop && total >= 0 && batched > 0) f(arg, batch, batched);
+    return total;
+}
+
+void tsdb_get_stats(tsdb_t* db, tsdb_stats_t* stats){
+    *stats = db->stats;
+    stats->segments = db->segment_count;
+    stats->chunks_indexed = db->index_count;
+}
+
+int tsdb_close(tsdb_t** db){
+    if(db == NULL || *db == NULL) return 0;
+    tsdb_t* engine = *db;
+    int result = 0;
+    for(int i = 0; i < engine->active_count; i++){
+        tsdb_chunk_t* chunk = engine->chunks[engine->active[i]];
+        if(chunk->header.count > 0 && tsdb_seal(engine, chunk) != 0) result = -1;
+    }
+    if(engine->segment_count > 0){
+        if(tsdb_write_buffer(engine) != 0 || fdatasync(engine->segment_fds[engine->segment_count - 1]) != 0) result = -1;
+    }
+    if(result != 0) fprintf(stderr, "TSDB: NOT EVERY READING COULD BE WRITTEN\n");
+
+    for(int i = 0; i < engine->active_count; i++) free(engine->chunks[engine->active[i]]);
+    for(int i = 0; i < engine->segment_count; i++) close(engine->segment_fds[i]);
+    free(engine->segment_fds);
+    free(engine->index);
+    free(engine->buffer);
+    free(engine->active);
+    free(engine->dir);
+    free(engine);
+    *db = NULL;
+    return result;
+}
+
+static void tsdb_segment_path(const tsdb_t* db, int number, char* path, size_t length){
+    snprintf(path, length, "%s/%s_%06d.seg", db->dir, TSDB_PREFIX, number);
+}
+
+static int tsdb_add_segment(tsdb_t* db, int fd){
+    if(db->segment_count == db->segment_capacity){
+        int capacity = (db->segment_capacity == 0) ? 16 : db->segment_capacity * 2;
+        int* grown = realloc(db->segment_fds, capacity * sizeof(int));
+        if(grown == NULL){
+            close(fd);
+            return -1;
+        }
+        db->segment_fds = grown;
+        db->segment_capacity = capacity;
+    }
+    db->segment_fds[db->segment_count++] = fd;
+    return 0;
+}
+
+// starts the next segment, the previous one is complete and goes to disk first
+static int tsdb_new_segment(tsdb_t* db){
+    if(db->segment_count > 0){
+        if(tsdb_write_buffer(db) != 0 || fdatasync(db->segment_fds[db->segment_count - 1]) != 0) return -1;
+    }
+    char path[PATH_MAX];
+    tsdb_segment_path(db, db->segment_count, path, sizeof(path));
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        fprintf(stderr, "TSDB: CANNOT CREATE %s\n", path);
+        return -1;
+    }
+    if(write(fd, TSDB_MAGIC, TSDB_MAGIC_LENGTH) != TSDB_MAGIC_LENGTH || tsdb_add_segment(db, fd) != 0){
+        close(fd);
+        return -1;
+    }
+    db->segment_size = TSDB_MAGIC_LENGTH;
+    db->stats.bytes_written += TSDB_MAGIC_LENGTH;
+    return 0;
+}
+
+// rebuilds the index entries of a segment from its chunk headers, a torn chunk at the end is cut off
+static int tsdb_load_segment(tsdb_t* db, int fd){
+    struct stat st;
+    char magic[TSDB_MAGIC_LENGTH];
+    if(fstat(fd, &st) != 0) return -1;
+    if(st.st_size < TSDB_MAGIC_LENGTH){
+        // created but never written
+        if(ftruncate(fd, 0) != 0 || write(fd, TSDB_MAGIC, TSDB_MAGIC_LENGTH) != TSDB_MAGIC_LENGTH) return -1;
+        db->segment_size = TSDB_MAGIC_LENGTH;
+        return 0;
+    }
+    if(pread(fd, magic, TSDB_MAGIC_LENGTH, 0) != TSDB_MAGIC_LENGTH || memcmp(magic, TSDB_MAGIC, TSDB_MAGIC_LENGTH) != 0) return -1;
+
+    off_t offset = TSDB_MAGIC_LENGTH;
+    while(offset < st.st_size){
+        tsdb_chunk_header_t header;
+        if(pread(fd, &header, sizeof(header), offset) != sizeof(header) || header.count == 0
+            || offset + (off_t) TSDB_CHUNK_BYTES(header.count) > st.st_size){
+            fprintf(stderr, "TSDB: CUTTING OFF A TORN CHUNK AT OFFSET %ld\n", (long) offset);
+            if(ftruncate(fd, offset) != 0) return -1;
+            break;
+        }
+        if(tsdb_add_index(db, &header, db->segment_count - 1, offset) != 0) return -1;
+        offset += TSDB_CHUNK_BYTES(header.count);
+    }
+    db->segment_size = offset;
+    return 0;
+}
+
+static int tsdb_add_index(tsdb_t* db, const tsdb_chunk_header_t* header, int segment, off_t offset){
+    if(db->index_count == db->index_capacity){
+        long capacity = (db->index_capacity == 0) ? 1024 : db->index_capacity * 2;
+        tsdb_index_entry_t* grown = realloc(db->index, capacity * sizeof(tsdb_index_entry_t));
+        if(grown == NULL) return -1;
+        db->index = grown;
+        db->index_capacity = capacity;
+    }
+    db->index[db->index_count++] = (tsdb_index_entry_t){ *header, segment, offset };
+    return 0;
+}
+
+// moves an open chunk into the write buffer as a header and two columns, and indexes it
+static int tsdb_seal(tsdb_t* db, tsdb_chunk_t* chunk){
+    uint32_t count = chunk->header.count;
+    size_t length = TSDB_CHUNK_BYTES(count);
+    if(db->segment_size + (off_t) length > TSDB_SEGMENT_BYTES && db->segment_size > TSDB_MAGIC_LENGTH && tsdb_new_segment(db) != 0)
+        return -1;
+    if(db->buffered + length > TSDB_WRITE_BUFFER && tsdb_write_buffer(db) != 0) return -1;
+    if(tsdb_add_index(db, &(chunk->header), db->segment_count - 1, db->segment_size) != 0) return -1;
+
+    uint8_t* position = db->buffer + db->buffered;
+    memcpy(position, &(chunk->header), sizeof(tsdb_chunk_header_t));
+    position += sizeof(tsdb_chunk_header_t);
+    memcpy(position, chunk->ts, count * sizeof(int64_t));
+    memcpy(position + count * sizeof(int64_t), chunk->value, count * sizeof(double));
+    db->buffered += length;
+    db->segment_size += length;
+    db->stats.chunks_sealed++;
+    chunk->header.count = 0;
+    return 0;
+}
+
+static int tsdb_write_buffer(tsdb_t* db){
+    size_t written = 0;
+    int fd = db->segment_fds[db->segment_count - 1];
+    while(written < db->buffered){
+        ssize_t n = write(fd, db->buffer + written, db->buffered - written);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0){
+            // keep what was not written for the next attempt
+            memmove(db->buffer, db->buffer + written, db->buffered - written);
+            db->buffered -= written;
+            db->stats.bytes_written += written;
+            return -1;
+        }
+        written += n;
+    }
+    db->stats.bytes_written += written;
+    db->buffered = 0;
+    return 0;
+}
+
+// true if no reading of the chunk can match the range
+static bool tsdb_prune(const db_range_t* range, const tsdb_chunk_header_t* header){
+    return (range->sensor_id != DB_ANY_SENSOR && header->sensor_id != range->sensor_id)
+        || header->max_ts < range->from || header->min_ts > range->to
+        || header->max_value < range->min_value || header->min_value > range->max_value;
+}
+
+// adds the matching readings of a chunk to the batch and hands full batches to the callback, true to stop the query
+static bool tsdb_scan_columns(const db_range_t* range, sensor_id_t id, const int64_t* ts, const double* value, uint32_t count,
+    sensor_data_t* batch, int* batched, long* total, batch_callback_t f, void* arg){
+    for(uint32_t i = 0; i < count; i++){
+        if(ts[i] < range->from || ts[i] > range->to || value[i] < range->min_value || value[i] > range->max_value) continue;
+        batch[*batched] = (sensor_data_t){ id, value[i], (sensor_ts_t) ts[i] };
+        (*batched)++;
+        (*total)++;
+        bool limit_reached = (range->limit > 0 && *total >= range->limit);
+        if(*batched == DB_CURSOR_BATCH || limit_reached){
+            int n = *batched;
+            *batched = 0;
+            if(f(arg, batch, n) != 0 || limit_reached) return true;
+        }
+    }
+    return false;
+}
+
+// the engine as a storage backend
+static void* tsdb_backend_open(char clear_up_flag){
+    return tsdb_open(TSDB_DIR, clear_up_flag);
+}
+
+static int tsdb_backend_insert_batch(void* handle, const sensor_data_t* batch, int count){
+    return tsdb_insert_batch(handle, batch, count);
+}
+
+static int tsdb_backend_flush(void* handle){
+    return tsdb_flush(handle);
+}
+
+static long tsdb_backend_query_range(void* handle, const db_range_t* range, batch_callback_t f, void* arg){
+    return tsdb_query(handle, range, f, arg);
+}
+
+static void tsdb_backend_close(void* handle){
+    tsdb_t* db = handle;
+    tsdb_close(&db);
+}
+
+const storage_backend_t storage_tsdb = {
+    "tsdb", tsdb_backend_open, tsdb_backend_insert_batch, tsdb_backend_flush, tsdb_backend_query_range, tsdb_backend_close
+};
@@ -0,0 +1,115 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _TSDB_H_
+#define _TSDB_H_
+
+#include "config.h"
+#include "sensor_db.h"
+#include "storage.h"
+
+// readings per chunk, every sensor fills its own chunk in memory before it is appended to a segment
+#ifndef TSDB_CHUNK_READINGS
+#define TSDB_CHUNK_READINGS 1024
+#endif
+
+// a new segment file is started once the current one reaches this size
+#ifndef TSDB_SEGMENT_BYTES
+#define TSDB_SEGMENT_BYTES (64L * 1024 * 1024)
+#endif
+
+// sealed chunks are collected in a buffer of this size before they are written
+#ifndef TSDB_WRITE_BUFFER
+#define TSDB_WRITE_BUFFER (1024 * 1024)
+#endif
+
+// a flush also seals the chunks that have been open for this long, it bounds what a crash can lose
+#ifndef TSDB_MAX_OPEN_MS
+#define TSDB_MAX_OPEN_MS 60000
+#endif
+
+// directory and file name prefix of the segments: <TSDB_DIR>/<TSDB_PREFIX>_<number>.seg
+#ifndef TSDB_DIR
+#define TSDB_DIR "."
+#endif
+
+#ifndef TSDB_PREFIX
+#define TSDB_PREFIX "sensor_tsdb"
+#endif
+
+/*
+ * Segment format: the magic "TSD1", then chunks of
+ *     uint16 sensor_id, uint16 reserved, uint32 count, int64 min_ts, int64 max_ts, double min_value, double max_value,
+ *     'count' int64 timestamps, 'count' double values
+ * in the byte order of the machine that wrote it. The (sensor_id, min_ts, max_ts) -> offset index is rebuilt from the
+ * chunk headers when the engine is opened, a torn chunk at the end of the last segment is cut off.
+ */
+
+typedef struct tsdb tsdb_t;
+
+typedef struct {
+    unsigned long readings;             // readings inserted
+    unsigned long chunks_sealed;        // chunks appended to a segment
+    unsigned long chunks_indexed;       // chunks in the index, including the ones found when opening
+    unsigned long segments;             // segment files
+    unsigned long bytes_written;
+    unsigned long chunks_scanned;       // chunks read by queries
+    unsigned long chunks_pruned;        // chunks skipped by queries on their index entry
+} tsdb_stats_t;
+
+// the engine as a storage backend, see storage.h
+extern const storage_backend_t storage_tsdb;
+
+/**
+ * Opens the engine on the segments in a directory
+ * \param dir the directory of the segment files
+ * \param clear_up_flag if the existing segments should be removed
+ * \return the engine, or NULL if a segment can not be opened or created
+ */
+tsdb_t* tsdb_open(const char* dir, char clear_up_flag);
+
+/**
+ * Adds readings to the open chunks of their sensors, full chunks are sealed and appended
+ * A batch that fails is partly applied: the readings before the one whose chunk could not be sealed are kept, that
+ * reading and the ones after it are not. The full chunk stays in memory and is sealed again by the next insert or flush.
+ * \param db a pointer to the engine
+ * \param batch the readings
+ * \param count the number of readings in 'batch'
+ * \return zero for success, -1 if a chunk could not be written
+ */
+int tsdb_insert_batch(tsdb_t* db, const sensor_data_t* batch, int count);
+
+/**
+ * Writes the sealed chunks to the segment, after sealing the full chunks and the ones open for more than TSDB_MAX_OPEN_MS
+ * \param db a pointer to the engine
+ * \return zero for success, -1 if an error occurs
+ */
+int tsdb_flush(tsdb_t* db);
+
+/**
+ * Streams the readings that match 'range' to a callback, chunks are skipped on their sensor and time range
+ * Readings come chunk by chunk in the order they were inserted, the open chunks last.
+ * \param db a pointer to the engine
+ * \param range the predicates of the query
+ * \param f called for every batch, a non-zero return value ends the query early
+ * \param arg passed as the first argument of every callback
+ * \return the number of readings handed to the callback, -1 if an error occurs
+ */
+long tsdb_query(tsdb_t* db, const db_range_t* range, batch_callback_t f, void* arg);
+
+/**
+ * Copies the counters of the engine
+ * \param db a pointer to the engine
+ * \param stats filled out with the counters
+ */
+void tsdb_get_stats(tsdb_t* db, tsdb_stats_t* stats);
+
+/**
+ * Seals every open chunk, writes and syncs the segment and frees the engine
+ * \param db a double pointer to the engine, set to NULL
+ * \return zero for success, -1 if not everything could be written
+ */
+int tsdb_close(tsdb_t** db);
+
+#endif /* _TSDB_H_ */
@@ -0,0 +1,104 @@
+/**
+ * \author Alken Rrokaj
+ */
+#define _GNU_SOURCE
+
+#include <string.h>
+#include "config.h"
+#include "window.h"
+
+// helper methods
+static void window_release(event_window_t* window, const sensor_data_t* data, window_callback_t on_window, void* arg);
+static void window_close_pane(event_window_t* window, window_callback_t on_window, void* arg);
+
+int window_add(event_window_t* window, const sensor_data_t* data, window_callback_t on_window, void* arg){
+    if(data->ts < window->watermark){
+        window->late++;
+        return WINDOW_LATE;
+    }
+
+    // insertion sort, the buffer is small and readings mostly arrive in order
+    int i = window->reorder_count;
+    while(i > 0 && window->reorder[i - 1].ts > data->ts){
+        window->reorder[i] = window->reorder[i - 1];
+        i--;
+    }
+    window->reorder[i] = *data;
+    window->reorder_count++;
+
+    if(data->ts > window->max_ts) window->max_ts = data->ts;
+    if(window->max_ts - ALLOWED_LATENESS > window->watermark) window->watermark = window->max_ts - ALLOWED_LATENESS;
+
+    // release everything behind the watermark, and the oldest reading when the buffer overflows
+    int released = 0;
+    while(released < window->reorder_count
+        && (window->reorder[released].ts < window->watermark || window->reorder_count - released > REORDER_BUFFER_LENGTH)){
+        // a forced release moves the watermark, nothing older may come in after it
+        if(window->reorder[released].ts > window->watermark) window->watermark = window->reorder[released].ts;
+        window_release(window, &(window->reorder[released]), on_window, arg);
+        released++;
+    }
+    if(released > 0){
+        window->reorder_count -= released;
+        memmove(window->reorder, window->reorder + released, window->reorder_count * sizeof(sensor_data_t));
+    }
+    return WINDOW_ACCEPTED;
+}
+
+void window_flush(event_window_t* window, window_callback_t on_window, void* arg){
+    for(int i = 0; i < window->reorder_count; i++) window_release(window, &(window->reorder[i]), on_window, arg);
+    window->reorder_count = 0;
+    if(!window->pane_open) return;
+
+    // the pane being filled closes early, anything before the next pane is late from now on
+    window_close_pane(window, on_window, arg);
+    window->watermark = window->pane_start;
+}
+
+// adds a reading in timestamp order to its pane, closing the panes before it
+static void window_release(event_window_t* window, const sensor_data_t* data, window_callback_t on_window, void* arg){
+    sensor_ts_t pane_start = data->ts - (data->ts % WINDOW_SLIDE);
+    if(!window->pane_open){
+        window->pane_start = pane_start;
+        window->pane_open = true;
+    }
+
+    // after WINDOW_PANES empty panes the window is empty, skip the rest of a gap at once
+    int closed = 0;
+    while(window->pane_start < pane_start){
+        if(closed == WINDOW_PANES){
+            window->pane_start = pane_start;
+            break;
+        }
+        window_close_pane(window, on_window, arg);
+        closed++;
+    }
+
+    window->pane_sum[window->pane_position] += data->value;
+    window->pane_count[window->pane_position]++;
+}
+
+// reports the window ending with the current pane and starts a new pane
+static void window_close_pane(event_window_t* window, window_callback_t on_window, void* arg){
+    window_result_t result = {
+        .start = window->pane_start + WINDOW_SLIDE - WINDOW_LENGTH,
+        .end = window->pane_start + WINDOW_SLIDE,
+        .avg = 0, .count = 0
+    };
+
+    sensor_value_t sum = 0;
+    for(int i = 0; i < WINDOW_PANES; i++){
+        sum += window->pane_sum[i];
+        result.count += window->pane_count[i];
+    }
+    if(result.count > 0){
+        result.avg = sum / result.count;
+        on_window(arg, &result);
+    }
+
+    // the oldest pane drops out of the window
+    window->pane_position = (window->pane_position + 1) % WINDOW_PANES;
+    window->pane_sum[window->pane_position] = 0;
+    window->pane_count[window->pane_position] = 0;
+    window->pane_start += WINDOW_SLIDE;
+}
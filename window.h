@@ -0,0 +1,47 @@
+/**
+ * \author Alken Rrokaj
+ */
+
+#ifndef _WINDOW_H_
+#define _WINDOW_H_
+
+#include "config.h"
+
+#define WINDOW_ACCEPTED 0
+#define WINDOW_LATE 1
+
+// structure to hold a closed time window
+typedef struct {
+    sensor_ts_t start;      // first second in the window
+    sensor_ts_t end;        // first second after the window
+    sensor_value_t avg;     // average of the readings in the window
+    uint32_t count;         // number of readings in the window
+} window_result_t;
+
+typedef void (*window_callback_t)(void* arg, const window_result_t* result);
+
+/**
+ * Adds a reading to the event time window of a sensor
+ * The reading is held back in the reorder buffer until it is ALLOWED_LATENESS seconds behind the newest reading (or the buffer is full),
+ * then it is added to the pane of WINDOW_SLIDE seconds it belongs to. Every time a pane closes, the window of the last WINDOW_LENGTH seconds
+ * is passed to 'on_window' (windows without readings are skipped).
+ * Readings older than the watermark are not added, the late counter of the window is incremented instead.
+ * \param window the window state of the sensor
+ * \param data the new reading
+ * \param on_window called for every window that closes
+ * \param arg passed to 'on_window'
+ * \return WINDOW_ACCEPTED if the reading was added, WINDOW_LATE if it arrived too late
+ */
+int window_add(event_window_t* window, const sensor_data_t* data, window_callback_t on_window, void* arg);
+
+/**
+ * Releases every reading held back in the reorder buffer and closes the pane being filled, for a sensor that stops
+ * The last window is passed to 'on_window' even though its pane is not over yet. Readings from before the next pane
+ * are late afterwards.
+ * \param window the window state of the sensor
+ * \param on_window called for every window that closes
+ * \param arg passed to 'on_window'
+ */
+void window_flush(event_window_t* window, window_callback_t on_window, void* arg);
+
+#endif /* _WINDOW_H_ */